@@ -0,0 +1,110 @@
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "best_offset_prefetcher.hh"
+#include "util.hh"
+
+/// Score that ends a phase early
+static const int scoreMax = 31;
+
+/// Rounds before a phase ends anyway
+static const int roundMax = 100;
+
+/// Best scores at or below this turn prefetching off
+static const int badScore = 1;
+
+static const int pageBits = 12;
+
+BestOffsetPrefetcher::BestOffsetPrefetcher(int line_size, int degree) :
+    Prefetcher(line_size, degree), recentRequests(256, -1), nextOffset(0),
+    round(0), bestOffset(1), phases(0), phasesOff(0)
+{
+    assert(line_size < (1 << pageBits));
+    // Products of 2, 3 and 5 up to 64, both directions
+    int page_lines = 1 << (pageBits - lineBits);
+    for (int d = 1; d <= 64 && d < page_lines; d++) {
+        int n = d;
+        for (int factor : {2, 3, 5}) {
+            while (n % factor == 0) n /= factor;
+        }
+        if (n == 1) {
+            offsets.push_back(d);
+            offsets.push_back(-d);
+        }
+    }
+    scores.resize(offsets.size(), 0);
+}
+
+void BestOffsetPrefetcher::printStats(const std::string& name)
+{
+    Prefetcher::printStats(name);
+    std::cout << name << " BO best offset:   " << bestOffset << std::endl;
+    std::cout << name << " BO phases:        " << phases << std::endl;
+    std::cout << name << " BO phases off:    " << phasesOff << std::endl;
+}
+
+void BestOffsetPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    if (hit && !prefetched) return;
+
+    int64_t line = address >> lineBits;
+
+    // Learn
+    int64_t base = line - offsets[nextOffset];
+    if (base >= 0 && recentRequests[rrIndex(base)] == base) {
+        scores[nextOffset]++;
+    }
+    bool done = scores[nextOffset] >= scoreMax;
+    if (++nextOffset == (int)offsets.size()) {
+        nextOffset = 0;
+        done = done || ++round >= roundMax;
+    }
+    if (done) {
+        endPhase();
+    }
+
+    // Prefetch
+    if (bestOffset == 0) return;
+    int64_t page = line >> (pageBits - lineBits);
+    for (int i = 1; i <= degree; i++) {
+        int64_t target = line + (int64_t)i * bestOffset;
+        if (target < 0 || target >> (pageBits - lineBits) != page) break;
+        queuePrefetch((uint64_t)target << lineBits);
+    }
+}
+
+void BestOffsetPrefetcher::notifyFill(uint64_t line_address, bool prefetch)
+{
+    int64_t line = line_address >> lineBits;
+    if (prefetch) {
+        line -= bestOffset;
+    } else if (bestOffset != 0) {
+        return;
+    }
+    if (line >= 0) {
+        recentRequests[rrIndex(line)] = line;
+    }
+}
+
+void BestOffsetPrefetcher::endPhase()
+{
+    int best = 0;
+    for (size_t i = 1; i < scores.size(); i++) {
+        if (scores[i] > scores[best]) {
+            best = i;
+        }
+    }
+    bestOffset = scores[best] > badScore ? offsets[best] : 0;
+    DPRINT("Best offset is now " << bestOffset << " (score " << scores[best]
+           << ")");
+
+    phases++;
+    if (bestOffset == 0) {
+        phasesOff++;
+    }
+    std::fill(scores.begin(), scores.end(), 0);
+    nextOffset = 0;
+    round = 0;
+}
@@ -0,0 +1,69 @@
+
+#ifndef CSIM_BEST_OFFSET_PREFETCHER_H
+#define CSIM_BEST_OFFSET_PREFETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "prefetcher.hh"
+
+/**
+ * Best-offset prefetcher (after Michaud, BOP). Prefetches line X + D on an
+ * access to line X, where the offset D is learned.
+ *
+ * Learning runs in phases. Lines that were just filled go into a recent
+ * requests table: X - D for a prefetched line X, or X itself while
+ * prefetching is off. On each miss (or first use of a prefetched line) to X
+ * one candidate offset d is tested, scoring a point if X - d is in the
+ * table, i.e., a prefetch with offset d would have arrived by now. A phase
+ * ends when an offset reaches the maximum score or every offset has been
+ * tested enough rounds. The best offset wins; if its score is too low
+ * prefetching turns off until the next phase.
+ *
+ * With a degree above one, lines X + D, X + 2D, ... are prefetched.
+ * Prefetches do not cross 4KB pages.
+ */
+class BestOffsetPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of lines to prefetch on each miss
+     */
+    BestOffsetPrefetcher(int line_size, int degree = 1);
+
+    void printStats(const std::string& name) override;
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+    void notifyFill(uint64_t line_address, bool prefetch) override;
+
+  private:
+    /**
+     * Pick the best offset and start a new learning phase.
+     */
+    void endPhase();
+
+    int rrIndex(int64_t line) { return (line ^ (line >> 8)) % recentRequests.size(); }
+
+    /// Offsets tested, in lines
+    std::vector<int> offsets;
+
+    std::vector<int> scores;
+
+    /// Line numbers of recent fills (minus the offset), -1 if empty
+    std::vector<int64_t> recentRequests;
+
+    /// Next offset to test and how many times all of them have been
+    int nextOffset;
+    int round;
+
+    /// Current best offset, 0 when prefetching is off
+    int bestOffset;
+
+    int64_t phases;
+    int64_t phasesOff;
+};
+
+#endif // CSIM_BEST_OFFSET_PREFETCHER_H
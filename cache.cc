@@ -1,22 +1,220 @@
 
+#include <algorithm>
 #include <cassert>
+#include <iostream>
 
 #include "cache.hh"
-#include "memory.hh"
-#include "processor.hh"
+#include "util.hh"
 
-Cache::Cache(int64_t size, Memory& memory, Processor& processor) : size(size), memory(memory), processor(processor)
+Cache::Cache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int credits) :
+    ResponsePort(credits), size(size), lineSize(line_size),
+    lineBits(log2int(line_size)), addrSize(addr_size), memSide(mem_side),
+    name("cache"), hits(0), misses(0), inclusion(NonInclusive),
+    backInvalidations(0), invalidatedLines(0), dirtyInvalidations(0),
+    tagLatency(0), dataLatency(0), bankFree(1, 0), bankConflicts(0),
+    bankWaitTicks(0), dataAccesses(0), earlyRestarts(0),
+    earlyRestartTicks(0), tagEnergy(0), dataEnergy(0),
+    leakageEnergy(0), extraEnergy(0)
 {
-    memory.setCache(this);
-    processor.setCache(this);
+    memSide.setRequestor(this);
 }
 
-void Cache::sendResponse(int request_id, const uint8_t* data)
+Cache::~Cache()
 {
-    processor.receiveResponse(request_id, data);
+    std::cout << name << " hits:   " << hits << std::endl;
+    std::cout << name << " misses: " << misses << std::endl;
+    if (inclusion == Inclusive) {
+        std::cout << name << " back-invalidations:       " << backInvalidations << std::endl;
+        std::cout << name << " lines invalidated above:  " << invalidatedLines << std::endl;
+        std::cout << name << " dirty back-invalidations: " << dirtyInvalidations << std::endl;
+    }
+    if (tagLatency + dataLatency > 0) {
+        std::cout << name << " hit latency:    " << tagLatency + dataLatency;
+        std::cout << " ticks (" << bankFree.size() << " banks)" << std::endl;
+        std::cout << name << " bank conflicts: " << bankConflicts << " (";
+        std::cout << bankWaitTicks << " ticks waited)" << std::endl;
+    }
+    if (earlyRestarts > 0) {
+        std::cout << name << " early restarts: " << earlyRestarts << " (";
+        std::cout << (float)earlyRestartTicks / earlyRestarts;
+        std::cout << " ticks before the fill)" << std::endl;
+    }
+    if (leakageEnergy > 0) {
+        double leakage = leakageEnergy * curTick() / 1000;
+        std::cout << name << " energy: " << getEnergy() << "nJ (";
+        std::cout << getEnergy() - leakage << "nJ dynamic, ";
+        std::cout << leakage << "nJ leakage)" << std::endl;
+    }
 }
 
-void Cache::sendMemRequest(uint64_t address, int size, const uint8_t* data, int request_id)
+void Cache::setTiming(int tag_latency, int data_latency, int banks)
 {
-    memory.receiveRequest(address, size, data, request_id);
+    assert(tag_latency >= 0 && data_latency >= 0);
+    assert(__builtin_popcount(banks) == 1);
+    tagLatency = tag_latency;
+    dataLatency = data_latency;
+    bankFree.assign(banks, 0);
+}
+
+void Cache::setEnergy(double tag_energy, double data_energy, double leakage_energy)
+{
+    tagEnergy = tag_energy;
+    dataEnergy = data_energy;
+    leakageEnergy = leakage_energy;
+}
+
+double Cache::getEnergy()
+{
+    double energy = tagEnergy * (hits + misses) + dataEnergy * dataAccesses + extraEnergy;
+    return (energy + leakageEnergy * curTick()) / 1000;
+}
+
+void Cache::respond(uint64_t address, int size, int request_id, const uint8_t* data,
+                    int extra_ticks)
+{
+    dataAccesses++;
+    if (tagLatency + dataLatency == 0) {
+        sendResponse(request_id, data);
+        return;
+    }
+
+    int64_t start = startAccess(address, 1 + extra_ticks);
+    if (request_id < 0) return;
+
+    // A miss found out it missed a lookup ago, before it went below.
+    int lookup = 0;
+    auto it = lookups.find(request_id);
+    if (it != lookups.end()) {
+        lookup = it->second.ticks;
+        lookups.erase(it);
+    }
+
+    // Extra ticks hold up the bank just as long, so responses stay in order.
+    std::vector<uint8_t> copy;
+    if (data) {
+        copy.assign(data, data + size);
+    }
+    schedule(start + tagLatency + dataLatency + extra_ticks + lookup - curTick(), [this, request_id, copy]{
+        sendResponse(request_id, copy.empty() ? nullptr : copy.data());
+    });
+}
+
+int64_t Cache::startAccess(uint64_t address, int ticks)
+{
+    int64_t& free = bankFree[(address >> lineBits) & (bankFree.size() - 1)];
+    int64_t start = std::max(curTick(), free);
+    if (start > curTick()) {
+        bankConflicts++;
+        bankWaitTicks += start - curTick();
+    }
+    free = start + ticks; // Pipelined: the next access can start next tick
+    return start;
+}
+
+void Cache::lookupMiss(uint64_t address, int request_id)
+{
+    if (tagLatency + dataLatency == 0) return;
+    int64_t free = bankFree[(address >> lineBits) & (bankFree.size() - 1)];
+    int64_t start = startAccess(address, 1);
+    if (request_id >= 0) {
+        lookups[request_id] = {(int)(start - curTick()) + tagLatency, free};
+    }
+}
+
+void Cache::undoLookup(uint64_t address, int request_id)
+{
+    if (tagLatency + dataLatency == 0 || request_id < 0) return;
+    auto it = lookups.find(request_id);
+    assert(it != lookups.end());
+    int waited = it->second.ticks - tagLatency;
+    if (waited > 0) {
+        bankConflicts--;
+        bankWaitTicks -= waited;
+    }
+    bankFree[(address >> lineBits) & (bankFree.size() - 1)] = it->second.bankFree;
+    lookups.erase(it);
+}
+
+void Cache::restartEarly(int request_id, int size, const uint8_t* data)
+{
+    DPRINT("Early restart for id " << request_id);
+    earlyRestarts++;
+    auto it = lookups.find(request_id);
+    if (it == lookups.end()) {
+        earlyRestartTicks -= curTick(); // The fill adds its tick
+        sendResponse(request_id, data);
+        return;
+    }
+    int lookup = it->second.ticks;
+    lookups.erase(it);
+    earlyRestartTicks -= curTick() + lookup;
+    std::vector<uint8_t> copy(data, data + size);
+    schedule(lookup, [this, request_id, copy]{
+        sendResponse(request_id, copy.data());
+    });
+}
+
+void Cache::Arrivals::add(int request_size, int offset, int size,
+                          const uint8_t* beat)
+{
+    if (data.empty()) {
+        data.assign(request_size, 0);
+        valid.assign(request_size, false);
+    }
+    assert(offset + size <= (int)data.size());
+    for (int i = 0; i < size; i++) {
+        data[offset + i] = beat[i];
+        valid[offset + i] = true;
+    }
+}
+
+bool Cache::Arrivals::has(int offset, int size)
+{
+    if (valid.empty()) return false;
+    for (int i = offset; i < offset + size; i++) {
+        if (!valid[i]) return false;
+    }
+    return true;
+}
+
+void Cache::Arrivals::clear()
+{
+    data.clear();
+    valid.clear();
+}
+
+void Cache::receiveResponse(int request_id, const uint8_t* data)
+{
+    receiveMemResponse(request_id, data);
+}
+
+void Cache::receiveRetry()
+{
+    // The memory side has room again, so let the requestor try what we
+    // refused.
+    sendRetry();
+}
+
+bool Cache::sendMemRequest(uint64_t address, int size, const uint8_t* data, int request_id)
+{
+    assert(size <= lineSize && lineSize % size == 0); // A line or a sector
+    return memSide.receiveRequest(address, size, data, request_id);
+}
+
+bool Cache::sendEviction(uint64_t address, const uint8_t* data, bool dirty)
+{
+    if (!dirty && !memSide.wantsCleanEvictions()) return true;
+    return memSide.receiveEviction(address, lineSize, data, dirty);
+}
+
+void Cache::backInvalidate(uint64_t address, uint8_t* data, bool& dirty)
+{
+    assert(inclusion == Inclusive);
+    bool upper_dirty = false;
+    invalidatedLines += sendInvalidate(address, lineSize, data, upper_dirty);
+    backInvalidations++;
+    if (upper_dirty) {
+        dirtyInvalidations++;
+        dirty = true;
+    }
 }
@@ -3,27 +3,48 @@
 #define CSIM_CACHE_H
 
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
 
-class Memory;
-class Processor;
+#include "port.hh"
+#include "ticked_object.hh"
 
-class Cache
+class Cache : public TickedObject, public ResponsePort, public RequestPort
 {
   public:
+    /**
+     * How the lines in this cache relate to the lines in the caches above.
+     */
+    enum InclusionPolicy {
+        /// No rule: a line can be here, above, or both
+        NonInclusive,
+        /// Everything above is also here. Evicting a line here removes it
+        /// from the caches above (back-invalidation).
+        Inclusive,
+        /// Nothing above is also here. Lines move up on a hit and are only
+        /// filled by lines evicted from above.
+        Exclusive
+    };
+
     /**
      * @param size is the *total* size of the cache in bytes
-     * @param the memory that is below this cache
-     * @param processor this cache is connected tos
+     * @param line_size is the size of a line in this cache in bytes
+     * @param mem_side is what is below this cache (another cache or memory)
+     * @param addr_size is the number of bits in the address
+     * @param credits is the number of misses that can be outstanding
      */
-    Cache(int64_t size, Memory& memory, Processor& processor);
+    Cache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int credits = 1);
 
     /**
      * Virtual destructor. Please override in sub classes
      */
-    virtual ~Cache() { }
+    virtual ~Cache();
 
     /**
-     * Called when the processors sends load or store request.
+     * Called when the processors (or the cache above) sends load or store
+     * request.
      * All requests can be assummed to be naturally aligned (e.g., a 4 byte
      * request will be aligned to a 4 byte boundary)
      *
@@ -40,8 +61,8 @@ class Cache
     virtual bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) = 0;
 
     /**
-     * Called when memory id finished processing a request.
-     * Data will always be the length of memory.getLineSize()
+     * Called when the memory side finished processing a request.
+     * Data will always be the length of getLineSize()
      *
      * @param request_id is the id assigned to this request in sendMemRequest
      * @param data is the data from memory (length of data is line length)
@@ -49,38 +70,258 @@ class Cache
      */
     virtual void receiveMemResponse(int request_id, const uint8_t* data) = 0;
 
+    /**
+     * Responses from the memory side are handled by receiveMemResponse.
+     */
+    void receiveResponse(int request_id, const uint8_t* data) override;
+
+    /**
+     * Called when the memory side has room again after refusing this cache.
+     */
+    void receiveRetry() override;
+
+    /**
+     * Exclusive caches want every line evicted from above, clean or dirty.
+     */
+    bool wantsCleanEvictions() override { return inclusion == Exclusive; }
+
+    /**
+     * Fill addresses with the address of every valid line.
+     */
+    virtual void getValidLines(std::vector<uint64_t>& addresses) = 0;
+
+    /**
+     * Hand every dirty line (or the dirty bytes of one) this cache still
+     * holds to write, older copies first. Used at the end of a run to flush
+     * the caches for the final check of memory.
+     */
+    virtual void getDirtyData(
+            const std::function<void(uint64_t, int, const uint8_t*)>& write) = 0;
+
+    /**
+     * @return the line size in bytes
+     */
+    int getLineSize() { return lineSize; }
+
+    /**
+     * @return the size of the cache in bytes
+     */
+    int64_t getSize() { return size; }
+
+    /**
+     * Set how this cache's lines relate to the caches above it.
+     * Must be called before the simulation starts.
+     */
+    void setInclusionPolicy(InclusionPolicy policy) { inclusion = policy; }
+
+    /**
+     * Set the name used when printing statistics (e.g., "L1")
+     */
+    void setName(const std::string& name) { this->name = name; }
+
+    /**
+     * Give accesses a latency instead of responding right away. The cache
+     * has banks (a power of 2) picked by the low bits of the line address.
+     * A bank is pipelined: it starts one access per tick, and accesses to a
+     * busy bank wait for it. Must be called before the simulation starts.
+     *
+     * @param tag_latency and data_latency add up to the time from when an
+     *        access starts until its response. 0 and 0 responds right away.
+     *        A miss also waits tag_latency for its lookup before it goes
+     *        below.
+     */
+    void setTiming(int tag_latency, int data_latency, int banks = 1);
+
+    /**
+     * Count the energy of this cache's accesses (see SRAMModel).
+     *
+     * @param tag_energy and data_energy are in pJ per access
+     * @param leakage_energy is in pJ per tick
+     */
+    void setEnergy(double tag_energy, double data_energy, double leakage_energy);
+
+    /**
+     * @return the energy used so far in nJ, 0 if setEnergy() was not called
+     */
+    double getEnergy();
+
   protected:
     /**
-     * Send a response to the procesor.
+     * The bytes of a miss's data that have arrived in beats, ahead of the
+     * response (see RequestPort::receiveBeat).
+     */
+    struct Arrivals
+    {
+        std::vector<uint8_t> data;
+        std::vector<bool> valid;
+
+        /**
+         * Copy in a beat. The first one sizes the buffer.
+         *
+         * @param request_size is the size of the data that was requested
+         */
+        void add(int request_size, int offset, int size, const uint8_t* beat);
+
+        /**
+         * @return true if [offset, offset + size) has all arrived
+         */
+        bool has(int offset, int size);
+
+        void clear();
+    };
+
+    /**
+     * Answer a read from bytes that arrived before its line was filled
+     * (early restart). The data goes around the data array and its
+     * latency, but still waits for the miss's lookup (see lookupMiss()).
+     *
+     * @param size is the number of bytes of data to send back
+     */
+    void restartEarly(int request_id, int size, const uint8_t* data);
+
+    /**
+     * Look up the tags for a miss. Like a hit, the lookup starts an access
+     * on the address's bank, and the miss's response comes the lookup's
+     * ticks later. Call it before the miss goes below, which may answer
+     * right away.
+     */
+    void lookupMiss(uint64_t address, int request_id);
+
+    /**
+     * Take back lookupMiss() for a miss the memory side refused.
+     */
+    void undoLookup(uint64_t address, int request_id);
+
+    /**
+     * Send the response to an access to a line, after the hit latency and
+     * any wait for the line's bank (see setTiming()), plus the lookup of a
+     * miss. Writes without a response (negative ids) still use the bank.
+     *
+     * @param size is the number of bytes of data to send back
+     * @param data is copied, so it may change once this returns
+     * @param extra_ticks is added to the latency and keeps the bank busy
+     *        that much longer (e.g., a second probe)
+     */
+    void respond(uint64_t address, int size, int request_id, const uint8_t* data,
+                 int extra_ticks = 0);
+
+    /**
+     * Start an access on an address's bank, waiting for it if it is busy.
      *
-     * @param request_id is the id that the processor used when it called
-     *        receiveRequest
-     * @param data is the data for the request. This data will only be read.
+     * @param ticks is how long the access keeps the bank
+     * @return the tick the access starts
      */
-    void sendResponse(int request_id, const uint8_t* data);
+    int64_t startAccess(uint64_t address, int ticks);
 
     /**
-     * Send a request to get data from main memory.
+     * Send a request to the memory side.
      *
      * @param address of the request
-     * @param size of the request. NOTE: This must be the same as the memory
-     *        line size.
+     * @param size of the request. NOTE: This must be the same as the line
+     *        size.
      * @param when writing back to memory, data is a pointer to the data to
      *        write back. When reading it is nullptr.
      * @param request_id the id that must be used when replying to this request
      *        NOTE: You may choose any request id you want and the memory will
      *        use that id when it replies.
+     *        NOTE: Check memSide.checkCredit() before sending a read.
+     *
+     * @return false if the memory side refused the request. It will send a
+     *         retry later.
+     */
+    bool sendMemRequest(uint64_t address, int size, const uint8_t* data, int request_id);
+
+    /**
+     * Hand an evicted line to the memory side. Clean lines are only sent if
+     * the memory side wants them.
+     *
+     * @return false if the memory side refused the line. It will send a
+     *         retry later.
+     */
+    bool sendEviction(uint64_t address, const uint8_t* data, bool dirty);
+
+    /**
+     * Remove a line that is leaving an inclusive cache from the caches
+     * above.
+     *
+     * @param data is the line. Dirty data from above is copied into it.
+     * @param dirty is set to true if dirty data was copied
      */
-    void sendMemRequest(uint64_t address, int size, const uint8_t* data, int request_id);
+    void backInvalidate(uint64_t address, uint8_t* data, bool& dirty);
 
     /// Size of cache in bytes
     int64_t size;
 
-    /// Memory below this cache
-    Memory &memory;
+    /// Size of a line in bytes
+    int lineSize;
+
+    /// log2(lineSize)
+    int lineBits;
+
+    /// Number of bits in the address
+    int addrSize;
+
+    /// The cache or memory below this cache
+    ResponsePort &memSide;
+
+    /// Name used when printing statistics
+    std::string name;
+
+    /// Requests that hit
+    int64_t hits;
+
+    /// Requests that missed
+    int64_t misses;
+
+    InclusionPolicy inclusion;
+
+    /// Lines evicted while inclusive, which are removed from above
+    int64_t backInvalidations;
+
+    /// Lines above that were removed by back-invalidations
+    int64_t invalidatedLines;
+
+    /// Back-invalidations that got dirty data from above
+    int64_t dirtyInvalidations;
+
+    /// Ticks to read the tags and the data, 0 if accesses take no time
+    int tagLatency;
+    int dataLatency;
+
+    /// The tick each bank can start its next access
+    std::vector<int64_t> bankFree;
+
+    /// Accesses that waited for a busy bank, and for how long in total
+    int64_t bankConflicts;
+    int64_t bankWaitTicks;
+
+    struct Lookup
+    {
+        /// Ticks from the miss until its tags were read
+        int ticks;
+
+        /// The bank's free tick before the lookup took it
+        int64_t bankFree;
+    };
+
+    /// The lookups of misses whose responses have not been sent, by id
+    std::map<int, Lookup> lookups;
+
+    /// Reads and writes of the data array (responses and fills)
+    int64_t dataAccesses;
+
+    /// Reads answered before their lines were filled, and the ticks they
+    /// were answered ahead of the fills
+    int64_t earlyRestarts;
+    int64_t earlyRestartTicks;
+
+    /// pJ per tag lookup and data access, and leakage pJ per tick
+    double tagEnergy;
+    double dataEnergy;
+    double leakageEnergy;
 
-    /// Processor that is sending this cache requests.
-    Processor &processor;
+    /// pJ used by work the counts above miss (e.g., zcache walks)
+    double extraEnergy;
 };
 
 #endif // CSIM_CACHE_H
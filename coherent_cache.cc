@@ -0,0 +1,222 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "coherent_cache.hh"
+#include "util.hh"
+
+CoherentCache::CoherentCache(int64_t size, int line_size, int addr_size,
+                             int ways, SnoopingBus& bus, int core,
+                             int wb_entries) :
+    SetAssociativeCache(size, line_size, bus.getPort(core), addr_size, ways,
+                        wb_entries),
+    bus(bus), core(core),
+    lineStates(size / line_size, SnoopingBus::Invalid),
+    pending({-1, 0, 0, {}, SnoopingBus::BusRd, {}}),
+    upgrades(0), invalidations(0), supplied(0)
+{
+    bus.setCache(core, this);
+}
+
+CoherentCache::~CoherentCache()
+{
+    std::cout << name << " coherence: ";
+    std::cout << (bus.getProtocol() == SnoopingBus::MOESI ? "MOESI" : "MESI") << std::endl;
+    std::cout << name << " upgrades:      " << upgrades << std::endl;
+    std::cout << name << " invalidations: " << invalidations << std::endl;
+    std::cout << name << " lines supplied: " << supplied << std::endl;
+}
+
+bool CoherentCache::receiveRequest(uint64_t address, int size,
+                                   const uint8_t* data, int request_id)
+{
+    if (!checkCredit()) {
+        DPRINT("Cache is blocked!");
+        return false;
+    }
+
+    int line = hit(address);
+    SnoopingBus::LineState state = line >= 0 ? lineStates[line] : SnoopingBus::Invalid;
+    if (line >= 0 && (!data || state == SnoopingBus::Modified ||
+                      state == SnoopingBus::Exclusive)) {
+        if (data && state == SnoopingBus::Exclusive) {
+            // Nobody else has it, so nobody needs to hear about it
+            bus.transition(state, SnoopingBus::Modified, 0);
+            lineStates[line] = SnoopingBus::Modified;
+        }
+        return SetAssociativeCache::receiveRequest(address, size, data,
+                                                   request_id);
+    }
+
+    uint64_t block_address = address & ~(uint64_t)(lineSize - 1);
+    if (!writebackBuffer.hasSpace()) {
+        DPRINT("Writeback buffer is full!"); // For the victim
+        writebackBuffer.kick();
+        return refuse();
+    }
+    if (line < 0 && writebackBuffer.holds(block_address)) {
+        // Our own dirty copy is on its way out. Others may share it (it may
+        // have been Owned), so let it reach the bus and ask for it again.
+        writebackBuffer.flush();
+        return refuse();
+    }
+
+    pending.requestId = request_id;
+    pending.address = address;
+    pending.size = size;
+    pending.data.clear();
+    if (data) {
+        pending.data.assign(data, data + size);
+    }
+    pending.line.clear();
+    if (line >= 0) {
+        pending.type = SnoopingBus::BusUpgr;
+        pending.line.assign(dataArray.getLine(line), dataArray.getLine(line) + lineSize);
+    } else {
+        pending.type = data ? SnoopingBus::BusRdX : SnoopingBus::BusRd;
+    }
+
+    writebackBuffer.reserve(); // The victim is evicted when the line arrives
+    takeCredit();
+    // Last: the bus may complete the transaction before this returns.
+    if (!bus.request(core, pending.type, block_address, request_id)) {
+        writebackBuffer.unreserve();
+        undoCredit();
+        return refuse();
+    }
+    if (pending.type == SnoopingBus::BusUpgr) {
+        upgrades++;
+    }
+    misses++;
+    return true;
+}
+
+void CoherentCache::receiveMemResponse(int request_id, const uint8_t* data)
+{
+    assert(0); // The bus calls complete() instead
+}
+
+int CoherentCache::receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                                     bool& dirty)
+{
+    for (uint64_t block_address = address; block_address < address + size;
+         block_address += lineSize) {
+        int line = hit(block_address);
+        if (line >= 0) {
+            dropLine(line);
+        }
+    }
+    return SetAssociativeCache::receiveInvalidate(address, size, data, dirty);
+}
+
+void CoherentCache::complete(int request_id, const uint8_t* data, bool shared)
+{
+    assert(request_id == pending.requestId);
+    writebackBuffer.release();
+
+    uint64_t block_address = pending.address & ~(uint64_t)(lineSize - 1);
+    int line = hit(pending.address);
+    SnoopingBus::LineState from = line >= 0 ? lineStates[line] : SnoopingBus::Invalid;
+    SnoopingBus::LineState to = SnoopingBus::Modified;
+    if (pending.type == SnoopingBus::BusRd) {
+        to = shared ? SnoopingBus::Shared : SnoopingBus::Exclusive;
+    }
+
+    if (line < 0) {
+        // An upgrade whose line was invalidated from below still has the
+        // data it started with, and nobody has written it since.
+        assert(data || pending.type == SnoopingBus::BusUpgr);
+        int victim = findVictim(block_address);
+        if (tagArray.getState(victim) != Invalid) {
+            dropLine(victim);
+        }
+        evict(victim);
+        line = fillLine(block_address, data ? data : pending.line.data(), false);
+    }
+    bus.transition(from, to, from == SnoopingBus::Invalid ? lineSize : 0);
+    lineStates[line] = to;
+
+    accessLine(line, getBlockOffset(pending.address), pending.size,
+               pending.data.empty() ? nullptr : pending.data.data(),
+               pending.requestId);
+
+    pending.requestId = -1;
+    pending.data.clear();
+    pending.line.clear();
+    returnCredit();
+    writebackBuffer.kick();
+}
+
+bool CoherentCache::snoop(SnoopingBus::Transaction type, uint64_t line_address,
+                          uint8_t* data, bool& supplied, bool& flush)
+{
+    extraEnergy += tagEnergy; // Every snoop reads the tags
+
+    int line = hit(line_address);
+    if (line < 0) {
+        std::vector<uint8_t> buffered(lineSize);
+        bool dirty = false;
+        if (writebackBuffer.remove(line_address, buffered.data(), dirty) &&
+            dirty && type != SnoopingBus::BusUpgr) {
+            // The newest copy. A reader leaves it Shared, so it goes to
+            // memory as well.
+            memcpy(data, buffered.data(), lineSize);
+            supplied = true;
+            flush = flush || type == SnoopingBus::BusRd;
+            this->supplied++;
+        }
+        // An upgrader already has the data and now owns it
+        return false;
+    }
+
+    SnoopingBus::LineState state = lineStates[line];
+    SnoopingBus::LineState next = SnoopingBus::Invalid;
+    bool supplies = type != SnoopingBus::BusUpgr &&
+                    (state == SnoopingBus::Modified ||
+                     state == SnoopingBus::Owned ||
+                     state == SnoopingBus::Exclusive);
+    if (type == SnoopingBus::BusRd) {
+        next = state;
+        if (state == SnoopingBus::Exclusive) {
+            next = SnoopingBus::Shared;
+        } else if (state == SnoopingBus::Modified &&
+                   bus.getProtocol() == SnoopingBus::MOESI) {
+            next = SnoopingBus::Owned; // Stays dirty, and keeps supplying it
+        } else if (state == SnoopingBus::Modified) {
+            next = SnoopingBus::Shared;
+            flush = true; // Only memory can be the owner under MESI
+        }
+    }
+
+    if (supplies) {
+        memcpy(data, dataArray.getLine(line), lineSize);
+        supplied = true;
+        this->supplied++;
+    }
+    if (next != state || supplies) {
+        bus.transition(state, next, supplies ? lineSize : 0);
+    }
+    lineStates[line] = next;
+
+    if (next == SnoopingBus::Invalid) {
+        if (prefetchedLines[line]) {
+            prefetchesUseless++;
+            prefetchedLines[line] = false;
+        }
+        tagArray.setState(line, Invalid);
+        invalidations++;
+        return false;
+    }
+    bool dirty = next == SnoopingBus::Modified || next == SnoopingBus::Owned;
+    tagArray.setState(line, dirty ? Dirty : Valid);
+    return true;
+}
+
+void CoherentCache::dropLine(int line)
+{
+    SnoopingBus::LineState state = lineStates[line];
+    bool dirty = state == SnoopingBus::Modified || state == SnoopingBus::Owned;
+    bus.transition(state, SnoopingBus::Invalid, dirty ? lineSize : 0);
+    lineStates[line] = SnoopingBus::Invalid;
+}
@@ -0,0 +1,103 @@
+
+#ifndef CSIM_COHERENT_CACHE_H
+#define CSIM_COHERENT_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "set_assoc.hh"
+#include "snooping_bus.hh"
+
+/**
+ * A core's private cache on a SnoopingBus. Each line has a MESI (or MOESI)
+ * state on top of its valid and dirty bits.
+ *
+ * Reads hit in any state and writes hit in Modified or Exclusive (which
+ * becomes Modified without telling anyone). A write to a Shared or Owned
+ * line sends an upgrade, and a miss a read or read-exclusive, on the bus.
+ * Like the set associative cache, one miss or upgrade is outstanding at a
+ * time.
+ */
+class CoherentCache : public SetAssociativeCache
+{
+  public:
+    /**
+     * @param bus connects this cache to the other cores' caches and the
+     *        level below
+     * @param core is this cache's core on the bus
+     */
+    CoherentCache(int64_t size, int line_size, int addr_size, int ways,
+                  SnoopingBus& bus, int core, int wb_entries = 8);
+
+    ~CoherentCache() override;
+
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    /**
+     * Fills come from the bus (complete()), never from the memory side.
+     */
+    void receiveMemResponse(int request_id, const uint8_t* data) override;
+
+    int receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                          bool& dirty) override;
+
+    /**
+     * Finish this cache's bus transaction.
+     *
+     * @param data is the line, nullptr for an upgrade
+     * @param shared is true if another cache kept a copy
+     */
+    void complete(int request_id, const uint8_t* data, bool shared);
+
+    /**
+     * Another core's transaction for a line. The line (or a dirty copy in
+     * the writeback buffer) is shared or given up.
+     *
+     * @param data is set to the line if this cache supplies it
+     * @param supplied is set to true if this cache supplies the line
+     * @param flush is set to true if the line must also be written back
+     * @return true if this cache still has a copy
+     */
+    bool snoop(SnoopingBus::Transaction type, uint64_t line_address,
+               uint8_t* data, bool& supplied, bool& flush);
+
+  private:
+    /**
+     * Record that a line is leaving the cache.
+     */
+    void dropLine(int line);
+
+    struct PendingRequest
+    {
+        int requestId;
+        uint64_t address;
+        int size;
+        std::vector<uint8_t> data;
+        SnoopingBus::Transaction type;
+
+        /// The line being upgraded, in case it is invalidated from below
+        /// before the upgrade is done
+        std::vector<uint8_t> line;
+    };
+
+    SnoopingBus& bus;
+
+    int core;
+
+    /// The coherence state of each line
+    std::vector<SnoopingBus::LineState> lineStates;
+
+    PendingRequest pending;
+
+    /// Writes to Shared or Owned lines
+    int64_t upgrades;
+
+    /// Lines given up to other cores' writes
+    int64_t invalidations;
+
+    /// Lines sent to other cores
+    int64_t supplied;
+};
+
+#endif // CSIM_COHERENT_CACHE_H
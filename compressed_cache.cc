@@ -0,0 +1,218 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "compressed_cache.hh"
+#include "util.hh"
+
+CompressedCache::CompressedCache(int64_t size, int line_size,
+                                 ResponsePort& mem_side, int addr_size,
+                                 int ways, Compressor::Algorithm algorithm,
+                                 int tag_factor, int wb_entries) :
+    // Same sets, tag_factor times the lines in each
+    SetAssociativeCache(size * tag_factor, line_size, mem_side, addr_size,
+                        ways * tag_factor, wb_entries),
+    compressor(algorithm, line_size), tagFactor(tag_factor),
+    setBytes(ways * line_size), segmentSize(std::min(8, line_size)),
+    fillAddress(0), fillPending(false),
+    fillSizes(line_size / segmentSize, 0), fills(0), filledBytes(0),
+    setLines(0), decompressions(0), growthEvictions(0)
+{
+    assert(tag_factor > 0);
+    assert(wb_entries >= ways * tag_factor); // Room for a whole set of victims
+    this->size = size;
+    dataArray.setPhysicalSize(size);
+}
+
+CompressedCache::~CompressedCache()
+{
+    std::cout << name << " compression: " << compressor.getName() << ", ";
+    std::cout << tagFactor << "x tags" << std::endl;
+    std::cout << name << " compression ratio: ";
+    std::cout << (filledBytes ? (float)fills * lineSize / filledBytes : 1) << std::endl;
+    for (size_t i = 0; i < fillSizes.size(); i++) {
+        std::cout << name << " fills of " << (i + 1) * segmentSize << "B: ";
+        std::cout << fillSizes[i] << " (";
+        std::cout << (fills ? 100.0 * fillSizes[i] / fills : 0) << "%)" << std::endl;
+    }
+
+    // Lines held per physical line, at misses and at the end
+    std::vector<uint64_t> lines;
+    getValidLines(lines);
+    int physical_lines = size / lineSize;
+    int sets = indexMask + 1;
+    std::cout << name << " effective capacity: ";
+    std::cout << (misses ? 100.0 * setLines / misses * sets / physical_lines : 0);
+    std::cout << "% on average, " << 100.0 * lines.size() / physical_lines;
+    std::cout << "% at the end" << std::endl;
+
+    std::cout << name << " decompressions: " << decompressions << " (";
+    std::cout << compressor.getLatency() << " ticks each)" << std::endl;
+    std::cout << name << " growth evictions: " << growthEvictions << std::endl;
+}
+
+bool CompressedCache::receiveRequest(uint64_t address, int size,
+                                     const uint8_t* data, int request_id)
+{
+    if (!checkCredit()) {
+        return SetAssociativeCache::receiveRequest(address, size, data,
+                                                   request_id); // Refuses
+    }
+
+    int line = hit(address);
+    if (line >= 0) {
+        std::vector<int> victims;
+        if (data) {
+            // The write may make the line compress worse.
+            std::vector<uint8_t> written(dataArray.getLine(line),
+                                         dataArray.getLine(line) + lineSize);
+            memcpy(&written[getBlockOffset(address)], data, size);
+            victims = chooseVictims(address, line, storedSize(written.data()));
+            int writebacks = countWritebacks(victims);
+            if (!writebackBuffer.hasSpace(writebacks)) {
+                DPRINT("Writeback buffer is full!");
+                writebackBuffer.kick(writebacks);
+                return refuse();
+            }
+        }
+        if (!SetAssociativeCache::receiveRequest(address, size, data,
+                                                 request_id)) {
+            return false;
+        }
+        // Only now that the write is in does the set need the room.
+        for (int victim : victims) {
+            DPRINT("Compressed line grew, evicting 0x" << std::hex << getLineAddress(victim) << std::dec);
+            evict(victim);
+        }
+        growthEvictions += victims.size();
+        return true;
+    }
+
+    if (!memSide.checkCredit()) {
+        return SetAssociativeCache::receiveRequest(address, size, data,
+                                                   request_id); // Refuses
+    }
+
+    // Count the lines in the set before making room.
+    int set_lines = 0;
+    for (int way = 0; way < numberOfWays; way++) {
+        if (tagArray.getState(getLine(address, way)) != Invalid) {
+            set_lines++;
+        }
+    }
+
+    // The new line might not compress at all. The victims are evicted when
+    // it is filled (see findVictim()).
+    fillVictims = chooseVictims(address, -1, lineSize);
+    fillAddress = address;
+    fillPending = true;
+    if (!SetAssociativeCache::receiveRequest(address, size, data, request_id)) {
+        fillPending = false;
+        fillVictims.clear();
+        return false;
+    }
+    setLines += set_lines;
+    line = hit(address);
+    if (fillPending && line >= 0) {
+        recordFill(line); // Recovered without going to memory
+    }
+    return true;
+}
+
+void CompressedCache::receiveMemResponse(int request_id, const uint8_t* data)
+{
+    SetAssociativeCache::receiveMemResponse(request_id, data);
+    int line = hit(fillAddress);
+    if (fillPending && line >= 0) {
+        recordFill(line);
+    }
+}
+
+int CompressedCache::missWritebacks()
+{
+    return countWritebacks(fillVictims);
+}
+
+int CompressedCache::findVictim(uint64_t address, int core)
+{
+    for (int line : fillVictims) {
+        DPRINT("Compressed set is full, evicting 0x" << std::hex << getLineAddress(line) << std::dec);
+        evict(line); // Nothing if it was invalidated since
+    }
+    fillVictims.clear();
+    return SetAssociativeCache::findVictim(address, core); // A free tag
+}
+
+int CompressedCache::storedSize(const uint8_t* data)
+{
+    int bytes = compressor.compressedSize(data);
+    return (bytes + segmentSize - 1) / segmentSize * segmentSize;
+}
+
+std::vector<int> CompressedCache::chooseVictims(uint64_t address, int keep,
+                                               int bytes)
+{
+    int used = bytes;
+    bool free_tag = keep >= 0;
+    std::vector<int> candidates;
+    for (int way = 0; way < numberOfWays; way++) {
+        int line = getLine(address, way);
+        if (tagArray.getState(line) == Invalid) {
+            free_tag = true;
+        }
+        else if (line != keep) {
+            used += storedSize(dataArray.getLine(line));
+            candidates.push_back(line);
+        }
+    }
+
+    // Clean lines first, then random ones
+    std::vector<int> victims;
+    while (used > setBytes || !free_tag) {
+        assert(!candidates.empty());
+        size_t pick = rand() % candidates.size();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (tagArray.getState(candidates[i]) != Dirty) {
+                pick = i;
+                break;
+            }
+        }
+        victims.push_back(candidates[pick]);
+        used -= storedSize(dataArray.getLine(candidates[pick]));
+        free_tag = true;
+        candidates.erase(candidates.begin() + pick);
+    }
+    return victims;
+}
+
+int CompressedCache::countWritebacks(const std::vector<int>& victims)
+{
+    // Clean lines are written back too if memory wants them or if the
+    // caches above might hand back dirty data.
+    int writebacks = 0;
+    for (int line : victims) {
+        if (tagArray.getState(line) == Dirty || inclusion == Inclusive ||
+            memSide.wantsCleanEvictions()) {
+            writebacks++;
+        }
+    }
+    return writebacks;
+}
+
+int CompressedCache::hitPenalty(int line, const uint8_t* data)
+{
+    if (data || storedSize(dataArray.getLine(line)) == lineSize) return 0;
+    decompressions++;
+    return compressor.getLatency(); // Before the data can be sent
+}
+
+void CompressedCache::recordFill(int line)
+{
+    fillPending = false;
+    int bytes = storedSize(dataArray.getLine(line));
+    fillSizes[bytes / segmentSize - 1]++;
+    filledBytes += bytes;
+    fills++;
+}
@@ -0,0 +1,121 @@
+
+#ifndef CSIM_COMPRESSED_CACHE_H
+#define CSIM_COMPRESSED_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "compressor.hh"
+#include "set_assoc.hh"
+
+/**
+ * A set associative cache that compresses its lines, so that a set can hold
+ * more lines than it has physical ways.
+ *
+ * Each set has tag_factor times as many tags as physical ways (decoupled
+ * tags). The data of a set is a pool of ways * line size bytes, which
+ * lines use in segments of 8 bytes according to how well they compress. A
+ * line is evicted when its set runs out of tags or bytes, including when a
+ * write makes a line compress worse.
+ *
+ * The simulator keeps every line uncompressed, so the data array is
+ * tag_factor times larger than what is counted as SRAM.
+ */
+class CompressedCache : public SetAssociativeCache
+{
+  public:
+    /**
+     * @param size is the physical size of the cache in bytes
+     * @param ways is the number of physical ways
+     * @param algorithm is how lines are compressed
+     * @param tag_factor is the number of tags for each physical way
+     */
+    CompressedCache(int64_t size, int line_size, ResponsePort& mem_side,
+                    int addr_size, int ways, Compressor::Algorithm algorithm,
+                    int tag_factor = 2, int wb_entries = 8);
+
+    ~CompressedCache() override;
+
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    void receiveMemResponse(int request_id, const uint8_t* data) override;
+
+  protected:
+    /**
+     * A read hit on a compressed line waits for the decompressor.
+     */
+    int hitPenalty(int line, const uint8_t* data) override;
+
+    /**
+     * The victims picked for the miss, which may be none.
+     */
+    int missWritebacks() override;
+
+    /**
+     * Evict the victims picked for the miss, then take a free tag.
+     */
+    int findVictim(uint64_t address, int core = -1) override;
+
+  private:
+    /**
+     * @return the bytes a line's data takes in its set
+     */
+    int storedSize(const uint8_t* data);
+
+    /**
+     * Pick the lines to evict from the address's set so that it has the
+     * bytes for one more line and, on a miss, a free tag.
+     *
+     * @param keep is the line being written, -1 on a miss
+     * @param bytes is the size the new or written line needs
+     */
+    std::vector<int> chooseVictims(uint64_t address, int keep, int bytes);
+
+    /**
+     * @return the writeback entries evicting the victims takes
+     */
+    int countWritebacks(const std::vector<int>& victims);
+
+    /**
+     * Count a line that was just filled in the statistics.
+     */
+    void recordFill(int line);
+
+    Compressor compressor;
+
+    /// Tags per physical way
+    int tagFactor;
+
+    /// Bytes of data each set can hold
+    int setBytes;
+
+    /// Lines take space in multiples of this many bytes
+    int segmentSize;
+
+    /// The address of the miss being filled, if fillPending
+    uint64_t fillAddress;
+    bool fillPending;
+
+    /// The lines picked at the miss to make room for its fill
+    std::vector<int> fillVictims;
+
+    /// Fills by the number of segments they took, fewest first
+    std::vector<int64_t> fillSizes;
+
+    int64_t fills;
+
+    /// Sum of the bytes filled lines took, for the compression ratio
+    int64_t filledBytes;
+
+    /// Sum over misses of the lines in the set, for the average capacity
+    int64_t setLines;
+
+    /// Hits on lines that had to be decompressed
+    int64_t decompressions;
+
+    /// Lines evicted because a write made a line in their set bigger
+    int64_t growthEvictions;
+};
+
+#endif // CSIM_COMPRESSED_CACHE_H
@@ -0,0 +1,135 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "compressor.hh"
+
+/// Decompression latencies from the BDI and FPC papers
+static const int bdiLatency = 1;
+static const int fpcLatency = 5;
+
+/**
+ * @return the little-endian word of size bytes at data, sign extended
+ */
+static int64_t readWord(const uint8_t* data, int size)
+{
+    uint64_t value = 0;
+    memcpy(&value, data, size);
+    int shift = 64 - size * 8;
+    return (int64_t)(value << shift) >> shift;
+}
+
+/**
+ * @return true if value fits in a signed integer of size bytes
+ */
+static bool fits(int64_t value, int size)
+{
+    int64_t limit = (int64_t)1 << (size * 8 - 1);
+    return value >= -limit && value < limit;
+}
+
+Compressor::Compressor(Algorithm algorithm, int line_size) :
+    algorithm(algorithm), lineSize(line_size)
+{
+    assert(lineSize >= 8);
+}
+
+int Compressor::compressedSize(const uint8_t* line)
+{
+    return std::min(algorithm == BDI ? bdiSize(line) : fpcSize(line), lineSize);
+}
+
+int Compressor::getLatency()
+{
+    return algorithm == BDI ? bdiLatency : fpcLatency;
+}
+
+std::string Compressor::getName()
+{
+    return algorithm == BDI ? "BDI" : "FPC";
+}
+
+int Compressor::bdiSize(const uint8_t* line)
+{
+    bool zeros = true;
+    bool repeated = true;
+    for (int i = 0; i < lineSize; i += 8) {
+        zeros = zeros && readWord(line + i, 8) == 0;
+        repeated = repeated && readWord(line + i, 8) == readWord(line, 8);
+    }
+    if (zeros) return 1;
+    if (repeated) return 8;
+
+    // Base size and delta size, smallest compressed size first
+    static const int encodings[][2] = {
+        {8, 1}, {4, 1}, {8, 2}, {2, 1}, {4, 2}, {8, 4}
+    };
+    int best = lineSize;
+    for (auto& encoding : encodings) {
+        int word_size = encoding[0];
+        int delta_size = encoding[1];
+        int size = word_size + (lineSize / word_size) * delta_size;
+        if (size < best && fitsBaseDelta(line, word_size, delta_size)) {
+            best = size;
+        }
+    }
+    return best;
+}
+
+bool Compressor::fitsBaseDelta(const uint8_t* line, int word_size, int delta_size)
+{
+    bool have_base = false;
+    int64_t base = 0;
+    for (int i = 0; i < lineSize; i += word_size) {
+        int64_t word = readWord(line + i, word_size);
+        if (fits(word, delta_size)) continue; // Delta from the zero base
+
+        if (!have_base) {
+            base = word; // The first word that needs one is the base
+            have_base = true;
+        }
+        // The delta wraps around in a word of word_size bytes
+        uint64_t delta = (uint64_t)word - (uint64_t)base;
+        if (!fits(readWord((uint8_t*)&delta, word_size), delta_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Compressor::fpcSize(const uint8_t* line)
+{
+    int bits = 0;
+    int zero_run = 0;
+    for (int i = 0; i < lineSize; i += 4) {
+        int32_t word = readWord(line + i, 4);
+        if (word == 0) {
+            // Up to 8 zero words share one 3-bit run length
+            if (zero_run == 0) bits += 3 + 3;
+            zero_run = (zero_run + 1) % 8;
+            continue;
+        }
+        zero_run = 0;
+
+        int16_t low = word & 0xffff;
+        int16_t high = word >> 16;
+        uint8_t byte = word & 0xff;
+        if (word >= -8 && word < 8) {
+            bits += 3 + 4; // 4-bit sign extended
+        } else if (fits(word, 1)) {
+            bits += 3 + 8; // One byte sign extended
+        } else if (fits(word, 2)) {
+            bits += 3 + 16; // Halfword sign extended
+        } else if (low == 0) {
+            bits += 3 + 16; // Halfword padded with a zero halfword
+        } else if (fits(low, 1) && fits(high, 1)) {
+            bits += 3 + 16; // Two halfwords, each a sign extended byte
+        } else if ((uint32_t)word == byte * 0x01010101u) {
+            bits += 3 + 8; // Repeated bytes
+        } else {
+            bits += 3 + 32; // Uncompressed
+        }
+    }
+    return (bits + 7) / 8;
+}
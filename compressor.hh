@@ -0,0 +1,67 @@
+
+#ifndef CSIM_COMPRESSOR_H
+#define CSIM_COMPRESSOR_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Works out how small a line of data would be with one of two cache
+ * compression algorithms. Only the size is computed; the data itself stays
+ * uncompressed in the simulator.
+ *
+ * BDI (Base-Delta-Immediate, Pekhimenko et al.) stores the line as one
+ * base of 2, 4 or 8 bytes plus a small delta per word. Words close to zero
+ * use zero as an implicit second base. All-zero and repeated-value lines
+ * are special cases.
+ *
+ * FPC (Frequent Pattern Compression, Alameldeen and Wood) encodes each
+ * 32-bit word on its own with a 3-bit prefix: runs of zeros, small sign
+ * extended values, halfwords padded with zeros and repeated bytes.
+ */
+class Compressor
+{
+  public:
+    enum Algorithm {
+        BDI,
+        FPC
+    };
+
+    /**
+     * @param line_size is the size of a line in bytes, at least 8
+     */
+    Compressor(Algorithm algorithm, int line_size);
+
+    /**
+     * @return the size of the line in bytes once compressed, never more
+     *         than the line size
+     */
+    int compressedSize(const uint8_t* line);
+
+    /**
+     * @return the number of ticks it takes to decompress a line
+     */
+    int getLatency();
+
+    /**
+     * @return "BDI" or "FPC"
+     */
+    std::string getName();
+
+  private:
+    int bdiSize(const uint8_t* line);
+
+    int fpcSize(const uint8_t* line);
+
+    /**
+     * @return true if every word of word_size bytes is within a delta of
+     *         delta_size bytes from zero or from one common base
+     */
+    bool fitsBaseDelta(const uint8_t* line, int word_size, int delta_size);
+
+    Algorithm algorithm;
+
+    int lineSize;
+};
+
+#endif // CSIM_COMPRESSOR_H
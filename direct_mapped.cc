@@ -1,45 +1,66 @@
 
+#include <cassert>
 #include <cstring>
+#include <iostream>
+#include <vector>
 
 #include "direct_mapped.hh"
-#include "memory.hh"
-#include "processor.hh"
 #include "util.hh"
 
-DirectMappedCache::DirectMappedCache(int64_t size, Memory& memory, Processor& processor) :
-    Cache(size, memory, processor),
-    tagBits(processor.getAddrSize() - log2int(size / memory.getLineSize()) - memory.getLineBits()),
-    indexMask(size / memory.getLineSize() - 1),
-    tagArray(size / memory.getLineSize(), 2, tagBits),								 
-    dataArray(size / memory.getLineSize(), memory.getLineSize()),
-    blocked(false), mshr({-1,0,0,nullptr})
+DirectMappedCache::DirectMappedCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size) :
+    Cache(size, line_size, mem_side, addr_size),
+    tagBits(addrSize - log2int(size / lineSize) - lineBits),
+    indexMask(size / lineSize - 1),
+    indexFunction(size / lineSize),
+    tagArray(size / lineSize, 2, tagBits),
+    dataArray(size / lineSize, lineSize),
+    victimCache(nullptr), mshr({-1,0,0,{},{},false})
 {
 
 }
 
+DirectMappedCache::~DirectMappedCache()
+{
+    if (indexFunction.getKind() != IndexFunction::Modulo) {
+        std::cout << name << " index: " << indexFunction.getName() << " (";
+        std::cout << indexFunction.getUsedSets() << " sets)" << std::endl;
+    }
+    if (victimCache) {
+        victimCache->printStats(name);
+    }
+}
+
 int64_t DirectMappedCache::getIndex(uint64_t address)
 {
-    return (address >> memory.getLineBits()) & indexMask;
+    return indexFunction.getIndex(address >> lineBits);
 }
 
 int DirectMappedCache::getBlockOffset(uint64_t address)
 {
-    return address & (memory.getLineSize() - 1);
+    return address & (lineSize - 1);
 }
 
 uint64_t DirectMappedCache::getTag(uint64_t address)
 {
-    return address >> (processor.getAddrSize() - tagBits);
+    return indexFunction.getTag(address >> lineBits);
+}
+
+void DirectMappedCache::setIndexFunction(IndexFunction::Kind kind)
+{
+    assert(kind != IndexFunction::Skewed); // One way, nothing to skew
+    indexFunction = IndexFunction(indexMask + 1, kind);
+    tagBits = addrSize - log2int(indexMask + 1) - lineBits + indexFunction.getExtraTagBits();
+    tagArray.setTagBits(tagBits);
 }
 
 bool DirectMappedCache::receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id)
 {
-    assert(size <= memory.getLineSize()); // within line size
+    assert(size <= lineSize); // within line size
     // within address range
-    assert(address < ((uint64_t)1 << processor.getAddrSize()));
+    assert(address < ((uint64_t)1 << addrSize));
     assert((address &  (size - 1)) == 0); // naturally aligned
 
-    if (blocked) {
+    if (!checkCredit()) {
         DPRINT("Cache is blocked!");
         // Cache is currently blocked, so it cannot receive a new request
         return false;
@@ -47,8 +68,19 @@ bool DirectMappedCache::receiveRequest(uint64_t address, int size, const uint8_t
 
     int index = getIndex(address);
 
+    // A line swapped back in from the victim cache still counts as a miss.
+    bool swapped = false;
+    if (!hit(address) && victimCache) {
+        swapped = swapFromVictimCache(address);
+    }
+
     if (hit(address)) {
         DPRINT("Hit in cache");
+        if (swapped) {
+            misses++;
+            lookupMiss(address, request_id);
+        }
+        else hits++;
         // get a pointer to the data
         uint8_t* line = dataArray.getLine(index);
 
@@ -57,45 +89,55 @@ bool DirectMappedCache::receiveRequest(uint64_t address, int size, const uint8_t
         if (data) {
             // if this is a write, copy the data into the cache.
             memcpy(&line[block_offset], data, size);
-            sendResponse(request_id, nullptr);
+            respond(address, size, request_id, nullptr);
             // Mark dirty
             tagArray.setState(index, Dirty);
         } 
 		else {
             // This is a read so we need to return data
-            sendResponse(request_id, &line[block_offset]);
+            respond(address, size, request_id, &line[block_offset]);
         }
     } 
 	else {
         DPRINT("Miss in cache " << tagArray.getState(index));
-        if (dirty(address)) {
-            DPRINT("Dirty, writing back");
-            // If the line is dirty, then we need to evict it.
-            uint8_t* line = dataArray.getLine(index);
-            // Calculate the address of the writeback.
-            uint64_t wb_address =
-                tagArray.getTag(index) << (processor.getAddrSize() - tagBits);
-            wb_address |= (index << memory.getLineBits());
-            // No response for writes, no need for valid request_id
-            sendMemRequest(wb_address, memory.getLineSize(), line, -1);
+        if (!memSide.checkCredit()) {
+            DPRINT("Memory is full!");
+            // Try again when memory tells us it has room.
+            return refuse();
+        }
+        // Evict the line and mark it invalid.
+        if (!evict(index)) {
+            // Try again when memory tells us it has room.
+            return refuse();
         }
-        // Mark the line invalid.
-        tagArray.setState(index, Invalid);
-        // Forward to memory and block the cache.
-        // no need for req id since there is only one outstanding request.
-        // We need to read whether the request is a read or write.
-        uint64_t block_address = address & ~(memory.getLineSize() -1);
-        sendMemRequest(block_address, memory.getLineSize(), nullptr, 0);
-
         // remember the CPU's request id
         mshr.savedId = request_id;
         // Remember the address
         mshr.savedAddr = address;
         // Remember the data if it is a write.
         mshr.savedSize = size;
-        mshr.savedData = data;
+        mshr.savedData.clear();
+        if (data) {
+            mshr.savedData.assign(data, data + size);
+        }
         // Mark the cache as blocked
-        blocked = true;
+        takeCredit();
+
+        // Forward to memory. Send last: a cache below may respond before
+        // this call returns.
+        // no need for req id since there is only one outstanding request.
+        // We need to read whether the request is a read or write.
+        uint64_t block_address = address & ~(lineSize -1);
+        lookupMiss(address, request_id);
+        if (!sendMemRequest(block_address, lineSize, nullptr, 0)) {
+            undoLookup(address, request_id);
+            undoCredit();
+            return refuse();
+        }
+        misses++;
+        if (victimCache) {
+            victimCache->countMiss();
+        }
     }
 
     // We have accepted the request, so return true.
@@ -111,7 +153,7 @@ void DirectMappedCache::receiveMemResponse(int request_id, const uint8_t* data)
 
     // Copy the data into the cache.
     uint8_t* line = dataArray.getLine(index);
-    memcpy(line, data, memory.getLineSize());
+    memcpy(line, data, lineSize);
 
     assert(tagArray.getState(index) == Invalid);
 
@@ -124,22 +166,57 @@ void DirectMappedCache::receiveMemResponse(int request_id, const uint8_t* data)
     // Treat as a hit
     int block_offset = getBlockOffset(mshr.savedAddr);
 
-    if (mshr.savedData) {
+    if (!mshr.savedData.empty()) {
         // if this is a write, copy the data into the cache.
-        memcpy(&line[block_offset], mshr.savedData, mshr.savedSize);
-        sendResponse(mshr.savedId, nullptr);
+        memcpy(&line[block_offset], mshr.savedData.data(), mshr.savedSize);
+        respond(mshr.savedAddr, mshr.savedSize, mshr.savedId, nullptr);
         // Mark dirty
         tagArray.setState(index, Dirty);
+    } else if (mshr.answered) {
+        // Early restart already sent the data, so this is just the fill
+        earlyRestartTicks += curTick();
+        respond(mshr.savedAddr, mshr.savedSize, -1, nullptr);
     } else {
         // This is a read so we need to return data
-        sendResponse(mshr.savedId, &line[block_offset]);
+        respond(mshr.savedAddr, mshr.savedSize, mshr.savedId, &line[block_offset]);
     }
 
-    blocked = false;
     mshr.savedId = -1;
     mshr.savedAddr = 0;
     mshr.savedSize = 0;
-    mshr.savedData = nullptr;
+    mshr.savedData.clear();
+    mshr.arrivals.clear();
+    mshr.answered = false;
+    // Unblock, this lets the processor retry.
+    returnCredit();
+}
+
+void DirectMappedCache::receiveBeat(int request_id, int offset, int size, const uint8_t* data)
+{
+    assert(request_id == 0);
+    if (mshr.answered || !mshr.savedData.empty()) return; // Writes wait for the line
+
+    int block_offset = getBlockOffset(mshr.savedAddr);
+    mshr.arrivals.add(lineSize, offset, size, data);
+    if (mshr.arrivals.has(block_offset, mshr.savedSize)) {
+        mshr.answered = true;
+        restartEarly(mshr.savedId, mshr.savedSize, &mshr.arrivals.data[block_offset]);
+    }
+}
+
+int DirectMappedCache::getCriticalOffset(int request_id)
+{
+    assert(request_id == 0);
+    int block_offset = getBlockOffset(mshr.savedAddr);
+    if (mshr.savedId < 0) return block_offset;
+    return block_offset + requestor->getCriticalOffset(mshr.savedId);
+}
+
+int DirectMappedCache::getCore(int request_id)
+{
+    if (request_id < 0) return -1; // Our own writebacks
+    assert(request_id == 0);
+    return requestor->getCore(mshr.savedId);
 }
 
 bool DirectMappedCache::hit(uint64_t address)
@@ -151,9 +228,146 @@ bool DirectMappedCache::hit(uint64_t address)
     return (state == Valid || state == Dirty) && line_tag == getTag(address);
 }
 
+uint64_t DirectMappedCache::getLineAddress(int index)
+{
+    return indexFunction.getLineNumber(tagArray.getTag(index), index) << lineBits;
+}
+
 bool DirectMappedCache::dirty(uint64_t address)
 {
     int index = getIndex(address);
     State state = (State)tagArray.getState(index);
     return state == Dirty;
 }
+
+void DirectMappedCache::setVictimCache(VictimCache* victim_cache)
+{
+    victimCache = victim_cache;
+    // Dirty lines that fall out of the victim cache still need to get to
+    // memory. If the memory side refuses, the line stays and evict() fails.
+    victimCache->setEvictionCallback(
+        [this](uint64_t address, const uint8_t* data, bool dirty) {
+            return sendEviction(address, data, dirty);
+        });
+}
+
+bool DirectMappedCache::evict(int index)
+{
+    State state = (State)tagArray.getState(index);
+    if (state == Valid || state == Dirty) {
+        uint8_t* line = dataArray.getLine(index);
+        uint64_t line_address = getLineAddress(index);
+
+        if (victimCache && !victimCache->makeRoom()) {
+            // Keep the line until the memory side has room for the one
+            // leaving the victim cache.
+            return false;
+        }
+
+        if (inclusion == Inclusive) {
+            // Nothing above may keep the line.
+            bool upper_dirty = false;
+            backInvalidate(line_address, line, upper_dirty);
+            if (upper_dirty) {
+                state = Dirty;
+                tagArray.setState(index, Dirty);
+            }
+        }
+
+        if (victimCache) {
+            victimCache->insert(line_address, line, state == Dirty);
+        }
+        else {
+            if (state == Dirty) {
+                DPRINT("Dirty, writing back");
+            }
+            if (!sendEviction(line_address, line, state == Dirty)) {
+                // Keep the line until the memory side has room.
+                return false;
+            }
+        }
+    }
+    tagArray.setState(index, Invalid);
+    return true;
+}
+
+bool DirectMappedCache::swapFromVictimCache(uint64_t address)
+{
+    uint64_t block_address = address & ~(lineSize -1);
+    std::vector<uint8_t> swapped(lineSize);
+    bool swapped_dirty;
+    if (!victimCache->probe(block_address, swapped.data(), swapped_dirty)) {
+        return false;
+    }
+
+    // The current line takes the place of the one we got back.
+    int index = getIndex(address);
+    bool evicted = evict(index);
+    assert(evicted); // Evicting into the victim cache always works
+    (void)evicted;
+
+    memcpy(dataArray.getLine(index), swapped.data(), lineSize);
+    tagArray.setTag(index, getTag(address));
+    tagArray.setState(index, swapped_dirty ? Dirty : Valid);
+    return true;
+}
+
+int DirectMappedCache::receiveInvalidate(uint64_t address, int size, uint8_t* data, bool& dirty)
+{
+    assert(size % lineSize == 0); // Lines below are never smaller
+
+    int invalidated = 0;
+    std::vector<uint8_t> swapped(lineSize);
+    for (uint64_t block_address = address; block_address < address + size;
+         block_address += lineSize) {
+        uint8_t* block_data = &data[block_address - address];
+
+        // Take the line out of this cache or its victim cache.
+        bool swapped_dirty = false;
+        if (hit(block_address)) {
+            int index = getIndex(block_address);
+            if (tagArray.getState(index) == Dirty) {
+                memcpy(block_data, dataArray.getLine(index), lineSize);
+                dirty = true;
+            }
+            tagArray.setState(index, Invalid);
+            invalidated++;
+        }
+        else if (victimCache &&
+                 victimCache->probe(block_address, swapped.data(), swapped_dirty, false)) {
+            if (swapped_dirty) {
+                memcpy(block_data, swapped.data(), lineSize);
+                dirty = true;
+            }
+            invalidated++;
+        }
+
+        // Anything above is at least as new as this cache.
+        invalidated += sendInvalidate(block_address, lineSize, block_data, dirty);
+    }
+    return invalidated;
+}
+
+void DirectMappedCache::getValidLines(std::vector<uint64_t>& addresses)
+{
+    for (int index = 0; index < size / lineSize; index++) {
+        State state = (State)tagArray.getState(index);
+        if (state == Valid || state == Dirty) {
+            addresses.push_back(getLineAddress(index));
+        }
+    }
+}
+
+void DirectMappedCache::getDirtyData(
+        const std::function<void(uint64_t, int, const uint8_t*)>& write)
+{
+    // What was evicted is older than what is in the cache.
+    if (victimCache) {
+        victimCache->getDirtyData(write);
+    }
+    for (int index = 0; index < size / lineSize; index++) {
+        if (tagArray.getState(index) == Dirty) {
+            write(getLineAddress(index), lineSize, dataArray.getLine(index));
+        }
+    }
+}
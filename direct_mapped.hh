@@ -3,20 +3,29 @@
 #define CSIM_DIRECT_MAPPED_H
 
 #include <cstdint>
+#include <vector>
 
 #include "cache.hh"
+#include "index_function.hh"
 #include "tag_array.hh"
 #include "sram_array.hh"
+#include "victim_cache.hh"
 
 class DirectMappedCache: public Cache
 {
   public:
     /**
     * @param size is the *total* size of the cache in bytes
-    * @param the memory that is below this cache
-    * @param processor this cache is connected tos
+    * @param line_size is the size of a line in bytes
+    * @param mem_side is the cache or memory below this cache
+    * @param addr_size is the number of bits in the address
     */
-    DirectMappedCache(int64_t size, Memory& memory, Processor& processor);
+    DirectMappedCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size);
+
+    /**
+     * Destructor
+     */
+    ~DirectMappedCache() override;
 
     /**
      * Called when the processors sends load or store request.
@@ -34,8 +43,8 @@ class DirectMappedCache: public Cache
     bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) override;
 
     /**
-     * Called when memory id finished processing a request.
-     * Data will always be the length of memory.getLineSize()
+     * Called when the memory side finished processing a request.
+     * Data will always be the length of getLineSize()
      *
      * @param request_id is the id assigned to this request in sendMemRequest
      * @param data is the data from memory (length of data is line length)
@@ -43,6 +52,47 @@ class DirectMappedCache: public Cache
      */
     void receiveMemResponse(int request_id, const uint8_t* data) override;
 
+    /**
+     * A read waiting for the line is answered as soon as its bytes arrive.
+     */
+    void receiveBeat(int request_id, int offset, int size, const uint8_t* data) override;
+
+    /**
+     * @return the offset of the waiting request in the line
+     */
+    int getCriticalOffset(int request_id) override;
+
+    /**
+     * @return the core of the miss being fetched, from the cache above
+     */
+    int getCore(int request_id) override;
+
+    /**
+     * Attach a victim cache. Every line evicted from this cache goes to the
+     * victim cache, and misses look there before going to memory.
+     */
+    void setVictimCache(VictimCache* victim_cache);
+
+    /**
+     * Pick the lines' sets with something other than the low bits of the
+     * line number. Must be called before the cache is used.
+     */
+    void setIndexFunction(IndexFunction::Kind kind);
+
+    /**
+     * Removes lines from this cache, its victim cache and everything above
+     * it.
+     */
+    int receiveInvalidate(uint64_t address, int size, uint8_t* data, bool& dirty) override;
+
+    void getValidLines(std::vector<uint64_t>& addresses) override;
+
+    /**
+     * Includes its victim cache.
+     */
+    void getDirtyData(
+            const std::function<void(uint64_t, int, const uint8_t*)>& write) override;
+
   private:
 
     enum State {
@@ -72,25 +122,51 @@ class DirectMappedCache: public Cache
      */
     bool hit(uint64_t address);
 
+    /**
+     * @return the address of the data held at index
+     */
+    uint64_t getLineAddress(int index);
+
     /**
      * @return true if the line is dirty
      */
     bool dirty(uint64_t address);
 
+    /**
+     * Removes the line at index. It goes to the victim cache if there is
+     * one, otherwise it is written back if it is dirty (or handed to the
+     * memory side if it wants clean lines too).
+     *
+     * @return false if the memory side refused the writeback, or the line
+     *         the victim cache had to give up for it
+     */
+    bool evict(int index);
+
+    /**
+     * If the victim cache has the line for address, swap it with the line
+     * currently in its place.
+     *
+     * @return true if the line was swapped in
+     */
+    bool swapFromVictimCache(uint64_t address);
+
     /// Number of tag bits in the address
     int64_t tagBits;
 
     /// Mask for getting the index bits
     uint64_t indexMask;
 
+    /// Maps line numbers to sets and tags
+    IndexFunction indexFunction;
+
     /// The cache's tag array
     TagArray tagArray;
 
     /// The cache's data array
     SRAMArray dataArray;
 
-    /// If true, the cache is currently blocked
-    bool blocked;
+    /// Optional victim cache, nullptr if there is none
+    VictimCache* victimCache;
 
     struct MSHR 
 	{
@@ -104,7 +180,13 @@ class DirectMappedCache: public Cache
         int savedSize;
 
         /// This is the data that will be written after a miss
-        const uint8_t* savedData;
+        std::vector<uint8_t> savedData;
+
+        /// The part of the line that has arrived so far
+        Arrivals arrivals;
+
+        /// True if the read was answered before the fill
+        bool answered;
     };
 
     MSHR mshr;
@@ -0,0 +1,195 @@
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "coherent_cache.hh"
+#include "directory.hh"
+#include "util.hh"
+
+Directory::Directory(int cores, int line_size, ResponsePort& mem_side,
+                     Protocol protocol, int latency, int group, int entries,
+                     int ways, Replacement replacement, int lookup_latency) :
+    SnoopingBus(cores, line_size, mem_side, protocol, latency),
+    group(group), ways(ways), sets(entries / ways), replacement(replacement),
+    entries(entries, {false, 0, 0, 0}), useCounter(0), lookups(0),
+    allocations(0), blocked(0), evictions(0), dirtyEvictions(0),
+    invalidationsSent(0), linesInvalidated(0)
+{
+    assert(group > 0 && (cores + group - 1) / group <= 64);
+    assert(ways > 0 && sets > 0 && entries % ways == 0);
+    assert(lookup_latency >= 0);
+    lookupLatency = lookup_latency;
+}
+
+Directory::~Directory()
+{
+    std::cout << "Directory sharers:   ";
+    if (group == 1) {
+        std::cout << "full map" << std::endl;
+    } else {
+        std::cout << "coarse, " << group << " cores per bit" << std::endl;
+    }
+    std::cout << "Directory entries:   " << entries.size() << " (" << ways << " ways, ";
+    std::cout << (replacement == LRU ? "LRU" : "fewest sharers") << ")" << std::endl;
+    std::cout << "Directory lookups:   " << lookups << " (" << allocations << " new entries)" << std::endl;
+    std::cout << "Directory lookup latency: " << lookupLatency << " ticks each, ";
+    std::cout << lookups * lookupLatency << " in total" << std::endl;
+    std::cout << "Directory evictions: " << evictions << " (" << dirtyEvictions << " dirty)" << std::endl;
+    std::cout << "Directory invalidations: " << invalidationsSent << " sent, ";
+    std::cout << linesInvalidated << " lines removed" << std::endl;
+    std::cout << "Directory full:      " << blocked << std::endl;
+}
+
+int Directory::receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                                 bool& dirty)
+{
+    int invalidated = SnoopingBus::receiveInvalidate(address, size, data, dirty);
+    for (uint64_t line_address = address; line_address < address + size;
+         line_address += lineSize) {
+        // A line on its way to a core is still tracked
+        int entry = find(line_address);
+        if (entry >= 0 && !isBusy(line_address)) {
+            entries[entry].valid = false;
+        }
+    }
+    return invalidated;
+}
+
+bool Directory::lookup(int core, uint64_t line_address,
+                       std::vector<int>& targets)
+{
+    int entry = find(line_address);
+    if (entry < 0) {
+        // The entry is allocated by update(), once the transaction is sure
+        // to go ahead. Nobody has the line, so there is nobody to snoop.
+        if (findVictim(line_address) < 0) {
+            DPRINT("Directory set is busy");
+            blocked++;
+            return false;
+        }
+        lookups++;
+        return true;
+    }
+    lookups++;
+    entries[entry].lastUse = ++useCounter;
+    for (int i : getCores(entries[entry].sharers)) {
+        if (i != core) {
+            targets.push_back(i);
+        }
+    }
+    return true;
+}
+
+void Directory::update(int core, Transaction type, uint64_t line_address,
+                       const std::vector<int>& holders)
+{
+    int entry = find(line_address);
+    if (entry < 0) {
+        entry = allocate(line_address);
+        assert(entry >= 0); // lookup() made sure there is one
+        entries[entry].lastUse = ++useCounter;
+    }
+    // Every sharer was snooped, so the vector can start over.
+    entries[entry].sharers = getBit(core);
+    for (int i : holders) {
+        entries[entry].sharers |= getBit(i);
+    }
+}
+
+void Directory::writtenBack(int core, uint64_t line_address)
+{
+    int entry = find(line_address);
+    if (entry < 0 || group > 1) return; // The bit may cover other cores
+
+    entries[entry].sharers &= ~getBit(core);
+    if (entries[entry].sharers == 0) {
+        entries[entry].valid = false;
+    }
+}
+
+int Directory::find(uint64_t line_address)
+{
+    int64_t set = (line_address / lineSize) % sets;
+    for (int way = 0; way < ways; way++) {
+        Entry& entry = entries[set * ways + way];
+        if (entry.valid && entry.lineAddress == line_address) {
+            return set * ways + way;
+        }
+    }
+    return -1;
+}
+
+int Directory::findVictim(uint64_t line_address)
+{
+    int64_t set = (line_address / lineSize) % sets;
+    int victim = -1;
+    for (int way = 0; way < ways; way++) {
+        int entry = set * ways + way;
+        if (!entries[entry].valid) {
+            victim = entry;
+            break;
+        }
+        if (isBusy(entries[entry].lineAddress)) continue;
+        if (victim < 0) {
+            victim = entry;
+            continue;
+        }
+        int sharers = __builtin_popcountll(entries[entry].sharers);
+        int victim_sharers = __builtin_popcountll(entries[victim].sharers);
+        if (replacement == FewestSharers && sharers != victim_sharers) {
+            if (sharers < victim_sharers) {
+                victim = entry;
+            }
+        } else if (entries[entry].lastUse < entries[victim].lastUse) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+int Directory::allocate(uint64_t line_address)
+{
+    int victim = findVictim(line_address);
+    if (victim < 0) return -1;
+
+    if (entries[victim].valid) {
+        evict(victim);
+    }
+    entries[victim] = {true, line_address, 0, 0};
+    allocations++;
+    return victim;
+}
+
+void Directory::evict(int entry)
+{
+    uint64_t line_address = entries[entry].lineAddress;
+    DPRINT("Directory evicts 0x" << std::hex << line_address << std::dec);
+    evictions++;
+
+    std::vector<uint8_t> data(lineSize);
+    bool dirty = false;
+    for (int i : getCores(entries[entry].sharers)) {
+        invalidationsSent++;
+        linesInvalidated += caches[i]->receiveInvalidate(line_address, lineSize,
+                                                         data.data(), dirty);
+    }
+    if (dirty) {
+        dirtyEvictions++;
+        queueWriteback(line_address, data.data());
+    }
+    entries[entry].valid = false;
+}
+
+std::vector<int> Directory::getCores(uint64_t sharers)
+{
+    std::vector<int> cores;
+    for (int bit = 0; sharers; bit++, sharers >>= 1) {
+        if (!(sharers & 1)) continue;
+        int end = std::min((bit + 1) * group, (int)caches.size());
+        for (int i = bit * group; i < end; i++) {
+            cores.push_back(i);
+        }
+    }
+    return cores;
+}
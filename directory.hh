@@ -0,0 +1,135 @@
+
+#ifndef CSIM_DIRECTORY_H
+#define CSIM_DIRECTORY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "snooping_bus.hh"
+
+/**
+ * A sparse directory next to the shared level, in place of the bus's
+ * broadcast. Each entry tracks a line that the private caches may hold and
+ * a sharer vector, and a transaction only snoops the cores in the vector.
+ *
+ * With a full map each bit is one core. With coarse vectors each bit is a
+ * group of cores, which are all snooped, so the vector stays small with
+ * many cores at the cost of snoops to cores without the line.
+ *
+ * The entries are set associative. A line that needs an entry when its set
+ * is full evicts one (the least recently used, or the one with the fewest
+ * sharers), and every copy of the evicted line is invalidated. Entries of
+ * lines with a transaction in progress are not evicted; if that is all of
+ * them, the transaction waits.
+ *
+ * Clean lines leave the caches without telling the directory, so a vector
+ * can have cores that no longer hold the line. A full map forgets a core
+ * when it writes back the line.
+ */
+class Directory : public SnoopingBus
+{
+  public:
+    enum Replacement {
+        LRU,
+        FewestSharers
+    };
+
+    /**
+     * @param group is the number of cores per bit of a sharer vector, 1
+     *        for a full map. cores / group must be at most 64.
+     * @param entries is the number of lines the directory can track
+     * @param ways is the associativity of the entries
+     * @param lookup_latency is added to every transaction
+     */
+    Directory(int cores, int line_size, ResponsePort& mem_side,
+              Protocol protocol, int latency, int group, int entries, int ways,
+              Replacement replacement, int lookup_latency);
+
+    ~Directory() override;
+
+    /**
+     * Lines invalidated from below lose their entries too, unless a core
+     * is still waiting for them.
+     */
+    int receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                          bool& dirty) override;
+
+  protected:
+    bool lookup(int core, uint64_t line_address,
+                std::vector<int>& targets) override;
+
+    void update(int core, Transaction type, uint64_t line_address,
+                const std::vector<int>& holders) override;
+
+    void writtenBack(int core, uint64_t line_address) override;
+
+  private:
+    struct Entry
+    {
+        bool valid;
+        uint64_t lineAddress;
+
+        /// Bit i is cores i * group to (i + 1) * group - 1
+        uint64_t sharers;
+
+        int64_t lastUse;
+    };
+
+    /**
+     * @return the entry for a line, -1 if it has none
+     */
+    int find(uint64_t line_address);
+
+    /**
+     * @return the entry a line would get: a free one, otherwise the one to
+     *         evict. -1 if every entry of the set is busy.
+     */
+    int findVictim(uint64_t line_address);
+
+    /**
+     * Give a line an entry, evicting another line's if the set is full.
+     *
+     * @return the entry, -1 if every entry of the set is busy
+     */
+    int allocate(uint64_t line_address);
+
+    /**
+     * Invalidate every copy of an entry's line and free the entry.
+     */
+    void evict(int entry);
+
+    /**
+     * @return the cores a sharer vector covers
+     */
+    std::vector<int> getCores(uint64_t sharers);
+
+    uint64_t getBit(int core) { return (uint64_t)1 << (core / group); }
+
+    int group;
+
+    int ways;
+
+    int64_t sets;
+
+    Replacement replacement;
+
+    std::vector<Entry> entries;
+
+    int64_t useCounter;
+
+    int64_t lookups;
+    int64_t allocations;
+
+    /// Transactions that waited because every entry of the set was busy
+    int64_t blocked;
+
+    /// Entries evicted, and those whose line was dirty somewhere
+    int64_t evictions;
+    int64_t dirtyEvictions;
+
+    /// Invalidations sent for evicted entries, and the lines they removed
+    int64_t invalidationsSent;
+    int64_t linesInvalidated;
+};
+
+#endif // CSIM_DIRECTORY_H
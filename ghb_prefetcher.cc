@@ -0,0 +1,69 @@
+
+#include <cassert>
+
+#include "ghb_prefetcher.hh"
+#include "util.hh"
+
+GHBPrefetcher::GHBPrefetcher(int line_size, int degree, int distance,
+                             int entries) :
+    Prefetcher(line_size, degree), distance(distance), history(entries),
+    head(0), indexEntries(entries)
+{
+    assert(distance > 0);
+    assert(entries > 2);
+}
+
+void GHBPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    // Trained on the miss stream. A prefetched line would have been a miss.
+    if (hit && !prefetched) return;
+
+    int64_t line = address >> lineBits;
+    int64_t position = head++;
+    Entry& entry = at(position);
+    entry.line = line;
+    entry.link = -1;
+
+    if (!inHistory(position - 2)) return;
+
+    int64_t newer = line - at(position - 1).line;
+    int64_t older = at(position - 1).line - at(position - 2).line;
+    if (newer == 0) return;
+    uint64_t key = makeKey(older, newer);
+
+    auto it = indexTable.find(key);
+    if (it != indexTable.end()) {
+        entry.link = it->second;
+        it->second = position;
+    } else {
+        if (indexTable.size() >= indexEntries) {
+            // Forget keys whose entries have left the history buffer.
+            for (auto old = indexTable.begin(); old != indexTable.end();) {
+                if (inHistory(old->second)) {
+                    old++;
+                } else {
+                    old = indexTable.erase(old);
+                }
+            }
+        }
+        if (indexTable.size() < indexEntries) {
+            indexTable[key] = position;
+        }
+    }
+
+    if (!inHistory(entry.link)) return;
+
+    // Replay what happened after the last time we saw these deltas. If
+    // the history runs out, the pattern since then is assumed to repeat
+    // (a constant stride links to the entry just before).
+    int64_t predicted = line;
+    int64_t next = entry.link + 1;
+    for (int i = 1; i < distance + degree; i++) {
+        predicted += at(next).line - at(next - 1).line;
+        next = next == position ? entry.link + 1 : next + 1;
+        if (i < distance || predicted < 0) continue;
+        DPRINT("GHB predicts line 0x" << std::hex << (predicted << lineBits)
+               << std::dec);
+        queuePrefetch((uint64_t)predicted << lineBits);
+    }
+}
@@ -0,0 +1,86 @@
+
+#ifndef CSIM_GHB_PREFETCHER_H
+#define CSIM_GHB_PREFETCHER_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "prefetcher.hh"
+
+/**
+ * Global history buffer prefetcher with delta correlation (G/DC, after
+ * Nesbit and Smith).
+ *
+ * Every miss (and first use of a prefetched line) is pushed into a circular
+ * history buffer. The last two deltas between those lines form a key, and
+ * the index table points at the last time the same pair of deltas was
+ * seen. Each history entry links back to the previous entry with the same
+ * key. The deltas that followed that earlier occurrence are replayed from
+ * the current line to find the lines to prefetch. There is no PC in the
+ * traces, so the history is global rather than per instruction.
+ *
+ * The distance is how many predicted lines to skip before prefetching, so
+ * the prefetches cover lines `distance` to `distance + degree - 1` ahead.
+ */
+class GHBPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of lines to prefetch on each miss
+     * @param distance is how far ahead the first prefetch is (1 is the next
+     *        predicted line)
+     * @param entries is the size of the history buffer
+     */
+    GHBPrefetcher(int line_size, int degree = 4, int distance = 1,
+                  int entries = 256);
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+  private:
+    struct Entry
+    {
+        /// Line number (address / line size)
+        int64_t line;
+
+        /// Position of the previous entry with the same key, or -1
+        int64_t link;
+    };
+
+    /**
+     * @return true if the entry at this position has not been overwritten
+     */
+    bool inHistory(int64_t position)
+    {
+        return position >= 0 && position >= head - (int64_t)history.size() &&
+               position < head;
+    }
+
+    Entry& at(int64_t position) { return history[position % history.size()]; }
+
+    /**
+     * @return the index table key for two consecutive deltas
+     */
+    static uint64_t makeKey(int64_t older, int64_t newer)
+    {
+        return ((uint64_t)older << 32) ^ ((uint64_t)newer & 0xffffffff);
+    }
+
+    int distance;
+
+    std::vector<Entry> history;
+
+    /// Position of the next entry to write. Grows forever; the buffer
+    /// position is head % size.
+    int64_t head;
+
+    /// Delta pair -> position of the last entry with that key
+    std::unordered_map<uint64_t, int64_t> indexTable;
+
+    /// The table is as big as the history buffer, as in hardware.
+    size_t indexEntries;
+};
+
+#endif // CSIM_GHB_PREFETCHER_H
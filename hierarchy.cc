@@ -0,0 +1,947 @@
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#include "best_offset_prefetcher.hh"
+#include "coherent_cache.hh"
+#include "compressed_cache.hh"
+#include "direct_mapped.hh"
+#include "directory.hh"
+#include "ghb_prefetcher.hh"
+#include "hierarchy.hh"
+#include "memory.hh"
+#include "mmu.hh"
+#include "next_line_prefetcher.hh"
+#include "non_blocking.hh"
+#include "page_table.hh"
+#include "processor.hh"
+#include "set_assoc.hh"
+#include "sms_prefetcher.hh"
+#include "snooping_bus.hh"
+#include "sram_model.hh"
+#include "stream_prefetcher.hh"
+#include "temporal_prefetcher.hh"
+#include "util.hh"
+#include "vldp_prefetcher.hh"
+#include "way_partitioner.hh"
+#include "zcache.hh"
+
+Hierarchy::Hierarchy(const std::vector<LevelConfig>& levels,
+                     const std::vector<Processor*>& processors,
+                     Memory& memory, const TLBConfig& tlb) :
+    levels(levels), processors(processors), pageTable(nullptr), bus(nullptr),
+    temporal(nullptr), partitioner(nullptr)
+{
+    assert(!levels.empty());
+    assert(memory.getLineSize() == levels.back().lineSize / levels.back().sectors);
+    int cores = levels[0].coherence != "none" ? levels[0].cores : 1;
+    assert((int)processors.size() == cores);
+    int addr_size = processors[0]->getAddrSize();
+    if (tlb.pageSize > 0) {
+        // The page table lives above the processor's addresses
+        pageTable = new PageTable(addr_size, tlb.pageSize);
+        addr_size++;
+    }
+
+    // Build from memory up so that each cache has its downstream port. The
+    // first level's caches (one per core) come first.
+    caches.resize(levels.size() - 1 + cores);
+    ResponsePort* mem_side = &memory;
+    for (int i = levels.size() - 1; i >= 0; i--) {
+        assert(i == 0 || levels[i].lineSize / levels[i].sectors >= levels[i - 1].lineSize);
+        assert(levels[i].inclusion != Cache::Exclusive ||
+               (i > 0 && levels[i].lineSize == levels[i - 1].lineSize));
+        if (levels[i].coherence != "none") {
+            assert(i == 0);
+            SnoopingBus::Protocol protocol = levels[i].coherence == "moesi" ?
+                SnoopingBus::MOESI : SnoopingBus::MESI;
+            if (levels[i].directory != "none") {
+                int entries = levels[i].dirEntries;
+                if (entries == 0) {
+                    entries = 2 * cores * (levels[i].size / levels[i].lineSize);
+                    entries = (entries + levels[i].dirWays - 1) / levels[i].dirWays *
+                              levels[i].dirWays;
+                }
+                bus = new Directory(cores, levels[i].lineSize, *mem_side,
+                                    protocol, levels[i].busLatency,
+                                    levels[i].directory == "full" ? 1 : levels[i].dirGroup,
+                                    entries, levels[i].dirWays,
+                                    levels[i].dirReplacement == "sharers" ?
+                                        Directory::FewestSharers : Directory::LRU,
+                                    levels[i].dirLatency);
+            } else {
+                bus = new SnoopingBus(cores, levels[i].lineSize, *mem_side,
+                                      protocol, levels[i].busLatency);
+            }
+            for (int core = 0; core < cores; core++) {
+                caches[core] = createCache(levels[i], bus->getPort(core),
+                                           addr_size, core);
+            }
+            break;
+        }
+        caches[i + cores - 1] = createCache(levels[i], *mem_side, addr_size);
+        mem_side = caches[i + cores - 1];
+    }
+    for (int core = 0; core < cores; core++) {
+        if (!pageTable) {
+            processors[core]->setCache(caches[core]);
+            continue;
+        }
+        mmus.push_back(new MMU(*caches[core], *pageTable, tlb.l1Entries,
+                               tlb.l1Ways, tlb.l2Entries, tlb.l2Ways,
+                               tlb.l2Latency, tlb.pwcEntries));
+        if (cores > 1) {
+            mmus.back()->setName("MMU[" + std::to_string(core) + "]");
+        }
+        processors[core]->setCache(mmus.back());
+    }
+
+    // Give the temporal prefetcher its share of the last level.
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (levels[i].metadataWays == 0) continue;
+        SetAssociativeCache* llc =
+            dynamic_cast<SetAssociativeCache*>(caches.back());
+        assert(llc && temporal);
+        llc->reserveMetadataWays(levels[i].metadataWays);
+        temporal->setMetadataStore(llc->getNumMetadataLines(),
+                                   llc->getLineSize(),
+            [llc](int index) { return llc->getMetadataLine(index); });
+    }
+
+    // Share the last level's ways among the cores.
+    const LevelConfig& last = levels.back();
+    if (last.partition != "none") {
+        SetAssociativeCache* llc =
+            dynamic_cast<SetAssociativeCache*>(caches.back());
+        assert(llc && cores > 1);
+        partitioner = new WayPartitioner(cores,
+            last.size / last.lineSize / last.ways, last.ways,
+            last.partition == "cat" ? WayPartitioner::Static :
+                                      WayPartitioner::Utility,
+            last.partitionInterval, last.partitionSets);
+        for (size_t core = 0; core < last.wayMasks.size(); core++) {
+            partitioner->setMask(core, last.wayMasks[core]);
+        }
+        llc->setPartitioner(partitioner);
+    }
+
+    // Throttled prefetchers back off when memory is busy.
+    for (auto prefetcher : prefetchers) {
+        prefetcher->setMemory(&memory);
+    }
+
+    // With more than one level memory can legitimately see stale writebacks
+    // (e.g., a dirty L2 line whose newer copy is still in L1). Those are
+    // checked at the end instead, see checkMemory().
+    memory.setCheckWritebacks(levels.size() == 1);
+}
+
+void Hierarchy::checkMemory(Memory& memory)
+{
+    // The first level's caches come first, so this goes from memory up.
+    for (auto it = caches.rbegin(); it != caches.rend(); it++) {
+        (*it)->getDirtyData([&memory](uint64_t address, int size, const uint8_t* data) {
+            memory.flushWrite(address, size, data);
+        });
+    }
+    memory.checkFlushed();
+}
+
+Hierarchy::~Hierarchy()
+{
+    // Count each byte once, however many levels hold it. L1 has the
+    // smallest lines.
+    int granularity = levels[0].lineSize;
+    std::unordered_set<uint64_t> blocks;
+    int64_t total_size = 0;
+    for (auto cache : caches) {
+        std::vector<uint64_t> lines;
+        cache->getValidLines(lines);
+        for (uint64_t address : lines) {
+            for (int offset = 0; offset < cache->getLineSize(); offset += granularity) {
+                blocks.insert(address + offset);
+            }
+        }
+        total_size += cache->getSize();
+    }
+    std::cout << "Effective capacity: ";
+    std::cout << ((float)blocks.size() * granularity)/1024 << "KB of ";
+    std::cout << ((float)total_size)/1024 << "KB" << std::endl;
+
+    double energy = 0;
+    for (auto cache : caches) {
+        energy += cache->getEnergy();
+    }
+    std::cout << "Cache energy: " << energy << "nJ" << std::endl;
+    int64_t requests = 0;
+    for (auto processor : processors) {
+        requests += processor->getTotalRequests();
+    }
+    std::cout << "Requests per nJ: ";
+    std::cout << (energy > 0 ? requests / energy : 0) << std::endl;
+
+    // The MMUs sit above L1, so they print first.
+    for (auto mmu : mmus) {
+        delete mmu;
+    }
+    delete pageTable;
+
+    // L1 first so that the statistics print from the top down. The bus
+    // prints after the caches on it.
+    for (size_t i = 0; i < caches.size(); i++) {
+        delete caches[i];
+        if (i + 1 == processors.size()) {
+            delete bus;
+        }
+    }
+    delete partitioner;
+    for (auto victim_cache : victimCaches) {
+        delete victim_cache;
+    }
+    for (auto prefetcher : prefetchers) {
+        delete prefetcher;
+    }
+}
+
+bool Hierarchy::loadConfig(const std::string& filename,
+                           std::vector<LevelConfig>& levels,
+                           MemoryConfig& memory, TLBConfig& tlb)
+{
+    std::ifstream in(filename.c_str());
+
+    if (!in) return false;
+
+    levels.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream tokens(line);
+        LevelConfig level;
+        if (!(tokens >> level.name)) continue; // Blank line
+        if (level.name == "memory") {
+            std::string option;
+            while (tokens >> option) {
+                size_t equals = option.find('=');
+                std::string key = option.substr(0, equals);
+                int value = -1;
+                if (equals != std::string::npos) {
+                    std::istringstream(option.substr(equals + 1)) >> value;
+                }
+                if (key == "queue" && value > 0) {
+                    memory.queueDepth = value;
+                } else if (key == "transfer" && value >= 0) {
+                    memory.transferTicks = value;
+                } else if (key == "beats" && value > 0) {
+                    memory.beats = value;
+                } else {
+                    std::cerr << filename << ":" << line_number << ": bad "
+                              << "memory option " << option << std::endl;
+                    return false;
+                }
+            }
+            continue;
+        }
+        if (level.name == "tlb") {
+            tlb.pageSize = 4096;
+            std::string option;
+            while (tokens >> option) {
+                size_t equals = option.find('=');
+                std::string key = option.substr(0, equals);
+                std::string text = equals != std::string::npos ?
+                    option.substr(equals + 1) : "";
+                int value = -1;
+                std::istringstream(text) >> value;
+                if (key == "pagesize" && (text == "4k" || text == "2m" ||
+                                          text == "1g")) {
+                    tlb.pageSize = text == "4k" ? 4096 :
+                                   text == "2m" ? 2 << 20 : 1 << 30;
+                } else if (key == "l1" && value > 0) {
+                    tlb.l1Entries = value;
+                } else if (key == "l1ways" && value > 0) {
+                    tlb.l1Ways = value;
+                } else if (key == "l2" && value > 0) {
+                    tlb.l2Entries = value;
+                } else if (key == "l2ways" && value > 0) {
+                    tlb.l2Ways = value;
+                } else if (key == "l2lat" && value >= 0) {
+                    tlb.l2Latency = value;
+                } else if (key == "pwc" && value >= 0) {
+                    tlb.pwcEntries = value;
+                } else {
+                    std::cerr << filename << ":" << line_number << ": bad "
+                              << "tlb option " << option << std::endl;
+                    return false;
+                }
+            }
+            if (tlb.l1Entries % tlb.l1Ways != 0 ||
+                tlb.l2Entries % tlb.l2Ways != 0) {
+                std::cerr << filename << ":" << line_number << ": TLB "
+                          << "entries must be a multiple of the ways"
+                          << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (!(tokens >> level.type)) {
+            std::cerr << filename << ":" << line_number << ": missing type"
+                      << std::endl;
+            return false;
+        }
+        if (level.type != "direct" && level.type != "setassoc" &&
+            level.type != "nonblocking") {
+            std::cerr << filename << ":" << line_number << ": unknown type "
+                      << level.type << std::endl;
+            return false;
+        }
+
+        std::string option;
+        while (tokens >> option) {
+            size_t equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            if (key == "inclusion" && equals != std::string::npos) {
+                std::string policy = option.substr(equals + 1);
+                if (policy == "inclusive") {
+                    level.inclusion = Cache::Inclusive;
+                } else if (policy == "exclusive") {
+                    level.inclusion = Cache::Exclusive;
+                } else if (policy == "noninclusive") {
+                    level.inclusion = Cache::NonInclusive;
+                } else {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown inclusion policy " << policy
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "prefetcher" && equals != std::string::npos) {
+                level.prefetcher = option.substr(equals + 1);
+                if (level.prefetcher != "none" &&
+                    level.prefetcher != "nextline" &&
+                    level.prefetcher != "stream" &&
+                    level.prefetcher != "ghb" && level.prefetcher != "vldp" &&
+                    level.prefetcher != "bo" && level.prefetcher != "sms" &&
+                    level.prefetcher != "temporal") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown prefetcher " << level.prefetcher
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "timing" && equals != std::string::npos) {
+                level.timing = option.substr(equals + 1);
+                if (level.timing != "fixed" && level.timing != "model") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown timing " << level.timing
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "waypred" && equals != std::string::npos) {
+                level.wayPrediction = option.substr(equals + 1);
+                if (level.wayPrediction != "none" &&
+                    level.wayPrediction != "mru" &&
+                    level.wayPrediction != "hash") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown way prediction "
+                              << level.wayPrediction << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "index" && equals != std::string::npos) {
+                level.index = option.substr(equals + 1);
+                if (level.index != "modulo" && level.index != "xor" &&
+                    level.index != "prime" && level.index != "skewed") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown index " << level.index
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "write" && equals != std::string::npos) {
+                level.writePolicy = option.substr(equals + 1);
+                if (level.writePolicy != "back" &&
+                    level.writePolicy != "through") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown write policy "
+                              << level.writePolicy << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "writemiss" && equals != std::string::npos) {
+                level.writeMissPolicy = option.substr(equals + 1);
+                if (level.writeMissPolicy != "allocate" &&
+                    level.writeMissPolicy != "noallocate" &&
+                    level.writeMissPolicy != "validate") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown write miss policy "
+                              << level.writeMissPolicy << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "coherence" && equals != std::string::npos) {
+                level.coherence = option.substr(equals + 1);
+                if (level.coherence != "none" && level.coherence != "mesi" &&
+                    level.coherence != "moesi") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown coherence protocol "
+                              << level.coherence << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "directory" && equals != std::string::npos) {
+                level.directory = option.substr(equals + 1);
+                if (level.directory != "none" && level.directory != "full" &&
+                    level.directory != "coarse") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown directory " << level.directory
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "dirrepl" && equals != std::string::npos) {
+                level.dirReplacement = option.substr(equals + 1);
+                if (level.dirReplacement != "lru" &&
+                    level.dirReplacement != "sharers") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown directory replacement "
+                              << level.dirReplacement << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "partition" && equals != std::string::npos) {
+                level.partition = option.substr(equals + 1);
+                if (level.partition != "none" && level.partition != "ucp" &&
+                    level.partition != "cat") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown partitioning " << level.partition
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (key == "waymasks" && equals != std::string::npos) {
+                std::istringstream masks(option.substr(equals + 1));
+                level.wayMasks.clear();
+                for (std::string text; std::getline(masks, text, ',');) {
+                    std::istringstream mask_text(text);
+                    uint64_t mask = 0;
+                    if (!(mask_text >> std::hex >> mask) || !mask_text.eof() ||
+                        mask == 0) {
+                        std::cerr << filename << ":" << line_number
+                                  << ": bad way mask " << text << std::endl;
+                        return false;
+                    }
+                    level.wayMasks.push_back(mask);
+                }
+                continue;
+            }
+            if (key == "compression" && equals != std::string::npos) {
+                level.compression = option.substr(equals + 1);
+                if (level.compression != "none" && level.compression != "bdi" &&
+                    level.compression != "fpc") {
+                    std::cerr << filename << ":" << line_number
+                              << ": unknown compression " << level.compression
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+
+            int64_t value = 0;
+            if (equals != std::string::npos) {
+                std::istringstream(option.substr(equals + 1)) >> value;
+            }
+            if (value <= 0 && !(key == "victim" && value == 0) &&
+                !(key == "dirlat" && value == 0)) {
+                std::cerr << filename << ":" << line_number << ": bad value in "
+                          << option << std::endl;
+                return false;
+            }
+
+            if (key == "size") {
+                level.size = value;
+            } else if (key == "line") {
+                level.lineSize = value;
+            } else if (key == "ways") {
+                level.ways = value;
+            } else if (key == "mshrs") {
+                level.mshrs = value;
+            } else if (key == "wb") {
+                level.wbEntries = value;
+            } else if (key == "victim") {
+                level.victimEntries = value;
+            } else if (key == "sectors") {
+                level.sectors = value;
+            } else if (key == "degree") {
+                level.prefetchDegree = value;
+            } else if (key == "streams") {
+                level.prefetchStreams = value;
+            } else if (key == "region") {
+                level.prefetchRegion = value;
+            } else if (key == "metadata") {
+                level.prefetchMetadata = value;
+            } else if (key == "metaways") {
+                level.metadataWays = value;
+            } else if (key == "distance") {
+                level.prefetchDistance = value;
+            } else if (key == "throttle") {
+                level.prefetchThrottle = value;
+            } else if (key == "tags") {
+                level.tagFactor = value;
+            } else if (key == "taglat") {
+                level.tagLatency = value;
+            } else if (key == "datalat") {
+                level.dataLatency = value;
+            } else if (key == "banks") {
+                level.banks = value;
+            } else if (key == "zcache") {
+                level.zcacheLevels = value;
+            } else if (key == "cores") {
+                level.cores = value;
+            } else if (key == "buslat") {
+                level.busLatency = value;
+            } else if (key == "dirgroup") {
+                level.dirGroup = value;
+            } else if (key == "direntries") {
+                level.dirEntries = value;
+            } else if (key == "dirways") {
+                level.dirWays = value;
+            } else if (key == "dirlat") {
+                level.dirLatency = value;
+            } else if (key == "partinterval") {
+                level.partitionInterval = value;
+            } else if (key == "partsets") {
+                level.partitionSets = value;
+            } else {
+                std::cerr << filename << ":" << line_number << ": unknown key "
+                          << key << std::endl;
+                return false;
+            }
+        }
+
+        if (!levels.empty() && level.lineSize < levels.back().lineSize) {
+            std::cerr << filename << ":" << line_number << ": line size "
+                      << "smaller than the level above" << std::endl;
+            return false;
+        }
+        if (level.inclusion == Cache::Exclusive &&
+            (levels.empty() || level.type == "direct" ||
+             level.lineSize != levels.back().lineSize)) {
+            std::cerr << filename << ":" << line_number << ": an exclusive "
+                      << "level must be set associative, below another "
+                      << "level, with the same line size" << std::endl;
+            return false;
+        }
+        if (level.sectors > 1 &&
+            (level.type != "setassoc" || level.victimEntries > 0 ||
+             level.inclusion == Cache::Exclusive ||
+             __builtin_popcount(level.sectors) != 1 ||
+             level.sectors > level.lineSize)) {
+            std::cerr << filename << ":" << line_number << ": only "
+                      << "setassoc levels without a victim cache or "
+                      << "exclusion can have sectors, a power of 2 of them"
+                      << std::endl;
+            return false;
+        }
+        if (level.sectors > 1 && level.wbEntries < level.sectors) {
+            // Evicting a line may write back every sector.
+            std::cerr << filename << ":" << line_number << ": a sectored "
+                      << "level needs wb of at least sectors" << std::endl;
+            return false;
+        }
+        if (!levels.empty() &&
+            level.lineSize / level.sectors < levels.back().lineSize) {
+            std::cerr << filename << ":" << line_number << ": sectors "
+                      << "smaller than the lines of the level above"
+                      << std::endl;
+            return false;
+        }
+        if (levels.empty() && level.lineSize / level.sectors < 8) {
+            // A request must fit in one sector, and the processor (or a page
+            // walk) reads up to 8 bytes at a time.
+            std::cerr << filename << ":" << line_number << ": sectors of "
+                      << "the first level smaller than 8 bytes" << std::endl;
+            return false;
+        }
+        if (!levels.empty() && levels.back().sectors > 1 &&
+            level.inclusion == Cache::Exclusive) {
+            std::cerr << filename << ":" << line_number << ": an exclusive "
+                      << "level cannot be below a sectored one" << std::endl;
+            return false;
+        }
+        if (level.compression != "none" &&
+            (level.type != "setassoc" || level.sectors > 1 ||
+             level.victimEntries > 0 || level.inclusion == Cache::Exclusive ||
+             level.lineSize < 8)) {
+            std::cerr << filename << ":" << line_number << ": only "
+                      << "setassoc levels with lines of at least 8 bytes and "
+                      << "without sectors, a victim cache or exclusion can "
+                      << "be compressed" << std::endl;
+            return false;
+        }
+        if (level.compression != "none" &&
+            level.wbEntries < level.ways * level.tagFactor) {
+            std::cerr << filename << ":" << line_number << ": a compressed "
+                      << "level needs wb of at least ways * tags" << std::endl;
+            return false;
+        }
+        if (level.timing == "model" &&
+            level.tagLatency + level.dataLatency > 0) {
+            std::cerr << filename << ":" << line_number << ": timing=model "
+                      << "sets the latency, so taglat and datalat cannot "
+                      << "be given" << std::endl;
+            return false;
+        }
+        if (__builtin_popcount(level.banks) != 1 ||
+            (level.banks > 1 && level.timing != "model" &&
+             level.tagLatency + level.dataLatency == 0)) {
+            std::cerr << filename << ":" << line_number << ": banks must be "
+                      << "a power of 2, and only levels with a latency have "
+                      << "banks" << std::endl;
+            return false;
+        }
+        if (level.index == "skewed" &&
+            (level.type == "direct" || level.compression != "none")) {
+            std::cerr << filename << ":" << line_number << ": a skewed "
+                      << "index needs ways with sets of their own, so not "
+                      << "direct mapped or compressed" << std::endl;
+            return false;
+        }
+        if (level.zcacheLevels > 0 &&
+            (level.type != "setassoc" || level.sectors > 1 ||
+             level.victimEntries > 0 || level.compression != "none" ||
+             level.inclusion == Cache::Exclusive || level.ways < 2 ||
+             (level.index != "modulo" && level.index != "skewed"))) {
+            std::cerr << filename << ":" << line_number << ": a zcache "
+                      << "must be a skewed setassoc level with 2 or more "
+                      << "ways, and no sectors, victim cache, "
+                      << "compression or exclusion" << std::endl;
+            return false;
+        }
+        if ((level.writePolicy != "back" || level.writeMissPolicy != "allocate") &&
+            (level.type == "direct" || level.sectors > 1 ||
+             level.victimEntries > 0 || level.compression != "none" ||
+             level.zcacheLevels > 0 || level.inclusion == Cache::Exclusive ||
+             (level.writeMissPolicy == "validate" &&
+              level.inclusion == Cache::Inclusive))) {
+            std::cerr << filename << ":" << line_number << ": write policies "
+                      << "need a setassoc or nonblocking level without "
+                      << "sectors, a victim cache, compression, a zcache or "
+                      << "exclusion (or inclusion for validate)" << std::endl;
+            return false;
+        }
+        if ((level.coherence != "none" || level.cores > 1) &&
+            (!levels.empty() || level.coherence == "none" ||
+             level.type != "setassoc" || level.sectors > 1 ||
+             level.victimEntries > 0 || level.compression != "none" ||
+             level.zcacheLevels > 0 || level.inclusion != Cache::NonInclusive ||
+             level.writePolicy != "back" || level.writeMissPolicy != "allocate" ||
+             level.timing == "model" ||
+             level.tagLatency + level.dataLatency > 0)) {
+            std::cerr << filename << ":" << line_number << ": only the "
+                      << "first level can be coherent, only a coherent level "
+                      << "can have cores, and it must be setassoc without "
+                      << "sectors, a victim cache, "
+                      << "compression, a zcache, inclusion, write policies "
+                      << "or a latency" << std::endl;
+            return false;
+        }
+        if (level.directory != "none" &&
+            (level.coherence == "none" ||
+             (level.cores + (level.directory == "full" ? 1 : level.dirGroup) - 1) /
+                 (level.directory == "full" ? 1 : level.dirGroup) > 64 ||
+             level.dirEntries % level.dirWays != 0)) {
+            std::cerr << filename << ":" << line_number << ": a directory "
+                      << "needs a coherent level, at most 64 bits of "
+                      << "sharers and direntries a multiple of dirways"
+                      << std::endl;
+            return false;
+        }
+        if (level.wayPrediction != "none" && level.type == "direct") {
+            std::cerr << filename << ":" << line_number << ": a direct "
+                      << "mapped level has only one way to predict"
+                      << std::endl;
+            return false;
+        }
+        if (level.prefetcher != "none" &&
+            (level.type != "nonblocking" || level.mshrs < 2)) {
+            std::cerr << filename << ":" << line_number << ": only "
+                      << "non-blocking levels with more than one MSHR can "
+                      << "prefetch" << std::endl;
+            return false;
+        }
+        if (level.prefetcher == "sms" &&
+            (__builtin_popcount(level.prefetchRegion) != 1 ||
+             level.prefetchRegion <= level.lineSize)) {
+            std::cerr << filename << ":" << line_number << ": region must "
+                      << "be a power of 2 larger than a line" << std::endl;
+            return false;
+        }
+        if (level.metadataWays > 0 && level.prefetcher != "temporal") {
+            std::cerr << filename << ":" << line_number << ": only the "
+                      << "temporal prefetcher keeps metadata in the last "
+                      << "level" << std::endl;
+            return false;
+        }
+        if (level.prefetcher == "temporal" && level.metadataWays == 0 &&
+            level.prefetchMetadata % 64 != 0) {
+            std::cerr << filename << ":" << line_number << ": metadata must "
+                      << "be a multiple of 64 bytes" << std::endl;
+            return false;
+        }
+        if (level.prefetchThrottle > 0 &&
+            level.prefetchThrottle < level.prefetchDegree) {
+            std::cerr << filename << ":" << line_number << ": throttle is "
+                      << "the largest degree, so it cannot be less than "
+                      << "degree" << std::endl;
+            return false;
+        }
+        levels.push_back(level);
+    }
+
+    in.close();
+
+    if (levels.empty()) {
+        std::cerr << filename << ": no levels" << std::endl;
+        return false;
+    }
+
+    // Memory moves the last level's sectors
+    int memory_line = levels.back().lineSize / levels.back().sectors;
+    if (memory_line % memory.beats != 0) {
+        std::cerr << filename << ": memory beats must divide its "
+                  << memory_line << "-byte lines" << std::endl;
+        return false;
+    }
+
+    // Metadata can only go in the ways of one set associative last level.
+    int metadata_ways = 0;
+    for (auto& level : levels) {
+        if (level.metadataWays > 0) {
+            if (metadata_ways > 0) {
+                std::cerr << filename << ": only one level can keep "
+                          << "metadata in the last level" << std::endl;
+                return false;
+            }
+            metadata_ways = level.metadataWays;
+        }
+    }
+    if (metadata_ways > 0 && (levels.back().type == "direct" ||
+                              levels.back().compression != "none" ||
+                              levels.back().zcacheLevels > 0 ||
+                              metadata_ways >= levels.back().ways ||
+                              levels.back().lineSize < 8)) {
+        std::cerr << filename << ": metaways needs an uncompressed set associative "
+                  << "last level with more ways than that" << std::endl;
+        return false;
+    }
+
+    // Partitioning shares the last level among a coherent first level's
+    // cores, which tell it who each request is for.
+    for (size_t i = 0; i < levels.size(); i++) {
+        const LevelConfig& level = levels[i];
+        if (level.partition == "none" && level.wayMasks.empty()) continue;
+        int cores = levels[0].coherence != "none" ? levels[0].cores : 1;
+        if (i + 1 != levels.size() || i == 0 || cores < 2 ||
+            level.type == "direct" || level.compression != "none" ||
+            level.zcacheLevels > 0 || level.inclusion == Cache::Exclusive ||
+            metadata_ways > 0) {
+            std::cerr << filename << ": only a setassoc or nonblocking last "
+                      << "level below a coherent first level with cores, "
+                      << "and without compression, a zcache, exclusion or "
+                      << "metadata ways, can be partitioned" << std::endl;
+            return false;
+        }
+        if (level.partition == "ucp" && level.ways < cores) {
+            std::cerr << filename << ": ucp needs at least as many ways as "
+                      << "cores" << std::endl;
+            return false;
+        }
+        bool masks_fit = true;
+        for (uint64_t mask : level.wayMasks) {
+            masks_fit = masks_fit && (level.ways >= 64 || mask >> level.ways == 0);
+        }
+        if ((level.partition == "cat") != !level.wayMasks.empty() ||
+            (level.partition == "cat" &&
+             ((int)level.wayMasks.size() != cores || !masks_fit))) {
+            std::cerr << filename << ": cat needs waymasks, one per core, "
+                      << "within the " << level.ways << " ways" << std::endl;
+            return false;
+        }
+    }
+
+    // Stores that are not whole lines go below as stores, and an exclusive
+    // level only takes reads and evictions.
+    for (size_t i = 0; i + 1 < levels.size(); i++) {
+        if ((levels[i].writePolicy != "back" ||
+             levels[i].writeMissPolicy != "allocate") &&
+            levels[i + 1].inclusion == Cache::Exclusive) {
+            std::cerr << filename << ": " << levels[i + 1].name << " is "
+                      << "exclusive, so " << levels[i].name << " must write "
+                      << "back and allocate" << std::endl;
+            return false;
+        }
+    }
+
+    // The bus only writes back dirty lines.
+    if (levels[0].coherence != "none" && levels.size() > 1 &&
+        levels[1].inclusion == Cache::Exclusive) {
+        std::cerr << filename << ": " << levels[1].name << " cannot be "
+                  << "exclusive below the coherent " << levels[0].name
+                  << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+Cache* Hierarchy::createCache(const LevelConfig& level, ResponsePort& mem_side,
+                              int addr_size, int core)
+{
+    IndexFunction::Kind index = IndexFunction::Modulo;
+    if (level.index == "xor") {
+        index = IndexFunction::XOR;
+    } else if (level.index == "prime") {
+        index = IndexFunction::PrimeModulo;
+    } else if (level.index == "skewed") {
+        index = IndexFunction::Skewed;
+    }
+
+    Cache* cache;
+    if (level.type == "direct") {
+        DirectMappedCache* dm = new DirectMappedCache(level.size,
+                                    level.lineSize, mem_side, addr_size);
+        if (level.victimEntries > 0) {
+            victimCaches.push_back(new VictimCache(level.victimEntries,
+                                                   level.lineSize, addr_size));
+            dm->setVictimCache(victimCaches.back());
+        }
+        if (index != IndexFunction::Modulo) {
+            dm->setIndexFunction(index);
+        }
+        cache = dm;
+    } else {
+        SetAssociativeCache* sa;
+        if (core >= 0) {
+            assert(bus && &mem_side == &bus->getPort(core));
+            sa = new CoherentCache(level.size, level.lineSize, addr_size,
+                                   level.ways, *bus, core, level.wbEntries);
+        } else if (level.type == "setassoc" && level.zcacheLevels > 0) {
+            sa = new ZCache(level.size, level.lineSize, mem_side, addr_size,
+                            level.ways, level.zcacheLevels, level.wbEntries);
+        } else if (level.type == "setassoc" && level.compression != "none") {
+            sa = new CompressedCache(level.size, level.lineSize, mem_side,
+                                     addr_size, level.ways,
+                                     level.compression == "bdi" ?
+                                         Compressor::BDI : Compressor::FPC,
+                                     level.tagFactor, level.wbEntries);
+        } else if (level.type == "setassoc") {
+            sa = new SetAssociativeCache(level.size, level.lineSize, mem_side,
+                                         addr_size, level.ways,
+                                         level.wbEntries, level.sectors);
+        } else {
+            assert(level.type == "nonblocking");
+            NonBlockingCache* nb = new NonBlockingCache(level.size,
+                                       level.lineSize, mem_side, addr_size,
+                                       level.ways, level.mshrs,
+                                       level.wbEntries);
+            if (level.prefetcher != "none") {
+                if (level.prefetcher == "nextline") {
+                    prefetchers.push_back(new NextLinePrefetcher(
+                        level.lineSize, level.prefetchDegree));
+                } else if (level.prefetcher == "stream") {
+                    prefetchers.push_back(new StreamPrefetcher(
+                        level.lineSize, level.prefetchStreams,
+                        level.prefetchDegree));
+                } else if (level.prefetcher == "ghb") {
+                    prefetchers.push_back(new GHBPrefetcher(
+                        level.lineSize, level.prefetchDegree,
+                        level.prefetchDistance));
+                } else if (level.prefetcher == "vldp") {
+                    prefetchers.push_back(new VLDPPrefetcher(
+                        level.lineSize, level.prefetchDegree,
+                        level.prefetchDistance));
+                } else if (level.prefetcher == "bo") {
+                    prefetchers.push_back(new BestOffsetPrefetcher(
+                        level.lineSize, level.prefetchDegree));
+                } else if (level.prefetcher == "sms") {
+                    prefetchers.push_back(new SMSPrefetcher(
+                        level.lineSize, level.prefetchDegree,
+                        level.prefetchRegion));
+                } else {
+                    assert(level.prefetcher == "temporal");
+                    TemporalPrefetcher* tp = new TemporalPrefetcher(
+                        level.lineSize, level.prefetchDegree,
+                        level.metadataWays > 0 ? 0 : level.prefetchMetadata);
+                    if (level.metadataWays > 0) {
+                        temporal = tp; // Its store is set up later
+                    }
+                    prefetchers.push_back(tp);
+                }
+                if (level.prefetchThrottle > 0) {
+                    prefetchers.back()->setThrottle(1, level.prefetchThrottle);
+                }
+                nb->setPrefetcher(prefetchers.back());
+            }
+            sa = nb;
+        }
+        if (level.victimEntries > 0) {
+            victimCaches.push_back(new VictimCache(level.victimEntries,
+                                                   level.lineSize, addr_size));
+            sa->setVictimCache(victimCaches.back());
+        }
+        if (index != IndexFunction::Modulo && level.zcacheLevels == 0) {
+            sa->setIndexFunction(index); // A zcache is always skewed
+        }
+        if (level.wayPrediction == "mru") {
+            sa->setWayPrediction(SetAssociativeCache::MRUWayPrediction);
+        } else if (level.wayPrediction == "hash") {
+            sa->setWayPrediction(SetAssociativeCache::HashWayPrediction);
+        }
+        if (level.writePolicy != "back" || level.writeMissPolicy != "allocate") {
+            SetAssociativeCache::WriteMissPolicy miss_policy = SetAssociativeCache::WriteAllocate;
+            if (level.writeMissPolicy == "noallocate") {
+                miss_policy = SetAssociativeCache::NoWriteAllocate;
+            } else if (level.writeMissPolicy == "validate") {
+                miss_policy = SetAssociativeCache::WriteValidate;
+            }
+            sa->setWritePolicy(level.writePolicy == "through" ?
+                               SetAssociativeCache::WriteThrough :
+                               SetAssociativeCache::WriteBack, miss_policy);
+        }
+        cache = sa;
+    }
+    cache->setName(core >= 0 ? level.name + "[" + std::to_string(core) + "]" :
+                               level.name);
+    cache->setInclusionPolicy(level.inclusion);
+
+    SRAMModel model(level.size, level.lineSize,
+                    level.type == "direct" ? 1 : level.ways, level.banks,
+                    addr_size,
+                    level.compression != "none" ? level.tagFactor : 1);
+    cache->setEnergy(model.getTagEnergy(), model.getDataEnergy(),
+                     model.getLeakageEnergy());
+    if (level.timing == "model") {
+        cache->setTiming(model.getTagLatency(), model.getDataLatency(),
+                         level.banks);
+    } else if (level.tagLatency + level.dataLatency > 0) {
+        cache->setTiming(level.tagLatency, level.dataLatency, level.banks);
+    }
+    return cache;
+}
@@ -0,0 +1,361 @@
+
+#ifndef CSIM_HIERARCHY_H
+#define CSIM_HIERARCHY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cache.hh"
+#include "prefetcher.hh"
+#include "victim_cache.hh"
+
+class Memory;
+class MMU;
+class PageTable;
+class Processor;
+class SnoopingBus;
+class TemporalPrefetcher;
+class WayPartitioner;
+
+/**
+ * Builds a chain of caches between a processor and memory.
+ *
+ * The levels can be read from a file. Each line describes one level,
+ * starting with the level closest to the processor:
+ *
+ *   <name> <type> [key=value ...]
+ *
+ * type is one of direct, setassoc or nonblocking. The keys are size (bytes),
+ * line (bytes), ways, mshrs, wb (writeback buffer lines), victim (victim
+ * cache lines, 0 for none), inclusion (inclusive, exclusive or
+ * noninclusive, relative to the levels above) and prefetcher (none,
+ * nextline, stream, ghb, vldp, bo, sms or temporal). degree is the number
+ * of lines a prefetcher runs ahead, streams is the number of streams the
+ * stream prefetcher tracks, distance is how many predicted lines the ghb
+ * and vldp prefetchers skip and region is the sms region size in bytes.
+ * The temporal prefetcher keeps its metadata in a table of metadata=<bytes>
+ * or, with metaways=N, in N ways of every set of the last level.
+ * throttle=N lets the degree follow the prefetch accuracy, lateness,
+ * pollution and memory traffic anywhere from 1 to N.
+ * Anything after a # is ignored.
+ *
+ * A line starting with "memory" sets up memory instead of a level:
+ *
+ *   memory [queue=<reads>] [transfer=<ticks per line>] [beats=N]
+ *
+ * queue is the number of reads memory can have outstanding (16) and
+ * transfer limits the bandwidth (0, the default, is unlimited). With
+ * beats=N a line arrives in N pieces, the one with the word a miss is
+ * waiting for first, and the levels answer a read as soon as its bytes are
+ * there (early restart) instead of when the line is filled.
+ *
+ * A line starting with "tlb" puts an MMU (see MMU) between each processor
+ * and its first level:
+ *
+ *   tlb [pagesize=4k|2m|1g] [l1=N] [l1ways=N] [l2=N] [l2ways=N] [l2lat=N]
+ *       [pwc=N]
+ *
+ * l1 and l2 are the number of entries of the L1 (64, 4 ways) and L2 (1024,
+ * 8 ways) TLBs, l2lat is the L2 TLB's latency (7) and pwc is the size of
+ * each page-walk cache (16, 0 for none). The page table's nodes live above
+ * the processor's addresses, so the caches get one more address bit.
+ *
+ * A setassoc level can split its lines into sectors=N sectors, which share
+ * a tag but are fetched and written back on their own. Sectors must be at
+ * least as big as the lines of the level above, or 8 bytes at the first
+ * level, so that no request spans two sectors. Its writeback buffer must
+ * hold sectors lines.
+ *
+ * A setassoc level can also compress its lines with compression=bdi or
+ * compression=fpc. It then has tags=N (2) times as many tags as ways, and
+ * compressed lines share the data of a set. Its writeback buffer must hold
+ * ways * tags lines.
+ *
+ * Hits respond right away unless a level has taglat=N and/or datalat=N
+ * ticks of latency. It then has banks=N (1) pipelined banks, and accesses
+ * to a busy bank wait. With timing=model the latency comes from SRAMModel
+ * instead, from the level's size, line size, ways and banks. The model
+ * also gives every level an energy, which is reported with performance per
+ * watt (requests per nJ) for the whole hierarchy.
+ *
+ * A setassoc or nonblocking level can predict the way that will hit with
+ * waypred=mru (the set's most recently used way) or waypred=hash (a table
+ * indexed by a hash of the address). Hits in any other way take a tick
+ * longer.
+ *
+ * index picks the set from the line number: modulo (the low bits, the
+ * default), xor (the tag folded in), prime (modulo the largest prime
+ * number of sets) or skewed (a different xor hash in each way, not for
+ * direct mapped or compressed levels).
+ *
+ * zcache=N makes a setassoc level a zcache (skewed, with a replacement
+ * walk N levels deep, see ZCache). It cannot have sectors, a victim cache,
+ * compression or exclusion, and needs wb of at least 2.
+ *
+ * Stores are written back and a write miss fetches the line, unless a
+ * level has write=through (every store also goes below, through the
+ * writeback buffer) or writemiss=noallocate (a write miss goes below
+ * without a line) or writemiss=validate (a write miss fills a line without
+ * fetching it, and only the bytes written are valid). These need a
+ * setassoc or nonblocking level without sectors, a victim cache,
+ * compression, a zcache or exclusion, and the level below cannot be
+ * exclusive. validate cannot be inclusive either.
+ *
+ * The first level can be private to each of cores=N processors and kept
+ * coherent by a snooping bus with coherence=mesi or coherence=moesi (see
+ * SnoopingBus). buslat=N (4) is how long an upgrade or a cache-to-cache
+ * transfer takes. It must be a setassoc level without sectors, a victim
+ * cache, compression, a zcache, inclusion, write policies or a latency
+ * (hits respond right away, so the checker sees every core's accesses in
+ * order), and the level below cannot be exclusive. The caches are named
+ * after the level and their core, e.g. L1[0].
+ *
+ * directory=full or directory=coarse replaces the bus's broadcast with a
+ * sparse directory (see Directory) that only snoops the sharers of a line.
+ * coarse vectors have a bit per dirgroup=N (4) cores. The directory has
+ * direntries=N entries (by default twice the lines of all the private
+ * caches) in dirways=N (8) ways, replaced by dirrepl=lru or dirrepl=sharers
+ * (fewest sharers first), and a lookup takes dirlat=N (2) ticks. Each bit
+ * covers at most 64 cores' worth of sharers.
+ *
+ * The last level can share its ways among the cores of a coherent first
+ * level (see WayPartitioner). partition=ucp moves ways to the cores that
+ * gain the most hits, from utility monitors that watch partsets=N (32)
+ * sets, every partinterval=N (10000) accesses. partition=cat gives each
+ * core a fixed mask of the ways it may fill, waymasks=<mask>,<mask>,...
+ * in hex with one mask per core (e.g., waymasks=0x0f,0xf0). ucp needs at
+ * least a way per core. The level must be setassoc or nonblocking without
+ * compression, a zcache, exclusion or metadata ways. Processors then also
+ * print their throughput, to compare the cores.
+ *
+ * The line size can grow from one level to the next. An exclusive level
+ * must have the same line size as the level above and cannot be direct
+ * mapped or the first level. Only non-blocking levels can prefetch.
+ */
+class Hierarchy
+{
+  public:
+    struct LevelConfig
+    {
+        std::string name;
+        std::string type;
+        int64_t size;
+        int lineSize;
+        int ways;
+        int mshrs;
+        int wbEntries;
+        int victimEntries;
+        int sectors;
+        Cache::InclusionPolicy inclusion;
+        std::string prefetcher;
+        int prefetchDegree;
+        int prefetchStreams;
+        int prefetchDistance;
+        int prefetchRegion;
+        int prefetchMetadata;
+
+        /// Ways of the last level that hold temporal metadata, 0 for none
+        int metadataWays;
+
+        /// Largest degree the throttle may pick, 0 for no throttle
+        int prefetchThrottle;
+
+        /// none, bdi or fpc
+        std::string compression;
+
+        /// Tags per physical way of a compressed level
+        int tagFactor;
+
+        /// Hit latency (0 and 0 for instant hits) and number of banks
+        int tagLatency;
+        int dataLatency;
+        int banks;
+
+        /// fixed (taglat and datalat) or model (from SRAMModel)
+        std::string timing;
+
+        /// none, mru or hash
+        std::string wayPrediction;
+
+        /// modulo, xor, prime or skewed
+        std::string index;
+
+        /// Levels of a zcache's replacement walk, 0 if it is not a zcache
+        int zcacheLevels;
+
+        /// back or through
+        std::string writePolicy;
+
+        /// allocate, noallocate or validate
+        std::string writeMissPolicy;
+
+        /// none, mesi or moesi
+        std::string coherence;
+
+        /// Processors with a private copy of a coherent level
+        int cores;
+
+        /// Ticks for an upgrade or a cache-to-cache transfer
+        int busLatency;
+
+        /// none (a snooping bus), full or coarse
+        std::string directory;
+
+        /// Cores per bit of a coarse sharer vector
+        int dirGroup;
+
+        /// Directory entries (0 for twice the private lines) and ways
+        int dirEntries;
+        int dirWays;
+
+        /// Ticks per directory lookup
+        int dirLatency;
+
+        /// lru or sharers
+        std::string dirReplacement;
+
+        /// none, ucp (utility monitors) or cat (fixed way masks)
+        std::string partition;
+
+        /// The ways each core may fill with cat, one mask per core
+        std::vector<uint64_t> wayMasks;
+
+        /// Accesses between ucp reallocations, and the sets it samples
+        int partitionInterval;
+        int partitionSets;
+
+        LevelConfig(std::string name = "L1", std::string type = "nonblocking",
+                    int64_t size = 1 << 10, int line_size = 8, int ways = 4,
+                    int mshrs = 2) :
+            name(name), type(type), size(size), lineSize(line_size),
+            ways(ways), mshrs(mshrs), wbEntries(8), victimEntries(0),
+            sectors(1), inclusion(Cache::NonInclusive), prefetcher("none"),
+            prefetchDegree(4), prefetchStreams(4), prefetchDistance(1),
+            prefetchRegion(2048), prefetchMetadata(16384), metadataWays(0),
+            prefetchThrottle(0), compression("none"), tagFactor(2),
+            tagLatency(0), dataLatency(0), banks(1), timing("fixed"),
+            wayPrediction("none"), index("modulo"),
+            zcacheLevels(0), writePolicy("back"), writeMissPolicy("allocate"),
+            coherence("none"), cores(1), busLatency(4), directory("none"),
+            dirGroup(4), dirEntries(0), dirWays(8), dirLatency(2),
+            dirReplacement("lru"), partition("none"),
+            partitionInterval(10000), partitionSets(32)
+            {}
+    };
+
+    struct MemoryConfig
+    {
+        int queueDepth;
+        int transferTicks;
+
+        /// Pieces a line is delivered in, critical word first
+        int beats;
+
+        MemoryConfig() : queueDepth(16), transferTicks(0), beats(1) {}
+    };
+
+    struct TLBConfig
+    {
+        /// Bytes per page, 0 for no translation
+        int64_t pageSize;
+
+        int l1Entries;
+        int l1Ways;
+        int l2Entries;
+        int l2Ways;
+        int l2Latency;
+
+        /// Entries of each page-walk cache, 0 for none
+        int pwcEntries;
+
+        TLBConfig() : pageSize(0), l1Entries(64), l1Ways(4), l2Entries(1024),
+                      l2Ways(8), l2Latency(7), pwcEntries(16) {}
+    };
+
+    /**
+     * Create the caches and connect processor -> L1 -> ... -> memory.
+     * The last level's line size must match memory's.
+     *
+     * @param levels describes the caches, closest to the processor first
+     * @param processors has one processor per core of a coherent first
+     *        level, otherwise just one
+     * @param tlb gives each processor an MMU, unless its page size is 0
+     */
+    Hierarchy(const std::vector<LevelConfig>& levels,
+              const std::vector<Processor*>& processors, Memory& memory,
+              const TLBConfig& tlb);
+
+    /**
+     * Prints the effective capacity (bytes held by at least one level) and
+     * the energy, then deletes the caches, printing their statistics from
+     * L1 down.
+     */
+    ~Hierarchy();
+
+    /**
+     * Flush every level into memory, the last level first, and check that
+     * memory then holds everything the processors wrote. Call it once the
+     * simulation is done.
+     */
+    void checkMemory(Memory& memory);
+
+    /**
+     * Read the levels from a file.
+     *
+     * @param levels is filled with one entry per level
+     * @param memory is set from the memory line, if there is one
+     * @param tlb is set from the tlb line, if there is one
+     * @return false if the file cannot be read or has an error
+     */
+    static bool loadConfig(const std::string& filename,
+                           std::vector<LevelConfig>& levels,
+                           MemoryConfig& memory, TLBConfig& tlb);
+
+    /**
+     * @return the cache at the given level (0 is closest to the processor).
+     *         A coherent first level has a cache per core, which come
+     *         first.
+     */
+    Cache* getCache(int level) { return caches[level]; }
+
+    int getNumLevels() { return levels.size(); }
+
+  private:
+    /**
+     * Create one cache below mem_side.
+     *
+     * @param core is the cache's core on the bus of a coherent level
+     */
+    Cache* createCache(const LevelConfig& level, ResponsePort& mem_side,
+                       int addr_size, int core = -1);
+
+    std::vector<LevelConfig> levels;
+
+    std::vector<Processor*> processors;
+
+    /// One per processor if addresses are translated
+    std::vector<MMU*> mmus;
+
+    /// Shared by the MMUs, nullptr if there are none
+    PageTable* pageTable;
+
+    /// The caches, closest to the processor first
+    std::vector<Cache*> caches;
+
+    /// Keeps a coherent first level's caches coherent (a bus or a
+    /// directory), nullptr if there is none
+    SnoopingBus* bus;
+
+    std::vector<VictimCache*> victimCaches;
+
+    std::vector<Prefetcher*> prefetchers;
+
+    /// The temporal prefetcher that keeps its metadata in the last level
+    TemporalPrefetcher* temporal;
+
+    /// Shares the last level among the cores, nullptr if it is not shared
+    WayPartitioner* partitioner;
+};
+
+#endif // CSIM_HIERARCHY_H
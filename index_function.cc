@@ -0,0 +1,84 @@
+
+#include <cassert>
+
+#include "index_function.hh"
+#include "util.hh"
+
+IndexFunction::IndexFunction(int64_t sets, Kind kind) :
+    kind(kind), sets(sets), setBits(log2int(sets)), prime(sets)
+{
+    // Trial division is fine, this happens once per cache.
+    for (; prime > 2; prime--) {
+        bool is_prime = true;
+        for (int64_t divisor = 2; divisor * divisor <= prime; divisor++) {
+            if (prime % divisor == 0) {
+                is_prime = false;
+                break;
+            }
+        }
+        if (is_prime) break;
+    }
+}
+
+int64_t IndexFunction::getIndex(uint64_t line_number, int way)
+{
+    switch (kind) {
+      case PrimeModulo:
+        return line_number % prime;
+      case XOR:
+      case Skewed:
+        return (line_number ^ hash(getTag(line_number), way)) & (sets - 1);
+      default:
+        return line_number & (sets - 1);
+    }
+}
+
+uint64_t IndexFunction::getTag(uint64_t line_number)
+{
+    if (kind == PrimeModulo) {
+        return line_number / prime;
+    }
+    return line_number >> setBits;
+}
+
+uint64_t IndexFunction::getLineNumber(uint64_t tag, int64_t index, int way)
+{
+    switch (kind) {
+      case PrimeModulo:
+        return tag * prime + index;
+      case XOR:
+      case Skewed:
+        return (tag << setBits) | ((index ^ hash(tag, way)) & (sets - 1));
+      default:
+        return (tag << setBits) | index;
+    }
+}
+
+std::string IndexFunction::getName()
+{
+    switch (kind) {
+      case XOR:
+        return "xor";
+      case PrimeModulo:
+        return "prime modulo";
+      case Skewed:
+        return "skewed";
+      default:
+        return "modulo";
+    }
+}
+
+uint64_t IndexFunction::hash(uint64_t tag, int way)
+{
+    if (setBits == 0) return 0;
+
+    uint64_t folded = 0;
+    for (; tag; tag >>= setBits) {
+        folded ^= tag & (sets - 1);
+    }
+    if (kind != Skewed) return folded;
+
+    int shift = way % setBits;
+    if (shift == 0) return folded;
+    return ((folded << shift) | (folded >> (setBits - shift))) & (sets - 1);
+}
@@ -0,0 +1,77 @@
+
+#ifndef CSIM_INDEX_FUNCTION_H
+#define CSIM_INDEX_FUNCTION_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Maps a line number (address >> line bits) to a set, and splits it into
+ * the set index and the tag that is stored, so that the line number can be
+ * rebuilt from the two.
+ *
+ * Modulo takes the low bits, which makes power of 2 strides fall into a
+ * few sets. XOR folds the tag into the index. PrimeModulo uses the largest
+ * prime number of sets that fits, leaving the other sets unused. Skewed
+ * (Seznec's skewed associativity) gives every way its own XOR hash, with
+ * the folded tag rotated by the way number, so lines that conflict in one
+ * way usually do not in the others.
+ */
+class IndexFunction
+{
+  public:
+    enum Kind {
+        Modulo,
+        XOR,
+        PrimeModulo,
+        Skewed
+    };
+
+    /**
+     * @param sets is the number of sets, a power of 2
+     */
+    IndexFunction(int64_t sets, Kind kind = Modulo);
+
+    /**
+     * @param way only matters if the kind is Skewed
+     */
+    int64_t getIndex(uint64_t line_number, int way = 0);
+
+    uint64_t getTag(uint64_t line_number);
+
+    /**
+     * @return the line number that has this tag and index
+     */
+    uint64_t getLineNumber(uint64_t tag, int64_t index, int way = 0);
+
+    /**
+     * @return how many more tag bits than Modulo the tags need
+     */
+    int getExtraTagBits() { return kind == PrimeModulo ? 1 : 0; }
+
+    /**
+     * @return the number of sets lines can go in
+     */
+    int64_t getUsedSets() { return kind == PrimeModulo ? prime : sets; }
+
+    Kind getKind() { return kind; }
+
+    std::string getName();
+
+  private:
+    /**
+     * @return the tag folded into the index bits and rotated by the way
+     */
+    uint64_t hash(uint64_t tag, int way);
+
+    Kind kind;
+
+    int64_t sets;
+
+    int setBits;
+
+    /// Largest prime number that is not more than sets
+    int64_t prime;
+};
+
+#endif // CSIM_INDEX_FUNCTION_H
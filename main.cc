@@ -1,12 +1,13 @@
 
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
-#include "direct_mapped.hh"
+#include "hierarchy.hh"
 #include "memory.hh"
 #include "processor.hh"
 #include "record_store.hh"
-#include "set_assoc.hh"
-#include "non_blocking.hh"
 
 
 
@@ -17,32 +18,72 @@ int main(int argc, char *argv[])
     // const char* recordFile = "./tests/randomSimple10000.txt";
     // const char* recordFile = "./tests/randomStagger10000.txt";
     // const char* recordFile = "./tests/randomStagger1000000.txt";
-    if (argc == 2) {
+    // const char* hierarchyFile = "./configs/two_level.cfg";
+    const char* hierarchyFile = nullptr;
+    if (argc >= 2) {
         recordFile = argv[1];
-    } 
-	else if (argc > 2) {
-        std::cout << "Usage: cache_simulator [records file]" << std::endl;
+    }
+    if (argc == 3) {
+        hierarchyFile = argv[2];
+    }
+	else if (argc > 3) {
+        std::cout << "Usage: cache_simulator [records file[,records file...]] [hierarchy file]" << std::endl;
     }
 
-    Processor p(32);
-    Memory m(8);
-    RecordStore records(recordFile);
-    if (!records.loadRecords()) {
-        std::cerr << "Could not load file: " << recordFile << std::endl;
+    std::vector<Hierarchy::LevelConfig> levels;
+    Hierarchy::MemoryConfig memory;
+    Hierarchy::TLBConfig tlb;
+    if (!hierarchyFile) {
+        // One non-blocking cache: 1KB, 4 ways, 2 MSHRs
+        levels.push_back(Hierarchy::LevelConfig());
+    } else if (!Hierarchy::loadConfig(hierarchyFile, levels, memory, tlb)) {
+        std::cerr << "Could not load file: " << hierarchyFile << std::endl;
         return 1;
     }
-    p.setMemory(&m);
-    p.setRecords(&records);
-    
-    // DirectMappedCache c(1 << 10, m, p);
-    // SetAssociativeCache c(1 << 10, m, p, 4);
-    NonBlockingCache c(1 << 10, m, p, 4, 2);
 
-    p.scheduleForSimulation();
+    // A coherent first level has a processor per core, each with its own
+    // records (or all with the same ones).
+    int cores = levels[0].coherence != "none" ? levels[0].cores : 1;
+    std::vector<std::string> recordFiles;
+    std::istringstream files(recordFile);
+    for (std::string file; std::getline(files, file, ',');) {
+        recordFiles.push_back(file);
+    }
+    if (recordFiles.size() != 1 && (int)recordFiles.size() != cores) {
+        std::cerr << "Need 1 or " << cores << " records files" << std::endl;
+        return 1;
+    }
+
+    // Memory moves the last level's sectors (its lines if not sectored).
+    Memory m(levels.back().lineSize / levels.back().sectors, memory.queueDepth,
+             memory.transferTicks, memory.beats);
+    std::vector<Processor*> processors;
+    std::vector<RecordStore*> records;
+    for (int core = 0; core < cores; core++) {
+        const std::string& file = recordFiles[core % recordFiles.size()];
+        records.push_back(new RecordStore(file));
+        if (!records.back()->loadRecords()) {
+            std::cerr << "Could not load file: " << file << std::endl;
+            return 1;
+        }
+        processors.push_back(new Processor(32));
+        if (cores > 1) {
+            processors.back()->setName("P" + std::to_string(core));
+        }
+        processors.back()->setMemory(&m);
+        processors.back()->setRecords(records.back());
+    }
+
+    Hierarchy* hierarchy = new Hierarchy(levels, processors, m, tlb);
+
+    for (auto p : processors) {
+        p->scheduleForSimulation();
+    }
 
     std::cout << "Running simulation" << std::endl;
     TickedObject::runSimulation();
     std::cout << "Simulation done" << std::endl;
+    hierarchy->checkMemory(m);
 
     std::cout << "Data size: ";
     std::cout << ((float)SRAMArray::getTotalSize())/1024 << "KB" << std::endl;
@@ -50,5 +91,13 @@ int main(int argc, char *argv[])
     std::cout << "Tag size: ";
     std::cout << ((float)TagArray::getTotalSize())/1024 << "KB" << std::endl;
 
+    delete hierarchy;
+    for (auto p : processors) {
+        delete p;
+    }
+    for (auto r : records) {
+        delete r;
+    }
+
     return 0;
 }
@@ -1,31 +1,56 @@
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
-#include "cache.hh"
 #include "memory.hh"
 #include "util.hh"
 
-Memory::Memory(int line_size) :
+Memory::Memory(int line_size, int queue_depth, int transfer_ticks, int beats) :
+    ResponsePort(queue_depth),
     memorySize(1<<26), // 64 MB
-    lineSize(line_size),
-    cacheWritebacks(0), cacheMisses(0)
+    lineSize(line_size), transferTicks(transfer_ticks), beats(beats),
+    channelFree(0),
+    cacheWritebacks(0), cacheMisses(0), partialWrites(0), channelWaits(0),
+    checkWritebacks(true)
 {
+    assert(transfer_ticks >= 0);
+    assert(beats > 0 && line_size % beats == 0);
 }
 
 Memory::~Memory()
 {
     std::cout << "Writebacks: " << cacheWritebacks << std::endl;
     std::cout << "Misses:     " << cacheMisses << std::endl;
+    if (partialWrites > 0) {
+        std::cout << "Partial writes: " << partialWrites << std::endl;
+    }
+    if (transferTicks > 0) {
+        std::cout << "Channel waits: " << channelWaits << std::endl;
+    }
+    if (beats > 1) {
+        std::cout << "Beats per line: " << beats << " (" << lineSize / beats;
+        std::cout << " bytes, critical word first)" << std::endl;
+    }
     for (auto it : dataStorage) {
         assert(it.second.data);
         delete[] it.second.data;
+        delete[] it.second.stored;
     }
 }
 
-void Memory::receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id)
+bool Memory::receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id)
 {
-    if (data) {
+    if (!data && !checkCredit()) {
+        // No room in the read queue.
+        return false;
+    }
+
+    if (data && size < lineSize) {
+        // A store that went around or through the caches
+        partialWrites++;
+    }
+    else if (data) {
         // writing back data, so this is a writeback.
         cacheWritebacks++;
     } 
@@ -35,39 +60,91 @@ void Memory::receiveRequest(uint64_t address, int size, const uint8_t* data, int
     }
     // Immediately deal with the request.
 
-    // Only accept lineSize requests that are correctly aligned
-    assert(size == lineSize);
-    assert((address & (lineSize - 1)) == 0);
-
-    // get pointer from map.
-    auto it = dataStorage.find(address);
-    if (it == dataStorage.end()) {
-        uint8_t *new_data = new uint8_t[lineSize];
-        memset(new_data, 1, lineSize);
-        dataStorage[address] = {new_data, false};
-    }
+    // Only accept lineSize reads (and writes up to lineSize) that are
+    // correctly aligned
+    assert(size == lineSize || (data && size < lineSize));
+    assert((address & (size - 1)) == 0);
 
-    uint8_t* mem_data = dataStorage[address].data;
+    uint64_t line_address = address & ~(uint64_t)(lineSize - 1);
+    int offset = address - line_address;
+    Block& block = getBlock(line_address);
+    uint8_t* mem_data = block.stored;
 
     if (data) {
-        // Instead of writing the data, make sure the data is correct.
-        bool match = compareData(mem_data, data, lineSize);
-        if (!match) {
-            std::cout << "Address " << std::hex << address << std::endl;
-            std::cout << "ERROR! Writeback contains wrong data." << std::endl;
-            assert(0); // Assert for easier gdb
+        // Make sure the data is correct.
+        if (checkWritebacks) {
+            bool match = compareData(block.data + offset, data, size);
+            if (!match) {
+                std::cout << "Address " << std::hex << address << std::endl;
+                std::cout << "ERROR! Writeback contains wrong data." << std::endl;
+                assert(0); // Assert for easier gdb
+            }
         }
+        memcpy(mem_data + offset, data, size);
         // Now that it's written back, it's no longer dirty in the cache
-        dataStorage[address].dirty = false;
+        block.dirty = false;
+
+        // The data still has to cross the channel.
+        if (transferTicks > 0) {
+            channelFree = std::max(channelFree, curTick()) + transferTicks;
+        }
     } 
 	else {
         // If reading schedule a request for later.
         // Wait for a "random" amount of time to reply
-        schedule(10+curTick() % 10,
+        int64_t latency = 10 + curTick() % 10;
+        if (transferTicks > 0) {
+            // The line comes back over the channel once it is free.
+            int64_t done = std::max(curTick() + latency, channelFree + transferTicks);
+            channelWaits += done - (curTick() + latency);
+            channelFree = done;
+            latency = done - curTick();
+        }
+        takeCredit();
+        if (beats > 1) {
+            // The burst ends when the whole line would have arrived, starting
+            // with the beat the requestor is waiting for. The last beat comes
+            // with the response.
+            int beat_size = lineSize / beats;
+            int first = requestor->getCriticalOffset(request_id) / beat_size;
+            int64_t burst = transferTicks > 0 ? transferTicks : beats;
+            for (int i = 0; i < beats - 1; i++) {
+                int offset = (first + i) % beats * beat_size;
+                int64_t ticks = latency - burst + (i + 1) * burst / beats;
+                schedule(std::max(ticks, (int64_t)1),
+                        [this, request_id, mem_data, offset, beat_size]{
+                            sendBeat(request_id, offset, beat_size, mem_data + offset);
+                        });
+            }
+        }
+        schedule(latency,
                 [this, request_id, mem_data]{
-                    cache->receiveMemResponse(request_id, mem_data);
+                    sendResponse(request_id, mem_data);
+                    returnCredit();
                 });
     }
+
+    return true;
+}
+
+void Memory::flushWrite(uint64_t address, int size, const uint8_t* data)
+{
+    // A line from above may be smaller than memory's, but never crosses one.
+    uint64_t line_address = address & ~(uint64_t)(lineSize - 1);
+    int offset = address - line_address;
+    assert(offset + size <= lineSize);
+    memcpy(getBlock(line_address).stored + offset, data, size);
+}
+
+void Memory::checkFlushed()
+{
+    for (auto& it : dataStorage) {
+        if (!compareData(it.second.data, it.second.stored, lineSize)) {
+            std::cout << "Address " << std::hex << it.first << std::endl;
+            std::cout << "ERROR! Memory does not hold what was written." << std::endl;
+            assert(0); // Assert for easier gdb
+        }
+    }
 }
 
 int Memory::getLineSize()
@@ -80,36 +157,53 @@ int Memory::getLineBits()
     return log2int(lineSize);
 }
 
+Memory::Block& Memory::getBlock(uint64_t line_address)
+{
+    auto it = dataStorage.find(line_address);
+    if (it == dataStorage.end()) {
+        uint8_t *new_data = new uint8_t[lineSize];
+        memset(new_data, 1, lineSize);
+        uint8_t *new_stored = new uint8_t[lineSize];
+        memset(new_stored, 1, lineSize);
+        it = dataStorage.emplace(line_address,
+                                 Block{new_data, new_stored, false}).first;
+    }
+    return it->second;
+}
+
 void Memory::processorWrite(uint64_t address, int size, const uint8_t* data)
 {
     uint64_t line_address = address & ~(lineSize - 1);
-    auto it = dataStorage.find(line_address);
 
-    // We should always have backing data since processorWrite is called after
-    // the request completes.
-    assert(it != dataStorage.end());
+    // There may be no backing data yet if the caches never fetched the line
+    // (e.g., write-validate).
+    Block& block = getBlock(line_address);
 
     int block_offset =  address & (lineSize - 1);
 
     // Write the data to the backing store.
-    memcpy(it->second.data + block_offset, data, size);
+    memcpy(block.data + block_offset, data, size);
 
     // Mark that the cache contains dirty data
-    it->second.dirty = true;
+    block.dirty = true;
 }
 
-void Memory::checkRead(uint64_t address, int size, const uint8_t* data)
+void Memory::expectRead(uint64_t address, int size, uint8_t* expected)
 {
     uint64_t line_address = address & ~(lineSize - 1);
-    auto it = dataStorage.find(line_address);
 
-    // We should always have backing data since processorWrite is called after
-    // the request completes.
-    assert(it != dataStorage.end());
+    // Nothing may have been written to the line yet.
+    Block& block = getBlock(line_address);
 
     int block_offset = address & (lineSize - 1);
 
-    bool match = compareData(it->second.data + block_offset, data, size);
+    memcpy(expected, block.data + block_offset, size);
+}
+
+void Memory::checkRead(uint64_t address, int size, const uint8_t* expected,
+                       const uint8_t* data)
+{
+    bool match = compareData(expected, data, size);
     if (!match) {
         std::cout << "Address " << std::hex << address << std::endl;
         std::cout << "ERROR! Read contains wrong data." << std::endl;
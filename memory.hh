@@ -4,14 +4,26 @@
 
 #include <cstdint>
 #include <map>
+#include <vector>
 
-#include "cache.hh"
+#include "port.hh"
 #include "ticked_object.hh"
 
-class Memory : public TickedObject
+class Memory : public TickedObject, public ResponsePort
 {
   public:
-    Memory(int line_size);
+    /**
+     * @param line_size is the size of a request in bytes
+     * @param queue_depth is the number of reads that can be outstanding
+     * @param transfer_ticks is how long one line (read or write) holds the
+     *        channel, 0 for unlimited bandwidth
+     * @param beats is the number of pieces a read's line is sent in, the
+     *        requestor's critical word first. They are spread over the
+     *        transfer time, or a tick apart with unlimited bandwidth, and
+     *        the last one arrives when the whole line used to.
+     */
+    Memory(int line_size, int queue_depth = 16, int transfer_ticks = 0,
+           int beats = 1);
     ~Memory();
 
     /**
@@ -20,11 +32,14 @@ class Memory : public TickedObject
      * request will be aligned to a 4 byte boundary)
      *
      * @param address of the request
-     * @param size in bytes of the request (should be line size).
+     * @param size in bytes of the request. Reads are a line, writes can be
+     *        smaller (e.g., from a write-through cache).
      * @param data is non-null, then this is a store request.
      * @param request_id the id that must be used when replying to this request
+     *
+     * @return false if the read queue is full. Writes are never refused.
      */
-    void receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id);
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) override;
 
     /**
      * @return the line size in bytes
@@ -38,34 +53,80 @@ class Memory : public TickedObject
     int getLineBits();
 
     /**
-     * Connect the cache
+     * If true (the default), every writeback is checked against the data the
+     * processor wrote. This only holds with a single level of cache: with
+     * more levels, an outer level may write back an old copy of a line that
+     * an inner level has since changed.
+     */
+    void setCheckWritebacks(bool check) { checkWritebacks = check; }
+
+    /**
+     * Write data that is still dirty in a cache at the end of the run, as if
+     * the caches were flushed. Nothing is checked or counted. The last level
+     * goes first so that newer copies from above land on top.
      */
-    void setCache(Cache *cache) { this->cache = cache; }
+    void flushWrite(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * Check that memory holds everything the processor wrote. Call it once
+     * the caches have been flushed with flushWrite(). This holds with any
+     * number of levels, unlike the check of each writeback.
+     */
+    void checkFlushed();
 
     /**
      * DO NOT USE THESE FUNCTIONS! THESE ARE FOR TESTING PURPOSES ONLY
+     *
+     * processorWrite is called when the cache takes a store, which is where
+     * the store is ordered with the other requests: it may be written back
+     * (or through) before its response. expectRead copies out what a read
+     * the cache takes now must return, and checkRead compares that with
+     * what it returned.
      */
     void processorWrite(uint64_t address, int size, const uint8_t* data);
-    void checkRead(uint64_t address, int size, const uint8_t* data);
+    void expectRead(uint64_t address, int size, uint8_t* expected);
+    void checkRead(uint64_t address, int size, const uint8_t* expected,
+                   const uint8_t* data);
 
   private:
-    Cache *cache;
-
     int64_t memorySize;
     int lineSize;
 
     struct Block 
 	{
-        uint8_t *data;
+        uint8_t *data; // What the processor has written (used for checking)
+        uint8_t *stored; // What has been written back to memory
         bool dirty; // True if this data is dirty in the cache.
     };
 
+    /**
+     * @return the block for a line address, filled with 1s if it is new
+     */
+    Block& getBlock(uint64_t line_address);
+
     /// Cheat and only allocate the blocks needed
     std::map<uint64_t, Block> dataStorage;
 
+    /// Ticks each line keeps the channel busy, 0 for unlimited bandwidth
+    int transferTicks;
+
+    /// Pieces a line is read in
+    int beats;
+
+    /// First tick the channel is free
+    int64_t channelFree;
+
     int64_t cacheWritebacks;
     int64_t cacheMisses;
 
+    /// Writes of less than a line
+    int64_t partialWrites;
+
+    /// Ticks reads spent waiting for the channel
+    int64_t channelWaits;
+
+    bool checkWritebacks;
+
     /**
      * Returns false if data does not match
      */
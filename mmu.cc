@@ -0,0 +1,221 @@
+
+#include <cassert>
+#include <climits>
+#include <iostream>
+
+#include "mmu.hh"
+#include "util.hh"
+
+MMU::MMU(ResponsePort& mem_side, PageTable& page_table, int l1_entries,
+         int l1_ways, int l2_entries, int l2_ways, int l2_latency,
+         int pwc_entries) :
+    ResponsePort(1), memSide(mem_side), pageTable(page_table),
+    l1TLB(l1_entries, l1_ways), l2TLB(l2_entries, l2_ways),
+    l2Latency(l2_latency), name("MMU"),
+    pending({-1, 0, 0, {}, false, 0}), phase(Idle), walkLevel(0),
+    walkStart(0), waitingForCache(false), nextTag(0), requests(0), walks(0),
+    entriesRead(0), walkTicks(0),
+    walkCacheHits(page_table.getLeafLevel(), 0), translationTicks(0)
+{
+    assert(l2_latency >= 0 && pwc_entries >= 0);
+    if (pwc_entries > 0) {
+        for (int level = 0; level < page_table.getLeafLevel(); level++) {
+            walkCaches.emplace_back(pwc_entries, pwc_entries);
+        }
+    }
+    memSide.setRequestor(this);
+}
+
+MMU::~MMU()
+{
+    int64_t page_size = pageTable.getPageSize();
+    std::cout << name << " page size: ";
+    if (page_size >= 1 << 30) {
+        std::cout << (page_size >> 30) << "GB" << std::endl;
+    } else if (page_size >= 1 << 20) {
+        std::cout << (page_size >> 20) << "MB" << std::endl;
+    } else {
+        std::cout << (page_size >> 10) << "KB" << std::endl;
+    }
+    l1TLB.printStats(name + " L1 TLB");
+    l2TLB.printStats(name + " L2 TLB");
+    std::cout << name << " walks: " << walks << " (" << entriesRead;
+    std::cout << " entries read)" << std::endl;
+    for (size_t level = 0; level < walkCaches.size(); level++) {
+        std::cout << name << " PWC level " << level << " hits: ";
+        std::cout << walkCacheHits[level] << " (" << walkCaches[level].getEntries();
+        std::cout << " entries)" << std::endl;
+    }
+    std::cout << name << " average walk latency: ";
+    std::cout << (walks ? (float)walkTicks / walks : 0) << " ticks" << std::endl;
+    std::cout << name << " translation ticks: " << translationTicks << " (";
+    std::cout << (requests ? (float)translationTicks / requests : 0);
+    std::cout << " per request)" << std::endl;
+}
+
+bool MMU::receiveRequest(uint64_t address, int size, const uint8_t* data,
+                         int request_id)
+{
+    if (!checkCredit()) {
+        DPRINT("MMU is translating");
+        return false;
+    }
+    assert(!pageTable.contains(address + size - 1));
+    if (!memSide.checkCredit()) {
+        // Gets a retry from the cache, which is passed on
+        waitingForCache = true;
+        return refuse();
+    }
+
+    uint64_t page = pageTable.getPage(address);
+    if (l1TLB.lookup(page)) {
+        if (!forward(address, size, data, request_id)) {
+            waitingForCache = true;
+            return refuse();
+        }
+        requests++;
+        return true;
+    }
+
+    DPRINT("L1 TLB miss for 0x" << std::hex << address << std::dec);
+    pending.requestId = request_id;
+    pending.address = address;
+    pending.size = size;
+    pending.write = data != nullptr;
+    pending.data.clear();
+    if (data) {
+        pending.data.assign(data, data + size);
+    }
+    pending.start = curTick();
+    takeCredit();
+    requests++;
+
+    phase = Lookup;
+    bool hit = l2TLB.lookup(page);
+    schedule(l2Latency, [this, hit, page] {
+        if (hit) {
+            l1TLB.insert(page);
+            finishTranslation();
+        } else {
+            startWalk();
+        }
+    });
+    return true;
+}
+
+void MMU::receiveResponse(int request_id, const uint8_t* data)
+{
+    auto it = tags.find(request_id);
+    assert(it != tags.end());
+    int processor_id = it->second;
+    tags.erase(it);
+    if (processor_id >= 0) {
+        sendResponse(processor_id, data);
+        return;
+    }
+
+    assert(phase == Walking);
+    if (walkLevel < pageTable.getLeafLevel()) {
+        // The entry points at the next level's node
+        if (!walkCaches.empty()) {
+            walkCaches[walkLevel].insert(pageTable.getPrefix(walkLevel,
+                                                             pending.address));
+        }
+        walkLevel++;
+        // Like a retry, the next read waits for the cache to finish
+        schedule(0, [this] { readEntry(); });
+        return;
+    }
+
+    walkTicks += curTick() - walkStart;
+    uint64_t page = pageTable.getPage(pending.address);
+    l2TLB.insert(page);
+    l1TLB.insert(page);
+    schedule(0, [this] { finishTranslation(); });
+}
+
+void MMU::receiveRetry()
+{
+    if (!waitingForCache) return;
+
+    waitingForCache = false;
+    // Not right away: the cache may be in the middle of a response.
+    schedule(0, [this] {
+        if (phase == Walking) {
+            readEntry();
+        } else if (phase == Forwarding) {
+            sendPending();
+        } else {
+            sendRetry(); // The processor's request was refused
+        }
+    });
+}
+
+int MMU::receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                           bool& dirty)
+{
+    return sendInvalidate(address, size, data, dirty);
+}
+
+bool MMU::forward(uint64_t address, int size, const uint8_t* data,
+                  int request_id)
+{
+    int tag = nextTag;
+    nextTag = nextTag == INT_MAX ? 0 : nextTag + 1;
+    // Before sending: the cache may respond before this returns.
+    tags[tag] = request_id;
+    if (!memSide.receiveRequest(address, size, data, tag)) {
+        tags.erase(tag);
+        return false;
+    }
+    return true;
+}
+
+void MMU::startWalk()
+{
+    walks++;
+    walkStart = curTick();
+    walkLevel = 0;
+    // The deepest page-walk cache hit skips the most levels
+    for (int level = walkCaches.size() - 1; level >= 0; level--) {
+        if (walkCaches[level].lookup(pageTable.getPrefix(level,
+                                                         pending.address))) {
+            walkCacheHits[level]++;
+            walkLevel = level + 1;
+            break;
+        }
+    }
+    phase = Walking;
+    readEntry();
+}
+
+void MMU::readEntry()
+{
+    uint64_t entry = pageTable.getEntryAddress(walkLevel, pending.address);
+    DPRINT("Walk reads level " << walkLevel << " at 0x" << std::hex << entry << std::dec);
+    if (!forward(entry, 8, nullptr, -1)) {
+        waitingForCache = true;
+        return;
+    }
+    entriesRead++;
+}
+
+void MMU::finishTranslation()
+{
+    translationTicks += curTick() - pending.start;
+    phase = Forwarding;
+    sendPending();
+}
+
+void MMU::sendPending()
+{
+    if (!forward(pending.address, pending.size,
+                 pending.write ? pending.data.data() : nullptr,
+                 pending.requestId)) {
+        waitingForCache = true;
+        return;
+    }
+    phase = Idle;
+    pending.requestId = -1;
+    returnCredit();
+}
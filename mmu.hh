@@ -0,0 +1,163 @@
+
+#ifndef CSIM_MMU_H
+#define CSIM_MMU_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "page_table.hh"
+#include "port.hh"
+#include "ticked_object.hh"
+#include "tlb.hh"
+
+/**
+ * Translates a processor's addresses before they reach its first level
+ * cache: processor -> MMU -> L1.
+ *
+ * An L1 TLB hit costs nothing (the L1 TLB is looked up alongside the
+ * cache). An L1 miss looks in the L2 TLB, which takes l2_latency ticks,
+ * and an L2 miss walks the page table. The walker reads one entry per
+ * level through the cache below, starting below the deepest level whose
+ * page-walk cache has the address. Translation is blocking: while a miss
+ * is being handled the processor cannot send more requests.
+ *
+ * Pages are identity mapped (see PageTable), so the request that goes on
+ * has the processor's address.
+ */
+class MMU : public TickedObject, public ResponsePort, public RequestPort
+{
+  public:
+    /**
+     * @param mem_side is the first level cache
+     * @param page_table may be shared with other MMUs
+     * @param pwc_entries is the size of each level's page-walk cache (fully
+     *        associative), 0 for none
+     */
+    MMU(ResponsePort& mem_side, PageTable& page_table, int l1_entries,
+        int l1_ways, int l2_entries, int l2_ways, int l2_latency,
+        int pwc_entries);
+
+    ~MMU() override;
+
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    void receiveResponse(int request_id, const uint8_t* data) override;
+
+    void receiveRetry() override;
+
+    /**
+     * Passes invalidations up to the processor.
+     */
+    int receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                          bool& dirty) override;
+
+    /**
+     * Set the name used when printing statistics (e.g., "MMU[0]")
+     */
+    void setName(const std::string& name) { this->name = name; }
+
+  private:
+    enum Phase {
+        Idle,
+
+        /// Waiting for the L2 TLB
+        Lookup,
+
+        /// Reading page-table entries
+        Walking,
+
+        /// Translated, but the cache refused the request
+        Forwarding
+    };
+
+    /**
+     * Send a translated request to the cache.
+     *
+     * @return false if the cache refused it
+     */
+    bool forward(uint64_t address, int size, const uint8_t* data,
+                 int request_id);
+
+    /**
+     * Called when the L2 TLB misses. Skips the levels the page-walk caches
+     * have.
+     */
+    void startWalk();
+
+    /**
+     * Read the entry of the level being walked.
+     */
+    void readEntry();
+
+    /**
+     * Called once the pending request is translated.
+     */
+    void finishTranslation();
+
+    /**
+     * Send the pending request on. Gives the processor back its credit
+     * unless the cache refuses.
+     */
+    void sendPending();
+
+    ResponsePort& memSide;
+
+    PageTable& pageTable;
+
+    TLB l1TLB;
+    TLB l2TLB;
+
+    /// Ticks to look in the L2 TLB
+    int l2Latency;
+
+    /// One per level above the leaf, empty if there are none
+    std::vector<TLB> walkCaches;
+
+    std::string name;
+
+    /// The request being translated
+    struct PendingRequest
+    {
+        int requestId;
+        uint64_t address;
+        int size;
+        std::vector<uint8_t> data;
+        bool write;
+
+        /// When it got here
+        int64_t start;
+    };
+
+    PendingRequest pending;
+
+    Phase phase;
+
+    /// The level being walked
+    int walkLevel;
+
+    int64_t walkStart;
+
+    /// True if the cache refused a request and will send a retry
+    bool waitingForCache;
+
+    /// Id sent to the cache -> the processor's id, -1 for the walker
+    std::map<int, int> tags;
+
+    int nextTag;
+
+    int64_t requests;
+    int64_t walks;
+    int64_t entriesRead;
+    int64_t walkTicks;
+
+    /// Hits in each level's page-walk cache
+    std::vector<int64_t> walkCacheHits;
+
+    /// Ticks from a request reaching the MMU to it going to the cache
+    int64_t translationTicks;
+};
+
+#endif // CSIM_MMU_H
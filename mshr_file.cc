@@ -0,0 +1,90 @@
+
+#include <cassert>
+
+#include "mshr_file.hh"
+
+MSHRFile::MSHRFile(int entries) :
+    entries(entries), occupancy(0)
+{
+    assert(entries > 0);
+
+    freeList.reserve(entries);
+    // Push in reverse so that the lowest tags are handed out first.
+    for (int i = entries - 1; i >= 0; i--) {
+        this->entries[i].tag = i;
+        this->entries[i].valid = false;
+        this->entries[i].type = Demand;
+        this->entries[i].lineAddress = 0;
+        freeList.push_back(i);
+    }
+    addressIndex.reserve(entries);
+}
+
+MSHRFile::Entry* MSHRFile::allocate(uint64_t line_address, Type type)
+{
+    assert(!freeList.empty());
+    assert(addressIndex.find(line_address) == addressIndex.end());
+
+    int tag = freeList.back();
+    freeList.pop_back();
+
+    Entry &entry = entries[tag];
+    assert(!entry.valid);
+    entry.valid = true;
+    entry.type = type;
+    entry.lineAddress = line_address;
+    entry.core = -1;
+    entry.targets.clear();
+
+    addressIndex[line_address] = tag;
+    occupancy++;
+
+    return &entry;
+}
+
+void MSHRFile::deallocate(Entry* entry)
+{
+    assert(entry);
+    assert(entry->valid);
+
+    addressIndex.erase(entry->lineAddress);
+    entry->valid = false;
+    entry->targets.clear();
+
+    freeList.push_back(entry->tag);
+    occupancy--;
+}
+
+void MSHRFile::addTarget(Entry* entry, int request_id, int offset, int size,
+                         const uint8_t* data)
+{
+    assert(entry->valid);
+
+    Target target;
+    target.requestId = request_id;
+    target.offset = offset;
+    target.size = size;
+    target.write = data != nullptr;
+    target.answered = false;
+    if (data) {
+        target.data.assign(data, data + size);
+    }
+    entry->targets.push_back(target);
+}
+
+MSHRFile::Entry* MSHRFile::findByAddress(uint64_t line_address)
+{
+    auto it = addressIndex.find(line_address);
+    if (it == addressIndex.end()) {
+        return nullptr;
+    }
+    return &entries[it->second];
+}
+
+MSHRFile::Entry* MSHRFile::findByTag(int tag)
+{
+    if (tag < 0 || tag >= (int)entries.size() || !entries[tag].valid) {
+        return nullptr;
+    }
+    return &entries[tag];
+}
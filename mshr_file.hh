@@ -0,0 +1,144 @@
+
+#ifndef CSIM_MSHR_FILE_H
+#define CSIM_MSHR_FILE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A file of miss status holding registers (MSHRs).
+ *
+ * Free entries are kept on a free list and busy entries are indexed both by
+ * their line address and by their tag (the request id sent to memory), so
+ * allocation, deallocation and both lookups are constant time regardless of
+ * the number of entries.
+ */
+class MSHRFile
+{
+  public:
+    /**
+     * A request from the processor that is waiting on an MSHR.
+     */
+    struct Target
+    {
+        /// The request id used by the processor
+        int requestId;
+
+        /// The byte offset of the request within the line
+        int offset;
+
+        /// The size of the request in bytes
+        int size;
+
+        /// True if this is a store
+        bool write;
+
+        /// Copy of the store data (empty for loads)
+        std::vector<uint8_t> data;
+
+        /// True if a load was answered before the line was filled
+        bool answered;
+    };
+
+    /**
+     * Why a line is being fetched.
+     */
+    enum Type {
+        /// A request from above missed
+        Demand,
+        /// A prefetch that nobody has asked for yet
+        Prefetch
+    };
+
+    struct Entry
+    {
+        /// Tag of this entry. This is the request id sent to memory.
+        int tag;
+
+        /// True if this entry is currently allocated
+        bool valid;
+
+        /// A prefetch becomes a demand miss when a request merges with it
+        Type type;
+
+        /// The line address that this entry is waiting for
+        uint64_t lineAddress;
+
+        /// The core the line is for, -1 if it is not known (e.g., a
+        /// prefetch)
+        int core;
+
+        /// All of the processor requests waiting on this line, in order
+        std::vector<Target> targets;
+    };
+
+    /**
+     * @param entries is the number of MSHRs
+     */
+    MSHRFile(int entries);
+
+    /**
+     * Allocate a free MSHR for the given line.
+     * There must be a free entry and no other entry for the same line.
+     *
+     * @return the newly allocated entry
+     */
+    Entry* allocate(uint64_t line_address, Type type = Demand);
+
+    /**
+     * Release an entry back to the free list.
+     */
+    void deallocate(Entry* entry);
+
+    /**
+     * Add a waiting request to an entry. The store data (if any) is copied.
+     */
+    void addTarget(Entry* entry, int request_id, int offset, int size,
+                   const uint8_t* data);
+
+    /**
+     * @return the entry waiting for the line, nullptr if there is none
+     */
+    Entry* findByAddress(uint64_t line_address);
+
+    /**
+     * @return the entry with the given tag, nullptr if it is not allocated
+     */
+    Entry* findByTag(int tag);
+
+    /**
+     * @return the number of allocated entries
+     */
+    int getOccupancy() { return occupancy; }
+
+    /**
+     * @return the total number of entries
+     */
+    int getNumEntries() { return entries.size(); }
+
+    /**
+     * @return the number of free entries
+     */
+    int getNumFree() { return entries.size() - occupancy; }
+
+    /**
+     * @return true if there are no free entries
+     */
+    bool isFull() { return occupancy == (int)entries.size(); }
+
+  private:
+    /// Storage for all entries. The tag of an entry is its position here.
+    std::vector<Entry> entries;
+
+    /// Tags of all of the free entries
+    std::vector<int> freeList;
+
+    /// Maps a line address to the tag of the entry waiting for it
+    std::unordered_map<uint64_t, int> addressIndex;
+
+    /// Number of allocated entries
+    int occupancy;
+};
+
+#endif // CSIM_MSHR_FILE_H
@@ -0,0 +1,17 @@
+
+#include "next_line_prefetcher.hh"
+
+NextLinePrefetcher::NextLinePrefetcher(int line_size, int degree) :
+    Prefetcher(line_size, degree, degree > 16 ? degree : 16)
+{
+}
+
+void NextLinePrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    if (hit && !prefetched) return;
+
+    uint64_t line_address = address & ~((uint64_t)lineSize - 1);
+    for (int i = 1; i <= degree; i++) {
+        queuePrefetch(line_address + (uint64_t)i * lineSize);
+    }
+}
@@ -0,0 +1,25 @@
+
+#ifndef CSIM_NEXT_LINE_PREFETCHER_H
+#define CSIM_NEXT_LINE_PREFETCHER_H
+
+#include "prefetcher.hh"
+
+/**
+ * Prefetches the next N lines after a miss, or after the first demand hit
+ * to a prefetched line (tagged prefetching), so a sequential stream keeps
+ * the prefetcher going even once it stops missing.
+ */
+class NextLinePrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of lines to prefetch (N)
+     */
+    NextLinePrefetcher(int line_size, int degree = 1);
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+};
+
+#endif // CSIM_NEXT_LINE_PREFETCHER_H
@@ -1,138 +1,188 @@
 
 #include <cassert>
 #include <cstring>
+#include <iostream>
+#include <vector>
 
 #include "non_blocking.hh"
-#include "memory.hh"
-#include "processor.hh"
 #include "util.hh"
 
-// int numberOfWays;
-// int numberOfMSHR;
-
-NonBlockingCache::NonBlockingCache(int64_t size, Memory& memory, Processor& processor, int ways, int mshrs): 
-	SetAssociativeCache(size, memory, processor, ways),
-    tagBits(processor.getAddrSize() - log2int((size / memory.getLineSize())/ways) - memory.getLineBits()), // Tag bits = Processor Size - # of Sets - Offset
-    // # of Sets = # of Lines / ways
-    // # of Lines = Cache Size / Line Size
-    indexMask( ( ( size / memory.getLineSize() ) / ways ) - 1 ), // Index mask = 1 for each digit of Set # i.e. 32 sets = 11111
-    tagArray( ( size / memory.getLineSize() ), 2, tagBits ), // Tag Array is # of Lines, Valid Bit, Dirty Bit, Tag bits
-    dataArray(  ( size / memory.getLineSize() ), memory.getLineSize() ), // Data Array is # of Lines, Line Size
-    blocked(false),
-	mshrTable({ nullptr, nullptr, nullptr, nullptr, nullptr })
+NonBlockingCache::NonBlockingCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int mshrs, int wb_entries):
+	SetAssociativeCache(size, line_size, mem_side, addr_size, ways, mshrs, wb_entries, 1), // No sectors
+	mshrs(mshrs), prefetcher(nullptr), prefetchReserve(1),
+	prefetchScheduled(false), prefetchesIssued(0), prefetchesUseful(0),
+	prefetchesLate(0), prefetchPollution(0)
 {
-    assert(mshrs > 0);
-    numberOfWays = ways;
-	numberOfMSHR = mshrs;
-
-	// malloc space for MHRS arrays
-	mshrTable.savedId = (int *) malloc(sizeof(int) * mshrs);
-	mshrTable.savedAddr = (uint64_t *) malloc(sizeof(uint64_t) * mshrs);
-	mshrTable.savedSize = (int *) malloc(sizeof(int) * mshrs);
-	mshrTable.savedData = (uint8_t **) malloc(sizeof(uint8_t*) * mshrs);
-	mshrTable.savedSetLineIndex = (int *) malloc(sizeof(int) * mshrs);
-
-	// initialize MHRS array values to defaults
-	for (int i = 0; i < mshrs; i++){
-		mshrTable.savedId[i] = -1;
-		mshrTable.savedAddr[i] = 0;
-		mshrTable.savedSize[i] = 0;
-		mshrTable.savedData[i] = nullptr;
-		mshrTable.savedSetLineIndex[i] = -1;
-	}
-}
-
-// ADDRESS BREAKDOWN
-int64_t NonBlockingCache::getIndex(uint64_t address) // Returns Set # off Address
-{
-	return (address >> memory.getLineBits()) & indexMask; // Shift off Offset and mask by how many bits make Set #
-}
-
-int NonBlockingCache::getBlockOffset(uint64_t address) // Returns Offset off Address
-{
-	return address & (memory.getLineSize() - 1); // Mask by how many bits make Offset
-}
-
-uint64_t NonBlockingCache::getTag(uint64_t address) // Returns Tag off Address
-{
-	return address >> (processor.getAddrSize() - tagBits); // Shifts off any bits that aren't tag bits
 }
 
 NonBlockingCache::~NonBlockingCache()
 {
-	// free malloced space for MHRS table
-	free(mshrTable.savedId);
-	free(mshrTable.savedAddr);
-	free(mshrTable.savedSize);
-	free(mshrTable.savedData);
-	free(mshrTable.savedSetLineIndex);
+	if (prefetcher) {
+		prefetcher->printStats(name);
+		std::cout << name << " prefetches issued:   " << prefetchesIssued << std::endl;
+		std::cout << name << " prefetches useful:   " << prefetchesUseful << std::endl;
+		std::cout << name << " prefetches late:     " << prefetchesLate << std::endl;
+		std::cout << name << " prefetches useless:  " << prefetchesUseless << std::endl;
+		std::cout << name << " prefetch pollution:  " << prefetchPollution << std::endl;
+
+		// Misses the prefetcher removed or shortened, out of all the misses
+		// there would have been without it
+		int64_t uncovered = misses - prefetchesLate;
+		std::cout << name << " prefetch accuracy:   ";
+		std::cout << (prefetchesIssued ? 100.0 * prefetchesUseful / prefetchesIssued : 0) << "%" << std::endl;
+		std::cout << name << " prefetch coverage:   ";
+		std::cout << (prefetchesUseful + uncovered ? 100.0 * prefetchesUseful / (prefetchesUseful + uncovered) : 0) << "%" << std::endl;
+	}
 }
 
-int NonBlockingCache::evictedLineIndex()
+void NonBlockingCache::setPrefetcher(Prefetcher* prefetcher, int reserve)
 {
-	// Can implement cache eviction strategy here:
-	return (int) rand() % numberOfWays;
+	assert(reserve >= 0 && reserve < mshrs.getNumEntries());
+	this->prefetcher = prefetcher;
+	prefetchReserve = reserve;
 }
 
 bool NonBlockingCache::receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id)
 {
-	assert(size <= memory.getLineSize()); // within line size									  
-	assert(address < ((uint64_t)1 << processor.getAddrSize())); // within address range
+	assert(size <= lineSize); // within line size									  
+	assert(address < ((uint64_t)1 << addrSize)); // within address range
 	assert((address &  (size - 1)) == 0); // naturally aligned
 
-	if (blocked) {
+	if (!checkCredit()) {
 		DPRINT("Cache is blocked!"); // Cache is currently blocked, so it cannot receive a new request
 		return false;
 	}
 
+	if (data && writePolicy == WriteThrough && !writebackBuffer.hasSpace()) {
+		DPRINT("Write buffer is full!"); // Stall until the store can go through
+		writebackBuffer.kick();
+		return refuse();
+	}
+
 	int setLine = hit(address); // Check if Hit;  SetLine = line in Set if hit OR -1 if miss
 
+	if (setLine >= 0 && !data && !bytesValid(setLine, getBlockOffset(address), size)) { // Only some bytes were written
+		if (!refetch(setLine)) {
+			return false;
+		}
+		setLine = -1;
+	}
+
 	if (setLine >= 0) { // HIT
 		DPRINT("Hit in cache");
-		uint8_t* line = dataArray.getLine(setLine); // line is the Address of the data of Set Line
-
-		int block_offset = getBlockOffset(address); // Offset
-
-		if (data) { // WRITE
-			memcpy(&line[block_offset], data, size); // Write data into the address of the line
-			sendResponse(request_id, nullptr); 
-			tagArray.setState(setLine, Dirty); // Set Set line to dirty
+		if (inclusion == Exclusive && tagArray.getState(setLine) == Dirty && !writebackBuffer.hasSpace()) {
+			DPRINT("Writeback buffer is full!"); // Stall until the line can be written back
+			writebackBuffer.kick();
+			return refuse();
+		}
+		hits++;
+		monitor(address, request_id, true);
+		bool prefetched = prefetchedLines[setLine]; // First use of a prefetched line
+		prefetchedLines[setLine] = false;
+		if (prefetched) {
+			prefetchesUseful++;
 		}
-		else { // READ
-			sendResponse(request_id, &line[block_offset]);
+		accessLine(setLine, getBlockOffset(address), size, data, request_id, predictionPenalty(address, setLine));
+		if (inclusion == Exclusive) {
+			handOff(setLine);
 		}
+		demandAccessed(address, request_id, true, prefetched);
 	}
 	else { // MISS
 		DPRINT("Miss in cache");
-		setLine = dirty(address); // -1 if all lines of Set Dirty, index of Clean Line otherwise
-		if (setLine < 0) { // Every line in Set is Dirty
-			DPRINT("Dirty, writing back");
-			// EVICTION
-			setLine = (getIndex(address) * numberOfWays) + evictedLineIndex(); // SetLine is set to the evicted line
-			uint8_t* line = dataArray.getLine(setLine); // line points to data of the evicted line
-			// Calculate Writeback Address
-			uint64_t wb_address = tagArray.getTag(setLine) << (processor.getAddrSize() - tagBits); // Sets Tag of Writeback Address to Tag of Set Line
-			wb_address |= (getIndex(address) << memory.getLineBits()); // Sets Index to Set # of Address
-			// No Offset
-			sendMemRequest(wb_address, memory.getLineSize(), line, request_id); // Writeback: Sends request to memory for memory receive/write Line of data
+		uint64_t block_address = address & ~(lineSize - 1); // block_address = address without offset
+
+		MSHRFile::Entry* mshr = mshrs.findByAddress(block_address);
+		if (mshr) { // Secondary miss: the line is already on its way
+			DPRINT("Merging with MSHR " << mshr->tag);
+			misses++;
+			lookupMiss(address, request_id);
+			monitor(address, request_id, false);
+			mshrs.addTarget(mshr, request_id, getBlockOffset(address), size, data);
+			bool prefetched = mshr->type == MSHRFile::Prefetch; // A late prefetch
+			if (prefetched) {
+				prefetchesUseful++;
+				prefetchesLate++;
+			}
+			mshr->type = MSHRFile::Demand;
+			restartTargets(mshr); // Its bytes may be here already
+			demandAccessed(address, request_id, false, prefetched);
+		}
+		else if (data && writeMissPolicy != WriteAllocate) { // Nothing to fetch
+			if (!writeWithoutFetch(address, size, data, request_id)) {
+				return false;
+			}
+			demandAccessed(address, request_id, false, false);
 		}
-		tagArray.setState(setLine, Invalid); // Marks the Set Line as empty (either from eviction or already empty)
-		uint64_t block_address = address & ~(memory.getLineSize() - 1); // block_address = address without offset
-		sendMemRequest(block_address, memory.getLineSize(), nullptr, request_id); // Request to memory to get the data of block address bringing in each line of offset
-		
-		int availableMSHR = findEmptyMSHR();
-		// remember the CPU's request id
-		mshrTable.savedId[availableMSHR] = request_id;
-		// Remember the address
-		mshrTable.savedAddr[availableMSHR] = address;
-		// Remember the data if it is a write.
-		mshrTable.savedSize[availableMSHR] = size;
-		//mshrTable.savedData[availableMSHR] = (uint8_t*) &data;
-		mshrTable.savedData[availableMSHR] = (uint8_t*) data;
-		mshrTable.savedSetLineIndex[availableMSHR] = setLine;
-		if (availableMSHR == numberOfMSHR - 1) { // If the MSHR used was the last available MSHR on the table block the cache.
-			// Mark the cache as blocked
-			blocked = true; // The Cache is blocked while it is waiting for data from Memory
+		else {
+			if (!memSide.checkCredit()) {
+				DPRINT("Memory is full!"); // Try again when memory tells us it has room
+				return refuse();
+			}
+			if (!writebackBuffer.hasSpace()) {
+				DPRINT("Writeback buffer is full!"); // Stall until there is room
+				writebackBuffer.kick();
+				return refuse();
+			}
+			if (writesPending(block_address)) {
+				return refuse();
+			}
+
+			// A miss the prefetcher caused by evicting the line
+			bool polluted = isPrefetchVictim(block_address);
+
+			// The line may have been evicted recently and not made it to memory.
+			std::vector<uint8_t> evicted(lineSize);
+			bool evicted_dirty;
+			if (recoverLine(block_address, evicted.data(), evicted_dirty)) {
+				misses++;
+				lookupMiss(address, request_id);
+				monitor(address, request_id, false);
+				if (polluted) {
+					prefetchPollution++;
+				}
+				if (inclusion == Exclusive) {
+					// Straight up to the cache above, without filling it here.
+					respond(address, size, request_id, &evicted[getBlockOffset(address)]);
+					if (evicted_dirty) {
+						writebackBuffer.insert(block_address, evicted.data());
+					}
+				}
+				else {
+					// Bring it straight back, swapping out this set's victim.
+					setLine = fillLine(block_address, evicted.data(), evicted_dirty, false, requestCore(request_id));
+					accessLine(setLine, getBlockOffset(address), size, data, request_id);
+				}
+				demandAccessed(address, request_id, false, false, polluted);
+				return true;
+			}
+
+			assert(inclusion != Exclusive || !data); // Only reads come from above
+			mshr = mshrs.allocate(block_address);
+			mshrs.addTarget(mshr, request_id, getBlockOffset(address), size, data);
+			mshr->core = requestCore(request_id); // Asked now: the fill may come after the response above
+			takeCredit(); // One credit per MSHR
+			writebackBuffer.reserve(); // So the fill never waits for the buffer
+			lookupMiss(address, request_id);
+
+			// Send last: a cache below may respond before this call returns.
+			// The MSHR tag is the request id, so the response can find it.
+			if (!sendMemRequest(block_address, lineSize, nullptr, mshr->tag)) {
+				undoLookup(address, request_id);
+				writebackBuffer.unreserve();
+				undoCredit();
+				mshrs.deallocate(mshr);
+				return refuse();
+			}
+			misses++;
+			if (victimCache) {
+				victimCache->countMiss();
+			}
+			monitor(address, request_id, false);
+			if (polluted) {
+				prefetchPollution++;
+			}
+			demandAccessed(address, request_id, false, false, polluted);
 		}
 	}
 	// Memory request was accepted
@@ -143,99 +193,156 @@ void NonBlockingCache::receiveMemResponse(int request_id, const uint8_t* data)
 {
 	assert(data);
 
-	int MSHRTableIndex = 0;
-	for (int MSHRIndex = 0; MSHRIndex < numberOfMSHR; MSHRIndex++) { // For every MSHR in the MSHR Table
-		if (request_id == mshrTable.savedId[MSHRIndex]) { // If the requested ID is the same as the ID saved in the MSHR Index
-			MSHRTableIndex = MSHRIndex; // Set the examined index to the one that matches ID
+	MSHRFile::Entry* mshr = mshrs.findByTag(request_id);
+	assert(mshr);
+	uint64_t line_address = mshr->lineAddress;
+	bool prefetch = mshr->type == MSHRFile::Prefetch;
+
+	writebackBuffer.release();
+	arrivals.erase(request_id);
+	for (auto& target : mshr->targets) {
+		if (target.answered) {
+			earlyRestartTicks += curTick();
 		}
 	}
-
-	int index = mshrTable.savedSetLineIndex[MSHRTableIndex]; // Index = to setLine from receiveMemRequest
-
-	// Copy the data into the cache.
-	uint8_t* line = dataArray.getLine(index);
-	memcpy(line, data, memory.getLineSize());
-
-	//assert(tagArray.getState(index) == Invalid);
-
-	// Mark valid
-	tagArray.setState(index, Valid);
-
-	// Set tag
-	tagArray.setTag(index, getTag(mshrTable.savedAddr[MSHRTableIndex]));
-
-	// Treat as a hit
-	int block_offset = getBlockOffset(mshrTable.savedAddr[MSHRTableIndex]);
-
-	if (mshrTable.savedData[MSHRTableIndex]) {
-		// if this is a write, copy the data into the cache.
-		memcpy(&line[block_offset], (void**)mshrTable.savedData[MSHRTableIndex], mshrTable.savedSize[MSHRTableIndex]);
-		sendResponse(mshrTable.savedId[MSHRTableIndex], nullptr);
-		// Mark dirty
-		tagArray.setState(index, Dirty);
+	if (prefetch) {
+		// Nobody has asked for it yet, so it stays here even if exclusive
+		assert(mshr->targets.empty());
+		fillLine(line_address, data, false, true);
+	}
+	else if (inclusion == Exclusive) {
+		// Pass the line up without keeping it
+		for (auto& target : mshr->targets) {
+			assert(!target.write);
+			if (!target.answered) {
+				respond(line_address, target.size, target.requestId, &data[target.offset]);
+			}
+		}
 	}
 	else {
-		// This is a read so we need to return data
-		sendResponse(mshrTable.savedId[MSHRTableIndex], &line[block_offset]);
+		// Pick the line to fill now that the data is here. Choosing at fill time
+		// means two outstanding misses to the same set never fight over a line.
+		int index = fillLine(line_address, data, false, false, mshr->core);
+
+		// Treat every waiting request as a hit, in the order they arrived
+		for (auto& target : mshr->targets) {
+			accessLine(index, target.offset, target.size,
+			           target.write ? target.data.data() : nullptr,
+			           target.answered ? -1 : target.requestId);
+		}
 	}
 
 	// Default Conditions
-	blocked = false; // Can write/read from cache again
-	mshrTable.savedId[MSHRTableIndex] = -1;
-	mshrTable.savedAddr[MSHRTableIndex] = 0;
-	mshrTable.savedSize[MSHRTableIndex] = 0;
-	mshrTable.savedData[MSHRTableIndex] = nullptr;
-	mshrTable.savedSetLineIndex[MSHRTableIndex] = -1;
+	mshrs.deallocate(mshr);
+	returnCredit(); // Can write/read from cache again
+
+	// Memory may be idle now, so the writeback buffer can drain.
+	writebackBuffer.kick();
 
+	if (prefetcher) {
+		prefetcher->fill(line_address, prefetch);
+	}
+	// An MSHR is free, so a waiting prefetch may be able to go.
+	schedulePrefetches();
 }
 
-// HIT
-int NonBlockingCache::hit(uint64_t address)
+void NonBlockingCache::receiveBeat(int request_id, int offset, int size, const uint8_t* data)
 {
-	uint64_t incomingTag = getTag(address);
-	int index = getIndex(address); // Grab set # from address
-	int LineIndex = (index * numberOfWays); // Find line index for Tag Array
-	
-	for (int SetIndex = 0; SetIndex < numberOfWays; SetIndex++) { // For every line in the Set
-		State state = (State)tagArray.getState(LineIndex + SetIndex); // Grab state of line in Set
-		uint64_t line_tag = tagArray.getTag(LineIndex + SetIndex); // Grab Tag of line in Set
-		if (((state == Valid) || (state == Dirty)) && (line_tag == incomingTag)) {  // If state is Valid and Tags match, it's a hit
-			return (LineIndex + SetIndex); // The incoming address has the same tag as a line in the set then it's a hit; return the line in Set
-		}
-	}
-	return -1; // Return -1 if Miss
+	MSHRFile::Entry* mshr = mshrs.findByTag(request_id);
+	assert(mshr);
+	arrivals[request_id].add(lineSize, offset, size, data);
+	restartTargets(mshr);
 }
 
-// Check for Dirty
-int NonBlockingCache::dirty(uint64_t address)
+int NonBlockingCache::getCriticalOffset(int request_id)
 {
-	int index = getIndex(address);
-	int LineIndex = (index * numberOfWays); // Find index of set in Tag Array
+	MSHRFile::Entry* mshr = mshrs.findByTag(request_id);
+	assert(mshr);
+	if (mshr->targets.empty()) return 0; // A prefetch
+	MSHRFile::Target& target = mshr->targets.front();
+	if (target.requestId < 0) return target.offset;
+	return target.offset + requestor->getCriticalOffset(target.requestId);
+}
 
-	for (int SetIndex = 0; SetIndex < numberOfWays; SetIndex++) {  // For every line in the Set
-		State state = (State)tagArray.getState(LineIndex + SetIndex); // Grab state of line in Set
-		if (state != Dirty) { // If the line is not dirty
-			return (LineIndex + SetIndex); // Return the clean Line
-		}
-	}
-	return -1; // Every Line in Set is Dirty
+int NonBlockingCache::getCore(int request_id)
+{
+	if (request_id < 0) return -1; // Our own writebacks
+	MSHRFile::Entry* mshr = mshrs.findByTag(request_id);
+	assert(mshr);
+	return mshr->core;
 }
 
-int NonBlockingCache::findEmptyMSHR()
+void NonBlockingCache::restartTargets(MSHRFile::Entry* mshr)
 {
-	for (int MSHRSlot = 0; MSHRSlot < numberOfMSHR - 1; MSHRSlot++) { // Check every slot of MSHR Table
-		if ((mshrTable.savedId[MSHRSlot] == -1) // If Slot in MSHR Table is set at default conditions (aka empty)
-			&& (mshrTable.savedAddr[MSHRSlot] == 0)
-			&& (mshrTable.savedSize[MSHRSlot] == 0)
-			&& (mshrTable.savedData[MSHRSlot] == nullptr)
-			&& (mshrTable.savedSetLineIndex[MSHRSlot] == -1))
-		{
-			return MSHRSlot; // Return the empty slot
-		}
+	auto it = arrivals.find(mshr->tag);
+	if (it == arrivals.end()) return;
+
+	for (auto& target : mshr->targets) {
+		if (target.write) break; // The loads after it have to see it
+		if (target.answered || !it->second.has(target.offset, target.size)) continue;
+		target.answered = true;
+		restartEarly(target.requestId, target.size, &it->second.data[target.offset]);
 	}
-	return numberOfMSHR - 1; // Return the last slot of MSHR Table so that cache is blocked if MSHR Table is full.
 }
 
+void NonBlockingCache::demandAccessed(uint64_t address, int request_id, bool hit, bool prefetched, bool polluted)
+{
+	// Writebacks from the cache above are not demand accesses.
+	if (!prefetcher || request_id < 0) return;
 
+	prefetcher->access(address, hit, prefetched, polluted);
+	schedulePrefetches();
+}
 
+void NonBlockingCache::schedulePrefetches()
+{
+	if (!prefetcher || prefetchScheduled || !prefetcher->hasPrefetch()) return;
+	prefetchScheduled = true;
+	// Wait until the end of this tick so the demand request is handled
+	// (and responded to) before any prefetch goes out.
+	schedule(0, [this]{ issuePrefetches(); });
+}
 
+void NonBlockingCache::issuePrefetches()
+{
+	prefetchScheduled = false;
+
+	while (prefetcher->hasPrefetch()) {
+		// Demand misses come first. Prefetches that cannot go now are stale
+		// by the time they could, so drop them.
+		if (mshrs.getNumFree() <= prefetchReserve || memSide.getCredits() == 0 || !writebackBuffer.hasSpace()) {
+			DPRINT("No room to prefetch, dropping prefetches");
+			prefetcher->dropPrefetches();
+			return;
+		}
+
+		uint64_t line_address = prefetcher->popPrefetch();
+		if (line_address >= ((uint64_t)1 << addrSize)) continue; // Off the end of memory
+		if (hit(line_address) >= 0 || mshrs.findByAddress(line_address)) continue; // Already here or on its way
+		if (writebackBuffer.hasPartial(line_address)) continue; // Stores to it have to drain first
+
+		// Memory may not have the newest copy of a line that was just evicted.
+		std::vector<uint8_t> evicted(lineSize);
+		bool evicted_dirty;
+		if (recoverLine(line_address, evicted.data(), evicted_dirty, false)) {
+			fillLine(line_address, evicted.data(), evicted_dirty, true);
+			prefetchesIssued++;
+			prefetcher->issued(line_address);
+			continue;
+		}
+
+		DPRINT("Prefetching 0x" << std::hex << line_address << std::dec);
+		MSHRFile::Entry* mshr = mshrs.allocate(line_address, MSHRFile::Prefetch);
+		takeCredit(); // Prefetches hold an MSHR like any other miss
+		writebackBuffer.reserve();
+		if (!sendMemRequest(line_address, lineSize, nullptr, mshr->tag)) {
+			writebackBuffer.unreserve();
+			undoCredit();
+			mshrs.deallocate(mshr);
+			prefetcher->dropPrefetches();
+			return;
+		}
+		prefetchesIssued++;
+		prefetcher->issued(line_address);
+	}
+}
@@ -2,6 +2,10 @@
 #ifndef CSIM_NON_BLOCKING_H
 #define CSIM_NON_BLOCKING_H
 
+#include <unordered_map>
+
+#include "mshr_file.hh"
+#include "prefetcher.hh"
 #include "set_assoc.hh"
 
 class NonBlockingCache: public SetAssociativeCache
@@ -9,13 +13,15 @@ class NonBlockingCache: public SetAssociativeCache
   public:
     /**
     * @param size is the *total* size of the cache in bytes
-    * @param the memory that is below this cache
-    * @param processor this cache is connected to
+    * @param line_size is the size of a line in bytes
+    * @param mem_side is the cache or memory below this cache
+    * @param addr_size is the number of bits in the address
     * @param the number of ways in this set associative cache. If the number
     *        of ways cannot be realized, this will cause an error
     * @param number of MSHRs (or max number of concurrent outstanding requests)
+    * @param the number of lines in the writeback buffer
     */
-    NonBlockingCache(int64_t size, Memory& memory, Processor& processor, int ways, int mshrs);
+    NonBlockingCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int mshrs, int wb_entries = 8);
 
     /**
      * Destructor
@@ -38,8 +44,8 @@ class NonBlockingCache: public SetAssociativeCache
     bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) override;
 
     /**
-     * Called when memory id finished processing a request.
-     * Data will always be the length of memory.getLineSize()
+     * Called when the memory side finished processing a request.
+     * Data will always be the length of getLineSize()
      *
      * @param request_id is the id assigned to this request in sendMemRequest
      * @param data is the data from memory (length of data is line length)
@@ -47,84 +53,80 @@ class NonBlockingCache: public SetAssociativeCache
      */
     void receiveMemResponse(int request_id, const uint8_t* data) override;
 
-  private:
-    /// Put any code you want here.
-    enum State 
-    {
-        Invalid = 0,
-        Valid = 1,
-        Invalid2 = 2,
-        Dirty = 3 // Dirty implies valid
-    };
-
     /**
-    * @return the index number for the given address
-    */
-    int64_t getIndex(uint64_t address);
+     * Loads waiting for the line are answered as soon as their bytes
+     * arrive, up to the first store (later loads must see it).
+     */
+    void receiveBeat(int request_id, int offset, int size, const uint8_t* data) override;
 
     /**
-    * @return the block offset for the given address
-    */
-    int getBlockOffset(uint64_t address);
+     * @return the offset of the MSHR's first load or store in the line
+     */
+    int getCriticalOffset(int request_id) override;
 
     /**
-    * @return the tag for the given address
-    */
-    uint64_t getTag(uint64_t address);
+     * @return the core the MSHR's line is for
+     */
+    int getCore(int request_id) override;
 
     /**
-    * @return matching line if there is a hit. -1 if miss
-    */
-    int hit(uint64_t address);
-
-    int evictedLineIndex();
-
-	int findEmptyMSHR();
+     * Attach a prefetcher. It sees every demand access, and its prefetches
+     * use MSHRs that demand misses do not need.
+     *
+     * @param reserve is the number of MSHRs kept free for demand misses
+     */
+    void setPrefetcher(Prefetcher* prefetcher, int reserve = 1);
 
+  private:
     /**
-    * @return clean line if there is a clean spot. -1 if all lines in set are dirty
-    */
-    int dirty(uint64_t address);
-
-    /// Number of Ways
-    int numberOfWays;
+     * Tell the prefetcher about a demand access and issue what it asks for.
+     *
+     * @param prefetched is true on the first use of a prefetched line
+     * @param polluted is true if a prefetch evicted the line
+     */
+    void demandAccessed(uint64_t address, int request_id, bool hit, bool prefetched,
+                        bool polluted = false);
 
-    /// Number of tag bits in the address
-    int64_t tagBits;
+    /**
+     * Answer the MSHR's loads whose bytes have arrived (see receiveBeat).
+     */
+    void restartTargets(MSHRFile::Entry* mshr);
 
-    /// Mask for getting the index bits
-    uint64_t indexMask;
+    /**
+     * Issue prefetches at the end of this tick, if there are any.
+     */
+    void schedulePrefetches();
 
-    /// The cache's tag array
-    TagArray tagArray;
+    /**
+     * Send the prefetcher's lines to memory while there are MSHRs to spare.
+     */
+    void issuePrefetches();
 
-    /// The cache's data array
-    SRAMArray dataArray;
+    /// The outstanding misses. The MSHR tag is the id sent to memory.
+    MSHRFile mshrs;
 
-    /// If true, the cache is currently blocked
-    bool blocked;
+    /// MSHR tag -> the part of its line that has arrived so far
+    std::unordered_map<int, Arrivals> arrivals;
 
-	int numberOfMSHR;
+    /// Optional prefetcher, nullptr if there is none
+    Prefetcher* prefetcher;
 
-    struct MSHRTable 
-    {
-		/// This is the current request_id that is blocking the cache.
-		int* savedId;
+    /// MSHRs that prefetches may not use
+    int prefetchReserve;
 
-		/// The address for the blocking request.
-		uint64_t* savedAddr;
+    /// True if there is an issuePrefetches event in the queue
+    bool prefetchScheduled;
 
-		/// This is the size of the original request. Needed for writes.
-		int* savedSize;
+    int64_t prefetchesIssued;
 
-		/// This is the data that will be written after a miss
-		uint8_t** savedData;
+    /// Prefetched lines that a demand access used, on time or late
+    int64_t prefetchesUseful;
 
-		/// Saves Set Line Index
-		int* savedSetLineIndex;
-    };
+    /// Demand misses that found the line's prefetch still in flight
+    int64_t prefetchesLate;
 
-    MSHRTable mshrTable;
+    /// Demand misses to lines that a prefetch evicted
+    int64_t prefetchPollution;
 };
 
 #endif // CSIM_NON_BLOCKING_H
@@ -0,0 +1,46 @@
+
+#include <cassert>
+#include <iostream>
+
+#include "page_table.hh"
+
+PageTable::PageTable(int addr_size, int64_t page_size) :
+    pageSize(page_size), base((uint64_t)1 << addr_size),
+    limit((uint64_t)1 << (addr_size + 1))
+{
+    assert(addr_size <= 48);
+    if (page_size == 4096) {
+        leafLevel = 3;
+    } else if (page_size == 2 << 20) {
+        leafLevel = 2;
+    } else {
+        assert(page_size == 1 << 30);
+        leafLevel = 1;
+    }
+}
+
+PageTable::~PageTable()
+{
+    std::cout << "Page table nodes: " << nodes.size() << " (";
+    std::cout << nodes.size() * 4 << "KB)" << std::endl;
+}
+
+uint64_t PageTable::getPrefix(int level, uint64_t address)
+{
+    assert(level >= 0 && level < Levels);
+    return address >> getShift(level);
+}
+
+uint64_t PageTable::getEntryAddress(int level, uint64_t address)
+{
+    assert(level <= leafLevel);
+    // The root's prefix is always 0
+    uint64_t prefix = level == 0 ? 0 : getPrefix(level - 1, address);
+    auto it = nodes.find({level, prefix});
+    if (it == nodes.end()) {
+        uint64_t node = base + nodes.size() * 4096;
+        assert(node < limit);
+        it = nodes.emplace(std::make_pair(level, prefix), node).first;
+    }
+    return it->second + ((address >> getShift(level)) & 511) * 8;
+}
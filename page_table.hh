@@ -0,0 +1,84 @@
+
+#ifndef CSIM_PAGE_TABLE_H
+#define CSIM_PAGE_TABLE_H
+
+#include <cstdint>
+#include <map>
+#include <utility>
+
+/**
+ * A four level radix page table like x86-64's: each level is a 4KB node of
+ * 512 8-byte entries, indexed by 9 bits of a 48-bit virtual address above
+ * the 12-bit offset. 2MB pages end the walk a level early and 1GB pages
+ * two levels early.
+ *
+ * Pages are identity mapped, so only the walk itself is simulated: the
+ * nodes get physical addresses of their own, above the virtual address
+ * space, so that the walker's reads go through the caches like any other
+ * line. Nodes are allocated the first time a walk needs them.
+ */
+class PageTable
+{
+  public:
+    static const int Levels = 4;
+
+    /**
+     * @param addr_size is the number of bits in a virtual address. The
+     *        nodes are placed from 2^addr_size up.
+     * @param page_size is 4KB, 2MB or 1GB
+     */
+    PageTable(int addr_size, int64_t page_size);
+
+    ~PageTable();
+
+    /**
+     * @return the level whose entries map pages (3 for 4KB pages)
+     */
+    int getLeafLevel() { return leafLevel; }
+
+    int64_t getPageSize() { return pageSize; }
+
+    /**
+     * @return the virtual page number of an address
+     */
+    uint64_t getPage(uint64_t address) { return address / pageSize; }
+
+    /**
+     * @return the bits of an address that pick the entries of the levels
+     *         up to and including this one (what a page-walk cache for the
+     *         level is indexed by)
+     */
+    uint64_t getPrefix(int level, uint64_t address);
+
+    /**
+     * @return the physical address of the entry a walk reads at a level,
+     *         allocating the node if it is new
+     */
+    uint64_t getEntryAddress(int level, uint64_t address);
+
+    /**
+     * @return true if a physical address belongs to the page table
+     */
+    bool contains(uint64_t address) { return address >= base; }
+
+  private:
+    /**
+     * @return the shift that leaves a level's index in the low 9 bits
+     */
+    int getShift(int level) { return 39 - 9 * level; }
+
+    int64_t pageSize;
+
+    int leafLevel;
+
+    /// Physical address of the first node
+    uint64_t base;
+
+    /// Largest physical address + 1
+    uint64_t limit;
+
+    /// (level, prefix of the levels above) -> the node's physical address
+    std::map<std::pair<int, uint64_t>, uint64_t> nodes;
+};
+
+#endif // CSIM_PAGE_TABLE_H
@@ -0,0 +1,86 @@
+
+#include <cassert>
+
+#include "port.hh"
+#include "util.hh"
+
+ResponsePort::ResponsePort(int credits) :
+    requestor(nullptr), credits(credits), maxCredits(credits),
+    retryPending(false)
+{
+    assert(credits > 0);
+}
+
+bool ResponsePort::checkCredit()
+{
+    if (credits > 0) {
+        return true;
+    }
+    retryPending = true;
+    return false;
+}
+
+void ResponsePort::sendResponse(int request_id, const uint8_t* data)
+{
+    // Negative ids (e.g., writebacks) do not want a response.
+    if (request_id < 0) return;
+    assert(requestor);
+    requestor->receiveResponse(request_id, data);
+}
+
+void ResponsePort::sendBeat(int request_id, int offset, int size,
+                            const uint8_t* data)
+{
+    if (request_id < 0) return;
+    assert(requestor);
+    requestor->receiveBeat(request_id, offset, size, data);
+}
+
+int ResponsePort::sendInvalidate(uint64_t address, int size, uint8_t* data,
+                                 bool& dirty)
+{
+    assert(requestor);
+    return requestor->receiveInvalidate(address, size, data, dirty);
+}
+
+bool ResponsePort::receiveEviction(uint64_t address, int size,
+                                   const uint8_t* data, bool dirty)
+{
+    if (!dirty) return true;
+    // No response for writes, no need for valid request_id
+    return receiveRequest(address, size, data, -1);
+}
+
+void ResponsePort::takeCredit()
+{
+    assert(credits > 0);
+    credits--;
+}
+
+void ResponsePort::returnCredit()
+{
+    assert(credits < maxCredits);
+    credits++;
+    sendRetry();
+}
+
+void ResponsePort::undoCredit()
+{
+    assert(credits < maxCredits);
+    credits++;
+}
+
+bool ResponsePort::refuse()
+{
+    retryPending = true;
+    return false;
+}
+
+void ResponsePort::sendRetry()
+{
+    if (retryPending && credits > 0) {
+        assert(requestor);
+        retryPending = false;
+        requestor->receiveRetry();
+    }
+}
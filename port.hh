@@ -0,0 +1,224 @@
+
+#ifndef CSIM_PORT_H
+#define CSIM_PORT_H
+
+#include <cstdint>
+
+/**
+ * The side of a connection that sends requests and gets responses back
+ * (e.g., the processor, or a cache talking to memory).
+ */
+class RequestPort
+{
+  public:
+    virtual ~RequestPort() { }
+
+    /**
+     * Called when the object below finishes a request.
+     *
+     * @param request_id is the id used when sending the request
+     * @param data is the data for the request (nullptr if write)
+     *        NOTE: This pointer will be invalid when this function returns.
+     */
+    virtual void receiveResponse(int request_id, const uint8_t* data) = 0;
+
+    /**
+     * Called by the object below when it has freed resources after it
+     * refused a request from this port. The request should be sent again.
+     */
+    virtual void receiveRetry() = 0;
+
+    /**
+     * Called by the object below when it drops lines that must not stay
+     * above it (e.g., an inclusive cache evicting a line). Every copy of
+     * [address, address + size) is removed.
+     *
+     * @param data holds the lower level's copy of the range. Dirty data
+     *        from above is copied over it.
+     * @param dirty is set to true if any dirty data was copied
+     * @return the number of lines removed
+     */
+    virtual int receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                                  bool& dirty)
+    {
+        return 0;
+    }
+
+    /**
+     * Called by the object below as a read's data arrives, one beat at a
+     * time, before receiveResponse (which still comes with the whole
+     * request once it is all here). By default beats are ignored.
+     *
+     * @param offset is the beat's position in the data that was requested
+     * @param data is the beat (size bytes)
+     *        NOTE: This pointer will be invalid when this function returns.
+     */
+    virtual void receiveBeat(int request_id, int offset, int size,
+                             const uint8_t* data)
+    {
+    }
+
+    /**
+     * Called by the object below to find out which part of a read to send
+     * first (critical word first).
+     *
+     * @return the offset in the requested data of the bytes this port is
+     *         waiting for
+     */
+    virtual int getCriticalOffset(int request_id) { return 0; }
+
+    /**
+     * Called by the object below to find out which core a request is for
+     * (e.g., to share a cache's ways among cores). A negative id asks about
+     * the writeback being sent.
+     *
+     * @return the core, -1 if it is not known
+     */
+    virtual int getCore(int request_id) { return -1; }
+};
+
+/**
+ * The side of a connection that receives requests and sends responses
+ * (e.g., a cache or memory).
+ *
+ * Flow control is credit based. Each credit is one request that the
+ * object can take on right now (e.g., one free MSHR). Requestors should
+ * call checkCredit() before sending. If there is no credit, or a request is
+ * refused, the requestor gets receiveRetry() as soon as a credit is
+ * returned.
+ */
+class ResponsePort
+{
+  public:
+    /**
+     * @param credits is the number of requests that can be outstanding
+     */
+    ResponsePort(int credits);
+
+    virtual ~ResponsePort() { }
+
+    /**
+     * Called when the object above sends a load or store request.
+     *
+     * @param address of the request
+     * @param size in bytes of the request.
+     * @param data is non-null, then this is a store request.
+     *        NOTE: data is invalid when this function returns. Data must be
+     *              copied.
+     * @param request_id the id that must be used when replying to this
+     *        request. A negative id means no response is wanted.
+     *
+     * @return true if the request can be received, false if the object is
+     *         blocked and the request must be retried later.
+     */
+    virtual bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) = 0;
+
+    /**
+     * Called when the object above evicts a line. By default dirty lines
+     * are written like any other store and clean lines are dropped.
+     *
+     * @param dirty is true if the data is newer than the data below
+     * @return false if the eviction must be retried later
+     */
+    virtual bool receiveEviction(uint64_t address, int size, const uint8_t* data, bool dirty);
+
+    /**
+     * @return true if clean lines evicted above should be sent here too
+     *         (e.g., an exclusive cache)
+     */
+    virtual bool wantsCleanEvictions() { return false; }
+
+    /**
+     * @return true if a request can be sent now. If not, the requestor will
+     *         receive a retry once a credit is returned.
+     */
+    bool checkCredit();
+
+    /**
+     * @return the number of credits currently available
+     */
+    int getCredits() { return credits; }
+
+    /**
+     * @return the number of credits when nothing is outstanding
+     */
+    int getMaxCredits() { return maxCredits; }
+
+    /**
+     * @return true if no credits are in use (nothing is outstanding)
+     */
+    bool isIdle() { return credits == maxCredits; }
+
+    /**
+     * Connect the object that sends requests to this port.
+     */
+    void setRequestor(RequestPort *requestor) { this->requestor = requestor; }
+
+  protected:
+    /**
+     * Send a response to the requestor.
+     *
+     * @param request_id is the id that the requestor used when it called
+     *        receiveRequest
+     * @param data is the data for the request. This data will only be read.
+     */
+    void sendResponse(int request_id, const uint8_t* data);
+
+    /**
+     * Send part of a read's data ahead of its response.
+     * See RequestPort::receiveBeat.
+     */
+    void sendBeat(int request_id, int offset, int size, const uint8_t* data);
+
+    /**
+     * Remove every copy of a range from the objects above.
+     * See RequestPort::receiveInvalidate.
+     *
+     * @return the number of lines removed
+     */
+    int sendInvalidate(uint64_t address, int size, uint8_t* data, bool& dirty);
+
+    /**
+     * Use up one credit for a request that was accepted.
+     */
+    void takeCredit();
+
+    /**
+     * Give back a credit. If the requestor was refused, it is told to retry.
+     */
+    void returnCredit();
+
+    /**
+     * Give back a credit taken for a request that was then refused further
+     * down. The requestor is not told to retry: that would only be refused
+     * again. The retry comes when the level below retries this one.
+     */
+    void undoCredit();
+
+    /**
+     * Refuse the current request. The requestor will get a retry later.
+     *
+     * @return false, so this can be returned from receiveRequest
+     */
+    bool refuse();
+
+    /**
+     * Tell the requestor to retry if it was refused earlier.
+     */
+    void sendRetry();
+
+    /// The object sending requests to this port
+    RequestPort *requestor;
+
+  private:
+    /// Number of requests that can still be taken on
+    int credits;
+
+    /// Number of credits when nothing is outstanding
+    int maxCredits;
+
+    /// True if the requestor was refused and is waiting for a retry
+    bool retryPending;
+};
+
+#endif // CSIM_PORT_H
@@ -0,0 +1,148 @@
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "prefetcher.hh"
+#include "util.hh"
+
+Prefetcher::Prefetcher(int line_size, int degree, int queue_size) :
+    lineSize(line_size), lineBits(log2int(line_size)), degree(degree),
+    queueSize(queue_size), throttle(false), minDegree(degree),
+    maxDegree(degree), window(0), windowMisses(0), windowIssued(0),
+    windowUseful(0), windowLate(0), windowPolluted(0), windowOccupancy(0),
+    windowSamples(0), memory(nullptr), candidates(0), dropped(0),
+    throttleUps(0), throttleDowns(0), busyWindows(0)
+{
+    assert(degree > 0);
+    assert(queue_size > 0);
+}
+
+void Prefetcher::access(uint64_t address, bool hit, bool prefetched,
+                        bool polluted)
+{
+    if (throttle) {
+        if (prefetched) {
+            windowUseful++;
+            if (!hit) {
+                windowLate++; // Merged with the prefetch on its way
+            }
+        }
+        if (polluted) {
+            windowPolluted++;
+        }
+        if (memory) {
+            windowOccupancy += 1.0 - (double)memory->getCredits() /
+                                     memory->getMaxCredits();
+            windowSamples++;
+        }
+        if (!hit && ++windowMisses == window) {
+            endWindow();
+        }
+    }
+    notifyAccess(address, hit, prefetched);
+}
+
+void Prefetcher::issued(uint64_t line_address)
+{
+    windowIssued++;
+}
+
+void Prefetcher::endWindow()
+{
+    // Prefetches used in this window may have been issued in the last one,
+    // which is close enough.
+    bool high = windowUseful * 4 > windowIssued * 3;
+    bool low = windowUseful * 5 < windowIssued * 2;
+    bool late = windowLate * 100 > windowUseful;
+    bool polluting = windowPolluted * 200 > windowMisses;
+    bool busy = windowSamples > 0 && windowOccupancy * 4 > windowSamples * 3;
+
+    int change = 0;
+    if (windowIssued == 0) {
+        change = 0; // Nothing to judge
+    } else if (high) {
+        change = late || polluting ? 1 : 0;
+    } else if (low) {
+        change = late || polluting ? -1 : 0;
+    } else if (polluting) {
+        change = -1;
+    } else if (late) {
+        change = 1;
+    }
+    if (busy) {
+        busyWindows++;
+        change = high ? std::min(change, 0) : -1;
+    }
+
+    if (change > 0 && degree < maxDegree) {
+        degree++;
+        throttleUps++;
+        DPRINT("Prefetcher degree up to " << degree);
+    }
+    else if (change < 0 && degree > minDegree) {
+        degree--;
+        throttleDowns++;
+        DPRINT("Prefetcher degree down to " << degree);
+    }
+
+    windowMisses = 0;
+    windowIssued = 0;
+    windowUseful = 0;
+    windowLate = 0;
+    windowPolluted = 0;
+    windowOccupancy = 0;
+    windowSamples = 0;
+}
+
+uint64_t Prefetcher::popPrefetch()
+{
+    assert(!queue.empty());
+    uint64_t line_address = queue.front();
+    queue.pop_front();
+    return line_address;
+}
+
+void Prefetcher::dropPrefetches()
+{
+    dropped += queue.size();
+    queue.clear();
+}
+
+void Prefetcher::setThrottle(int min_degree, int max_degree, int window)
+{
+    assert(min_degree > 0 && min_degree <= max_degree);
+    assert(window > 0);
+    throttle = true;
+    minDegree = min_degree;
+    maxDegree = max_degree;
+    this->window = window;
+    degree = std::max(min_degree, std::min(degree, max_degree));
+    queueSize = std::max(queueSize, max_degree);
+}
+
+void Prefetcher::queuePrefetch(uint64_t line_address)
+{
+    if (std::find(queue.begin(), queue.end(), line_address) != queue.end()) {
+        return;
+    }
+    if ((int)queue.size() == queueSize) {
+        // Newer requests are more likely to still be useful.
+        queue.pop_front();
+        dropped++;
+    }
+    queue.push_back(line_address);
+    candidates++;
+}
+
+void Prefetcher::printStats(const std::string& name)
+{
+    std::cout << name << " prefetch candidates: " << candidates << std::endl;
+    std::cout << name << " prefetches dropped:  " << dropped << std::endl;
+    if (throttle) {
+        std::cout << name << " prefetch degree:     " << degree << std::endl;
+        std::cout << name << " throttle ups:        " << throttleUps << std::endl;
+        std::cout << name << " throttle downs:      " << throttleDowns << std::endl;
+        std::cout << name << " throttle busy:       " << busyWindows << std::endl;
+    }
+}
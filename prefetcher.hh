@@ -0,0 +1,188 @@
+
+#ifndef CSIM_PREFETCHER_H
+#define CSIM_PREFETCHER_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include "port.hh"
+
+/**
+ * Watches the demand accesses to a cache and picks lines to bring in
+ * before they are asked for.
+ *
+ * The cache calls access() for every demand access, issued() for every
+ * prefetch it sends and fill() for every line it fills. A prefetcher puts
+ * the lines it wants on a small queue, and the cache takes them off when it
+ * has a free MSHR. If the queue is full the oldest line is dropped, and the
+ * cache drops the whole queue when it is short on MSHRs.
+ *
+ * Every prefetcher has a degree: how many lines it asks for each time it
+ * is triggered. With the throttle on, the degree is adjusted after every
+ * window of demand misses, feedback directed prefetching style (after
+ * Srinath et al., FDP), from:
+ *  - accuracy: prefetches used / prefetches issued
+ *  - lateness: used prefetches that were still in flight / used prefetches
+ *  - pollution: demand misses to lines a prefetch evicted / demand misses
+ *  - memory occupancy: the average fraction of memory's read queue in use
+ */
+class Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of lines to prefetch each time
+     * @param queue_size is the number of lines that can wait to be issued
+     */
+    Prefetcher(int line_size, int degree, int queue_size = 16);
+
+    virtual ~Prefetcher() { }
+
+    /**
+     * Called for every demand access (not for prefetches or writebacks from
+     * the cache above).
+     *
+     * @param address of the access
+     * @param hit is true if the line was in the cache
+     * @param prefetched is true if this is the first demand access to a line
+     *        that was prefetched (it may still be on its way)
+     * @param polluted is true if this misses on a line that a prefetch
+     *        evicted
+     */
+    void access(uint64_t address, bool hit, bool prefetched,
+                bool polluted = false);
+
+    /**
+     * Called when the cache sends a prefetch.
+     */
+    void issued(uint64_t line_address);
+
+    /**
+     * Called when the cache fills a line.
+     *
+     * @param prefetch is true if the line was prefetched and nobody has
+     *        asked for it yet
+     */
+    void fill(uint64_t line_address, bool prefetch) { notifyFill(line_address, prefetch); }
+
+    /**
+     * @return true if there is a line waiting to be prefetched
+     */
+    bool hasPrefetch() { return !queue.empty(); }
+
+    /**
+     * Take the oldest line off the queue. hasPrefetch() must be true.
+     *
+     * @return the line address to prefetch
+     */
+    uint64_t popPrefetch();
+
+    /**
+     * Throw away every line on the queue (e.g., the cache has no MSHRs to
+     * spare).
+     */
+    void dropPrefetches();
+
+    /**
+     * Turn on the throttle. After every window of demand misses the degree
+     * goes up or down by one:
+     *
+     *   accuracy  late  polluting  degree
+     *   high      -     -          up if late or polluting
+     *   medium    yes   no         up
+     *   medium    -     yes        down
+     *   low       -     -          down if late or polluting
+     *
+     * Accuracy is high above 75% and low below 40%. Lateness above 1% and
+     * pollution above 0.5% count. When memory is busy (its read queue more
+     * than 75% full on average) the degree never goes up, and goes down
+     * unless accuracy is high, so prefetches do not starve demand misses.
+     */
+    void setThrottle(int min_degree, int max_degree, int window = 256);
+
+    /**
+     * @param memory is the port whose read queue the throttle watches, or
+     *        nullptr to ignore bandwidth
+     */
+    void setMemory(ResponsePort* memory) { this->memory = memory; }
+
+    /**
+     * Print the statistics for this prefetcher.
+     *
+     * @param name is printed before each statistic
+     */
+    virtual void printStats(const std::string& name);
+
+  protected:
+    /**
+     * See access(). This is where subclasses train and queue prefetches.
+     */
+    virtual void notifyAccess(uint64_t address, bool hit, bool prefetched) = 0;
+
+    /**
+     * See fill().
+     */
+    virtual void notifyFill(uint64_t line_address, bool prefetch) { }
+
+    /**
+     * Ask for a line to be prefetched. Lines already on the queue are
+     * ignored.
+     */
+    void queuePrefetch(uint64_t line_address);
+
+    /// Line size of the cache in bytes
+    int lineSize;
+
+    /// log2(lineSize)
+    int lineBits;
+
+    /// Number of lines to prefetch each time. The throttle changes it.
+    int degree;
+
+  private:
+    /// Lines waiting to be issued, oldest first
+    std::deque<uint64_t> queue;
+
+    int queueSize;
+
+    /**
+     * Move the degree using the counts from the last window and start a
+     * new one.
+     */
+    void endWindow();
+
+    bool throttle;
+    int minDegree;
+    int maxDegree;
+
+    /// Demand misses per throttle decision
+    int window;
+
+    /// Counts for this window
+    int windowMisses;
+    int windowIssued;
+    int windowUseful;
+    int windowLate;
+    int windowPolluted;
+
+    /// Sum of memory's read queue occupancy, sampled on each demand access
+    double windowOccupancy;
+    int windowSamples;
+
+    ResponsePort* memory;
+
+    /// Lines put on the queue
+    int64_t candidates;
+
+    /// Lines that were dropped instead of issued
+    int64_t dropped;
+
+    int64_t throttleUps;
+    int64_t throttleDowns;
+
+    /// Windows where memory was too busy to allow more prefetching
+    int64_t busyWindows;
+};
+
+#endif // CSIM_PREFETCHER_H
@@ -7,13 +7,19 @@
 #include "ticked_object.hh"
 #include "util.hh"
 
-Processor::Processor(int addrSize) : addressSize(addrSize), cache(nullptr), memory(nullptr), records(nullptr), blocked(false), totalRequests(0)
+Processor::Processor(int addrSize) : addressSize(addrSize), cache(nullptr), memory(nullptr), records(nullptr), blocked(false), blockedTick(0), totalRequests(0), stallTicks(0), latencyTicks(0), responses(0), finishTick(0)
 {
 }
 
 Processor::~Processor()
 {
-    std::cout << "Total requests: " << totalRequests << std::endl;
+    std::string prefix = name.empty() ? "" : name + " ";
+    std::cout << prefix << "Total requests: " << totalRequests << std::endl;
+    std::cout << prefix << "Stall ticks:    " << stallTicks << std::endl;
+    std::cout << prefix << "Average latency: ";
+    std::cout << (responses ? (float)latencyTicks / responses : 0) << " ticks" << std::endl;
+    std::cout << prefix << "Throughput:     ";
+    std::cout << (finishTick ? 1000.0 * totalRequests / finishTick : 0) << " requests per 1000 ticks" << std::endl;
 }
 
 void Processor::scheduleForSimulation()
@@ -29,9 +35,29 @@ void Processor::scheduleForSimulation()
 void Processor::sendRequest(Record &r)
 {
     DPRINT("Sending request 0x" << std::hex << r.address << std::dec << ":" << r.size << " (" << r.requestId << ")");
+    if (!cache->checkCredit()) {
+        DPRINT("Cache has no credits. Wait for a retry.");
+        blocked = true;
+        blockedTick = curTick();
+        return;
+    }
+
     outstanding[r.requestId] = &r;
+    sentTicks[r.requestId] = curTick();
+    if (!r.write && memory) {
+        // The read sees every store the cache took before it, and no later
+        // one. Its response may come back before this call returns.
+        expected[r.requestId].resize(r.size);
+        memory->expectRead(r.address, r.size, expected[r.requestId].data());
+    }
     if (cache->receiveRequest(r.address, r.size, r.write ? r.dataVec.data() : nullptr, r.requestId)) {
         totalRequests++;
+        finishTick = curTick();
+        if (r.write && memory) {
+            // The store is ordered with the other requests once the cache
+            // takes it. It may reach memory before its response gets here.
+            memory->processorWrite(r.address, r.size, r.dataVec.data());
+        }
         trace.pop();
 
         if (trace.empty()) return;
@@ -41,12 +67,15 @@ void Processor::sendRequest(Record &r)
         schedule(r.ticksFromNow, [this, &next]{sendRequest(next);});
     } 
 	else {
-        DPRINT("Cache is blocked. Wait for later.");
-        // Cache is blocked wait for later.
+        DPRINT("Cache is blocked. Wait for a retry.");
+        // Cache is blocked wait for it to tell us to retry.
         blocked = true;
+        blockedTick = curTick();
         // Remove the last thing we added to the outstanding list, it's not
         // outstanding.
         outstanding.erase(r.requestId);
+        sentTicks.erase(r.requestId);
+        expected.erase(r.requestId);
     }
 }
 
@@ -59,14 +88,28 @@ void Processor::receiveResponse(int request_id, const uint8_t* data)
     assert(it != outstanding.end());
     checkData(*it->second, data);
     outstanding.erase(it);
+    latencyTicks += curTick() - sentTicks[request_id];
+    responses++;
+    sentTicks.erase(request_id);
+    finishTick = curTick();
+}
 
-    if (blocked) {
-        // unblock now.
-        DPRINT("Unblocking processor at " << curTick());
-        blocked = false;
-        Record &r = *trace.front();
-        schedule(r.ticksFromNow, [this, &r]{sendRequest(r);});
-    }
+void Processor::receiveRetry()
+{
+    if (!blocked) return;
+
+    // The cache has room now, so send the refused request right away.
+    DPRINT("Unblocking processor at " << curTick());
+    blocked = false;
+    stallTicks += curTick() - blockedTick;
+    Record &r = *trace.front();
+    schedule(0, [this, &r]{sendRequest(r);});
+}
+
+void Processor::setCache(ResponsePort *cache)
+{
+    this->cache = cache;
+    cache->setRequestor(this);
 }
 
 int Processor::getAddrSize()
@@ -77,11 +120,10 @@ int Processor::getAddrSize()
 void Processor::checkData(Record &record, const uint8_t* cache_data)
 {
     assert(memory);
-    if (record.write) {
-        memory->processorWrite(record.address, record.size, record.dataVec.data());
-    } 
-	else {
-        memory->checkRead(record.address, record.size, cache_data);
+    if (!record.write) {
+        memory->checkRead(record.address, record.size,
+                          expected[record.requestId].data(), cache_data);
+        expected.erase(record.requestId);
     }
 }
 
@@ -7,17 +7,20 @@
 #include <queue>
 #include <utility>
 #include <string>
+#include <vector>
 
-#include "cache.hh"
+#include "port.hh"
 #include "ticked_object.hh"
 #include "record_store.hh"
 
-class Processor: public TickedObject
+class Memory;
+
+class Processor: public TickedObject, public RequestPort
 {
   protected:
     int addressSize;
 
-    Cache *cache;
+    ResponsePort *cache;
     Memory *memory;
 
     RecordStore *records;
@@ -26,13 +29,34 @@ class Processor: public TickedObject
 
     std::map<int, Record*> outstanding;
 
+    /// The tick each outstanding request was sent
+    std::map<int, int64_t> sentTicks;
+
+    /// What each outstanding read must return, as of when it was sent
+    std::map<int, std::vector<uint8_t>> expected;
+
     void sendRequest(Record &r);
 
     bool blocked;
 
+    /// The tick when the processor last became blocked
+    int64_t blockedTick;
+
     virtual void createRecords();
 
     int64_t totalRequests;
+    /// Printed before the statistics, empty for a single processor
+    std::string name;
+
+    /// Number of ticks spent waiting for the cache to have room
+    int64_t stallTicks;
+
+    /// Ticks from sending requests to their responses, and the responses
+    int64_t latencyTicks;
+    int64_t responses;
+
+    /// The tick the last request was sent or answered, for the throughput
+    int64_t finishTick;
 
     void checkData(Record &record, const uint8_t* cache_data);
 
@@ -51,12 +75,17 @@ class Processor: public TickedObject
      * @param the original request id
      * @param the data returned if it was a read (nullptr if write)
      */
-    void receiveResponse(int request_id, const uint8_t* data);
+    void receiveResponse(int request_id, const uint8_t* data) override;
+
+    /**
+     * Called by the cache when it has room for the request it refused.
+     */
+    void receiveRetry() override;
 
     /**
-     * Connect the cache
+     * Connect the cache (or whatever is below the processor)
      */
-    void setCache(Cache *cache) { this->cache = cache; }
+    void setCache(ResponsePort *cache);
 
     /**
      * Connect memory for debugging and checking purposes
@@ -68,10 +97,20 @@ class Processor: public TickedObject
      */
     void setRecords(RecordStore *recordStore) { this->records = recordStore; }
 
+    /**
+     * Set the name printed before the statistics (e.g., "P0")
+     */
+    void setName(const std::string& name) { this->name = name; }
+
     /**
      * @return the number of bits in the address
      */
     int getAddrSize();
+
+    /**
+     * @return the number of requests the cache has accepted
+     */
+    int64_t getTotalRequests() { return totalRequests; }
 };
 
 #endif // CSIM_PROCESSOR_H
@@ -1,171 +1,448 @@
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <iostream>
+#include <vector>
 
-#include "memory.hh"
-#include "processor.hh"
 #include "util.hh"
 #include "set_assoc.hh"
 
 int numberOfWays;
 
+/// Lines the shadow tags remember
+static const size_t prefetchVictimEntries = 64;
+
 // CACHE SETUP
-SetAssociativeCache::SetAssociativeCache(int64_t size, Memory& memory, Processor& processor, int ways) : 
-	Cache(size, memory, processor),
-	tagBits(processor.getAddrSize() - log2int((size / memory.getLineSize())/ways) - memory.getLineBits()), // Tag bits = Processor Size - # of Sets - Offset
+SetAssociativeCache::SetAssociativeCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int wb_entries, int sectors) :
+	SetAssociativeCache(size, line_size, mem_side, addr_size, ways, 1, wb_entries, sectors)
+{
+}
+
+SetAssociativeCache::SetAssociativeCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int credits, int wb_entries, int sectors) :
+	Cache(size, line_size, mem_side, addr_size, credits),
+	metadataWays(0),
+	sectors(sectors),
+	sectorSize(line_size / sectors),
+	tagBits(addrSize - log2int((size / lineSize)/ways) - lineBits), // Tag bits = Address Size - # of Sets - Offset
 	// # of Sets = # of Lines / ways
 	// # of Lines = Cache Size / Line Size
-	indexMask( ( ( size / memory.getLineSize() ) / ways ) - 1 ), // Index mask = 1 for each digit of Set # i.e. 32 sets = 11111
-	tagArray( ( size / memory.getLineSize() ), 2, tagBits ), // Tag Array is # of Lines, Valid Bit, Dirty Bit, Tag bits
-	dataArray(  ( size / memory.getLineSize() ), memory.getLineSize() ), // Data Array is # of Lines, Line Size
-	blocked(false),
-	mshr({ -1,0,0,nullptr,-1 })
+	indexMask( ( ( size / lineSize ) / ways ) - 1 ), // Index mask = 1 for each digit of Set # i.e. 32 sets = 11111
+	indexFunction(indexMask + 1),
+	tagArray( ( size / lineSize ), 2, tagBits, sectors ), // Tag Array is # of Lines, Valid Bit, Dirty Bit, Tag bits (per sector if sectored)
+	dataArray(  ( size / lineSize ), lineSize ), // Data Array is # of Lines, Line Size
+	writebackBuffer(wb_entries, sectorSize, memSide), // Sectors are written back on their own
+	victimCache(nullptr),
+	prefetchedLines(size / lineSize, false),
+	prefetchesUseless(0),
+	wayPrediction(NoWayPrediction), partitioner(nullptr),
+	wayPredictions(0), wayPredictionsCorrect(0),
+	writePolicy(WriteBack), writeMissPolicy(WriteAllocate),
+	writesThrough(0), writesAround(0), writeValidates(0), validateMisses(0),
+	sectorMisses(0), evictedLines(0), evictedSectors(0),
+	mshr({ -1,0,0,{},-1,0,{},false })
 {
 	assert(ways > 0);
+	assert(sectors > 0 && lineSize % sectors == 0);
 	numberOfWays = ways;
+	// When the buffer frees up, let the processor retry anything refused.
+	writebackBuffer.setSpaceCallback([this]{ sendRetry(); });
 }
 
 // ADDRESS BREAKDOWN
-int64_t SetAssociativeCache::getIndex(uint64_t address) // Returns Set # off Address
+int64_t SetAssociativeCache::getIndex(uint64_t address, int way) // Returns Set # off Address
 {
-	return (address >> memory.getLineBits()) & indexMask; // Shift off Offset and mask by how many bits make Set #
+	return indexFunction.getIndex(address >> lineBits, way); // Shift off Offset and hash (by default mask) by how many bits make Set #
 }
 
 int SetAssociativeCache::getBlockOffset(uint64_t address) // Returns Offset off Address
 {
-	return address & (memory.getLineSize() - 1); // Mask by how many bits make Offset
+	return address & (lineSize - 1); // Mask by how many bits make Offset
 }
 
 uint64_t SetAssociativeCache::getTag(uint64_t address) // Returns Tag off Address
 {
-	return address >> (processor.getAddrSize() - tagBits); // Shifts off any bits that aren't tag bits
+	return indexFunction.getTag(address >> lineBits); // By default shifts off any bits that aren't tag bits
 }
 
 SetAssociativeCache::~SetAssociativeCache()
 {
+	if (indexFunction.getKind() != IndexFunction::Modulo) {
+		std::cout << name << " index: " << indexFunction.getName() << " (";
+		std::cout << indexFunction.getUsedSets() << " sets)" << std::endl;
+	}
+	if (wayPrediction != NoWayPrediction) {
+		int64_t wrong = wayPredictions - wayPredictionsCorrect;
+		std::cout << name << " way prediction: " << (wayPrediction == MRUWayPrediction ? "MRU" : "hash") << ", ";
+		std::cout << (wayPredictions ? 100.0 * wayPredictionsCorrect / wayPredictions : 0) << "% correct" << std::endl;
+		std::cout << name << " second probes:  " << wrong << " (" << wrong << " extra ticks";
+		std::cout << (tagLatency + dataLatency > 0 ? "" : ", not charged without a latency") << ")" << std::endl;
+	}
+	if (writePolicy != WriteBack || writeMissPolicy != WriteAllocate) {
+		const char* miss_policies[] = {"write-allocate", "no-write-allocate", "write-validate"};
+		std::cout << name << " write policy:    " << (writePolicy == WriteThrough ? "write-through" : "write-back");
+		std::cout << ", " << miss_policies[writeMissPolicy] << std::endl;
+		std::cout << name << " writes through:  " << writesThrough << std::endl;
+		std::cout << name << " writes around:   " << writesAround << std::endl;
+		std::cout << name << " write validates: " << writeValidates << std::endl;
+		std::cout << name << " validate misses: " << validateMisses << std::endl;
+	}
+	if (sectors > 1) {
+		std::cout << name << " sector misses:      " << sectorMisses << std::endl;
+		std::cout << name << " sector utilization: ";
+		std::cout << (evictedLines ? 100.0 * evictedSectors / (evictedLines * sectors) : 0) << "%" << std::endl;
+	}
+	if (metadataWays > 0) {
+		std::cout << name << " metadata ways: " << metadataWays << " (";
+		std::cout << ((float)getNumMetadataLines() * lineSize)/1024 << "KB)" << std::endl;
+	}
+	if (partitioner) {
+		partitioner->printStats(name);
+	}
+	writebackBuffer.printStats(name);
+	if (victimCache) {
+		victimCache->printStats(name);
+	}
+}
 
+void SetAssociativeCache::receiveRetry()
+{
+	// The memory side has room, so the writeback buffer can try again too.
+	writebackBuffer.kick();
+	Cache::receiveRetry();
 }
 
 int SetAssociativeCache::evictedLineIndex()
 {
-	return (int) rand() % numberOfWays;
+	return (int) rand() % (numberOfWays - metadataWays);
 }
 
 bool SetAssociativeCache::receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id)
 {
-	assert(size <= memory.getLineSize()); // within line size									  
-	assert(address < ((uint64_t)1 << processor.getAddrSize())); // within address range
+	assert(size <= lineSize); // within line size									  
+	assert(address < ((uint64_t)1 << addrSize)); // within address range
 	assert((address &  (size - 1)) == 0); // naturally aligned
+	assert(size <= sectorSize); // so within one sector
 
-	if (blocked) {
+	if (!checkCredit()) {
 		DPRINT("Cache is blocked!"); // Cache is currently blocked, so it cannot receive a new request
 		return false;
 	}
 
-	int setLine = hit(address); // Check if Hit;  SetLine = line in Set if hit OR -1 if miss
+	if (data && writePolicy == WriteThrough && !writebackBuffer.hasSpace()) {
+		DPRINT("Write buffer is full!"); // Stall until the store can go through
+		writebackBuffer.kick();
+		return refuse();
+	}
 
-	if (setLine >= 0) { // HIT
-		DPRINT("Hit in cache");
-		uint8_t* line = dataArray.getLine(setLine); // line is the Address of the data of Set Line
+	int setLine = hit(address); // Check if Hit;  SetLine = line in Set if hit OR -1 if miss
 
-		int block_offset = getBlockOffset(address); // Offset
+	if (setLine >= 0 && !data && !bytesValid(setLine, getBlockOffset(address), size)) { // Only some bytes were written
+		if (!refetch(setLine)) {
+			return false;
+		}
+		setLine = -1;
+	}
+	bool sector_miss = setLine >= 0 && !sectorValid(setLine, getSector(address)); // The tag is here but not the data
 
-		if (data) {  // WRITE
-			memcpy(&line[block_offset], data, size); // Write data into the address of the line
-			sendResponse(request_id, nullptr); 
-			tagArray.setState(setLine, Dirty); // Set Set line to dirty
+	if (setLine >= 0 && !sector_miss) { // HIT
+		DPRINT("Hit in cache");
+		if (inclusion == Exclusive && tagArray.getState(setLine) == Dirty && !writebackBuffer.hasSpace()) {
+			DPRINT("Writeback buffer is full!"); // Stall until the line can be written back
+			writebackBuffer.kick();
+			return refuse();
 		}
-		else { // READ
-			sendResponse(request_id, &line[block_offset]);
+		hits++;
+		monitor(address, request_id, true);
+		accessLine(setLine, getBlockOffset(address), size, data, request_id,
+		           predictionPenalty(address, setLine) + hitPenalty(setLine, data));
+		if (inclusion == Exclusive) {
+			handOff(setLine);
 		}
 	}
+	else if (sectors > 1) { // MISS in a sectored cache
+		return sectorMiss(address, size, data, request_id, sector_miss ? setLine : -1);
+	}
+	else if (data && writeMissPolicy != WriteAllocate) { // Write MISS without a fetch
+		return writeWithoutFetch(address, size, data, request_id);
+	}
 	else { // MISS
 		DPRINT("Miss in cache");
-		setLine = dirty(address); // -1 if all lines of Set Dirty, index of Clean Line otherwise
-		if (setLine < 0) {  // Every line in Set is Dirty
-			DPRINT("Dirty, writing back");
-			// EVICTION
-			setLine = (getIndex(address) * numberOfWays) + evictedLineIndex(); // SetLine is set to the evicted line
-			uint8_t* line = dataArray.getLine(setLine); // line points to data of the evicted line
-			// Calculate Writeback Address
-			uint64_t wb_address = tagArray.getTag(setLine) << (processor.getAddrSize() - tagBits); // Sets Tag of Writeback Address to Tag of Set Line
-			wb_address |= (getIndex(address) << memory.getLineBits()); // Sets Index to Set # of Address
-			// No Offset
-			sendMemRequest(wb_address, memory.getLineSize(), line, -1); // Sends request to memory to receive Line of data
-		}
-		tagArray.setState(setLine, Invalid); // Marks the Set Line as empty (either from eviction or already empty)
-		uint64_t block_address = address & ~(memory.getLineSize() - 1); // block_address = address without offset
-		sendMemRequest(block_address, memory.getLineSize(), nullptr, 0); // Request from memory the data of block address bringing in each line of offset
-		
+		uint64_t block_address = address & ~(lineSize - 1); // block_address = address without offset
+
+		if (!memSide.checkCredit()) {
+			DPRINT("Memory is full!"); // Try again when memory tells us it has room
+			return refuse();
+		}
+		int victim_entries = missWritebacks();
+		if (!writebackBuffer.hasSpace(victim_entries)) {
+			DPRINT("Writeback buffer is full!"); // Stall until there is room
+			writebackBuffer.kick(victim_entries);
+			return refuse();
+		}
+		if (writesPending(block_address)) {
+			return refuse();
+		}
+
+		// The line may have been evicted recently and not made it to memory.
+		std::vector<uint8_t> evicted(lineSize);
+		bool evicted_dirty;
+		if (recoverLine(block_address, evicted.data(), evicted_dirty)) {
+			misses++;
+			lookupMiss(address, request_id);
+			monitor(address, request_id, false);
+			if (inclusion == Exclusive) {
+				// Straight up to the cache above, without filling it here.
+				respond(address, size, request_id, &evicted[getBlockOffset(address)]);
+				if (evicted_dirty) {
+					writebackBuffer.insert(block_address, evicted.data());
+				}
+				return true;
+			}
+			// Bring it straight back, swapping out this set's victim.
+			setLine = fillLine(block_address, evicted.data(), evicted_dirty, false, requestCore(request_id));
+			accessLine(setLine, getBlockOffset(address), size, data, request_id);
+			return true;
+		}
+
+		if (inclusion == Exclusive) {
+			assert(!data); // Only reads come from above, evictions do not get here
+		}
+		// The victim is picked when the line arrives, so nothing is evicted
+		// for a miss the memory side refuses. Fills in exclusive mode go
+		// straight to the cache above.
+		setLine = -1;
+
 		// remember the CPU's request id
 		mshr.savedId = request_id;
 		// Remember the address
 		mshr.savedAddr = address;
 		// Remember the data if it is a write.
 		mshr.savedSize = size;
-		mshr.savedData = data;
+		mshr.savedData.clear();
+		if (data) {
+			mshr.savedData.assign(data, data + size);
+		}
 		mshr.savedSetLineIndex = setLine;
+		mshr.reserved = inclusion == Exclusive ? 0 : victim_entries;
 		// Mark the cache as blocked
-		blocked = true; // The Cache is blocked while it is waiting for data from Memory
+		takeCredit(); // The Cache is blocked while it is waiting for data from Memory
+		for (int i = 0; i < mshr.reserved; i++) {
+			writebackBuffer.reserve(); // So the victim never waits for the buffer
+		}
+		lookupMiss(address, request_id);
+
+		// Send last: a cache below may respond before this call returns.
+		if (!sendMemRequest(block_address, lineSize, nullptr, 0)) { // Request from memory the data of block address bringing in each line of offset
+			for (int i = 0; i < mshr.reserved; i++) {
+				writebackBuffer.unreserve();
+			}
+			undoLookup(address, request_id);
+			undoCredit();
+			return refuse();
+		}
+		misses++;
+		if (victimCache) {
+			victimCache->countMiss();
+		}
+		monitor(address, request_id, false);
 	}
 	// Memory request was accepted
 	return true;
 }
 
+bool SetAssociativeCache::sectorMiss(uint64_t address, int size, const uint8_t* data, int request_id, int line)
+{
+	DPRINT("Miss in cache" << (line >= 0 ? " (sector)" : ""));
+	assert(inclusion != Exclusive);
+	uint64_t sector_address = address & ~((uint64_t)sectorSize - 1);
+
+	if (!memSide.checkCredit()) {
+		DPRINT("Memory is full!"); // Try again when memory tells us it has room
+		return refuse();
+	}
+	if (!writebackBuffer.hasSpace(sectors)) {
+		DPRINT("Writeback buffer is full!"); // Evicting may write back every sector
+		writebackBuffer.kick(sectors);
+		return refuse();
+	}
+
+	if (line >= 0) {
+		sectorMisses++;
+	}
+
+	// The sector may have been evicted recently and not made it to memory.
+	std::vector<uint8_t> evicted(sectorSize);
+	bool evicted_dirty;
+	if (writebackBuffer.remove(sector_address, evicted.data(), evicted_dirty)) {
+		misses++;
+		lookupMiss(address, request_id);
+		monitor(address, request_id, false);
+		if (line < 0) {
+			line = findVictim(address, requestCore(request_id));
+			evict(line);
+		}
+		fillSector(line, sector_address, evicted.data(), evicted_dirty);
+		accessLine(line, getBlockOffset(address), size, data, request_id);
+		return true;
+	}
+
+	mshr.savedId = request_id;
+	mshr.savedAddr = address;
+	mshr.savedSize = size;
+	mshr.savedData.clear();
+	if (data) {
+		mshr.savedData.assign(data, data + size);
+	}
+	mshr.savedSetLineIndex = line;
+	mshr.reserved = line < 0 ? sectors : 0; // A new line's victim may write back every sector
+	takeCredit(); // The Cache is blocked while it is waiting for data from Memory
+	for (int i = 0; i < mshr.reserved; i++) {
+		writebackBuffer.reserve();
+	}
+	lookupMiss(address, request_id);
+
+	// Send last: a cache below may respond before this call returns.
+	if (!sendMemRequest(sector_address, sectorSize, nullptr, 0)) {
+		for (int i = 0; i < mshr.reserved; i++) {
+			writebackBuffer.unreserve();
+		}
+		undoLookup(address, request_id);
+		undoCredit();
+		return refuse();
+	}
+	misses++;
+	monitor(address, request_id, false);
+	return true;
+}
+
 void SetAssociativeCache::receiveMemResponse(int request_id, const uint8_t* data)
 {
 	assert(request_id == 0);
 	assert(data);
 
 	int index = mshr.savedSetLineIndex; // Index = to setLine from receiveMemRequest
+	int id = mshr.savedId;
+	if (mshr.answered) {
+		earlyRestartTicks += curTick();
+		id = -1; // Only fill the line
+	}
+	if (index < 0 && inclusion != Exclusive) { // Now that the line is here, make room for it
+		for (int i = 0; i < mshr.reserved; i++) {
+			writebackBuffer.release();
+		}
+		index = findVictim(mshr.savedAddr, getCore(request_id));
+		evict(index);
+	}
 
-	// Copy the data into the cache.
-	uint8_t* line = dataArray.getLine(index);
-	memcpy(line, data, memory.getLineSize());
-
-	assert(tagArray.getState(index) == Invalid);
+	if (index < 0) { // Exclusive: pass the line up without keeping it
+		if (id >= 0) {
+			respond(mshr.savedAddr, mshr.savedSize, id, &data[getBlockOffset(mshr.savedAddr)]);
+		}
+	}
+	else if (sectors > 1) {
+		fillSector(index, mshr.savedAddr & ~((uint64_t)sectorSize - 1), data, false);
+		accessLine(index, getBlockOffset(mshr.savedAddr), mshr.savedSize,
+		           mshr.savedData.empty() ? nullptr : mshr.savedData.data(), id);
+	}
+	else {
+		// Copy the data into the cache.
+		uint8_t* line = dataArray.getLine(index);
+		memcpy(line, data, lineSize);
 
-	// Mark valid
-	tagArray.setState(index, Valid);
+		assert(tagArray.getState(index) == Invalid);
 
-	// Set tag
-	tagArray.setTag(index, getTag(mshr.savedAddr));
+		// Mark valid
+		tagArray.setState(index, Valid);
+		markValid(index, 0, lineSize);
 
-	// Treat as a hit
-	int block_offset = getBlockOffset(mshr.savedAddr);
+		// Set tag
+		tagArray.setTag(index, getTag(mshr.savedAddr));
+		prefetchedLines[index] = false;
 
-	if (mshr.savedData) {
-		// if this is a write, copy the data into the cache.
-		memcpy(&line[block_offset], mshr.savedData, mshr.savedSize);
-		sendResponse(mshr.savedId, nullptr);
-		// Mark dirty
-		tagArray.setState(index, Dirty);
-	}
-	else {
-		// This is a read so we need to return data
-		sendResponse(mshr.savedId, &line[block_offset]);
+		// Treat as a hit
+		accessLine(index, getBlockOffset(mshr.savedAddr), mshr.savedSize,
+		           mshr.savedData.empty() ? nullptr : mshr.savedData.data(), id);
 	}
 
 	// Default Conditions
-	blocked = false; // Can write/read from cache again
 	mshr.savedId = -1;
 	mshr.savedAddr = 0;
 	mshr.savedSize = 0;
-	mshr.savedData = nullptr;
+	mshr.savedData.clear();
 	mshr.savedSetLineIndex = -1;
+	mshr.reserved = 0;
+	mshr.arrivals.clear();
+	mshr.answered = false;
+	returnCredit(); // Can write/read from cache again
+
+	// Memory may be idle now, so the writeback buffer can drain.
+	writebackBuffer.kick();
+}
+
+void SetAssociativeCache::receiveBeat(int request_id, int offset, int size, const uint8_t* data)
+{
+	assert(request_id == 0);
+	if (mshr.answered || !mshr.savedData.empty()) return; // Writes wait for the line
+
+	int request_size = sectors > 1 ? sectorSize : lineSize;
+	int request_offset = mshr.savedAddr & (request_size - 1);
+	mshr.arrivals.add(request_size, offset, size, data);
+	if (mshr.arrivals.has(request_offset, mshr.savedSize)) {
+		mshr.answered = true;
+		restartEarly(mshr.savedId, mshr.savedSize, &mshr.arrivals.data[request_offset]);
+	}
+}
+
+int SetAssociativeCache::getCore(int request_id)
+{
+	if (request_id < 0) return -1; // Our own writebacks
+	assert(request_id == 0);
+	return requestCore(mshr.savedId);
+}
+
+int SetAssociativeCache::requestCore(int request_id)
+{
+	return requestor->getCore(request_id);
+}
+
+void SetAssociativeCache::monitor(uint64_t address, int request_id, bool hit)
+{
+	// Writebacks from above say nothing about what a core will reuse.
+	if (!partitioner || request_id < 0) return;
+	int core = requestCore(request_id);
+	if (core >= 0) {
+		partitioner->access(core, getIndex(address), address >> lineBits, hit);
+	}
+}
+
+int SetAssociativeCache::getCriticalOffset(int request_id)
+{
+	assert(request_id == 0);
+	int request_size = sectors > 1 ? sectorSize : lineSize;
+	// Our request's place in the line, then the word it is waiting for
+	int offset = mshr.savedAddr & (request_size - 1);
+	return mshr.savedId >= 0 ? offset + requestor->getCriticalOffset(mshr.savedId) : offset;
 }
 
 // HIT
 int SetAssociativeCache::hit(uint64_t address)
 {
 	uint64_t incomingTag = getTag(address);
-	int index = getIndex(address); // Grab set # from address
-	int LineIndex = (index * numberOfWays); // Find line index for Tag Array
+
+	int predicted = predictLine(address); // Try the predicted way before the whole set
+	if (predicted >= 0) {
+		State state = (State)tagArray.getState(predicted); // Valid the same way as in the set below
+		if (((state == Valid) || (state == Dirty)) && tagArray.getTag(predicted) == incomingTag) {
+			return predicted;
+		}
+	}
 	
 	for (int SetIndex = 0; SetIndex < numberOfWays; SetIndex++) { // For every line in the Set
-		State state = (State)tagArray.getState(LineIndex + SetIndex); // Grab state of line in Set
-		uint64_t line_tag = tagArray.getTag(LineIndex + SetIndex); // Grab Tag of line in Set
+		int line = getLine(address, SetIndex); // Line of the Set in this way (the same set for every way unless skewed)
+		State state = (State)tagArray.getState(line); // Grab state of line in Set
+		uint64_t line_tag = tagArray.getTag(line); // Grab Tag of line in Set
 		if (((state == Valid) || (state == Dirty)) && (line_tag == incomingTag)) { // If state is Valid and Tags match, it's a hit
-			return (LineIndex + SetIndex); // The incoming address has the same tag as a line in the set then it's a hit; return the line in Set
+			return line; // The incoming address has the same tag as a line in the set then it's a hit; return the line in Set
 		}
 	}
 	return -1; // Return -1 if Miss
@@ -174,14 +451,551 @@ int SetAssociativeCache::hit(uint64_t address)
 // Check for Dirty
 int SetAssociativeCache::dirty(uint64_t address)
 {
-	int index = getIndex(address);
-	int LineIndex = (index * numberOfWays); // Find index of set in Tag Array
-
-	for (int SetIndex = 0; SetIndex < numberOfWays; SetIndex++) { // For every line in the Set
-		State state = (State)tagArray.getState(LineIndex + SetIndex); // Grab state of line in Set
+	for (int SetIndex = 0; SetIndex < numberOfWays - metadataWays; SetIndex++) { // For every data line in the Set
+		State state = (State)tagArray.getState(getLine(address, SetIndex)); // Grab state of line in Set
 		if (state != Dirty) {  // If the line is not dirty
-			return (LineIndex + SetIndex); // Return the clean Line
+			return getLine(address, SetIndex); // Return the clean Line
 		}
 	}
 	return -1; // Every Line in Set is Dirty
 }
+
+int SetAssociativeCache::findVictim(uint64_t address, int core)
+{
+	int setLine = partitioner && core >= 0 ? findPartitionVictim(address, core) : -1;
+	for (int SetIndex = 0; setLine < 0 && SetIndex < numberOfWays - metadataWays; SetIndex++) { // Use an empty line before replacing anything
+		if (tagArray.getState(getLine(address, SetIndex)) == Invalid) {
+			setLine = getLine(address, SetIndex);
+		}
+	}
+
+	if (setLine < 0) {
+		setLine = dirty(address); // -1 if all lines of Set Dirty, index of Clean Line otherwise
+	}
+	if (setLine < 0) { // Every line in Set is Dirty
+		setLine = getLine(address, evictedLineIndex()); // SetLine is set to the evicted line
+	}
+	if (partitioner) {
+		partitioner->setOwner(setLine, core); // The line is the core's once it is filled
+	}
+	return setLine;
+}
+
+int SetAssociativeCache::findPartitionVictim(uint64_t address, int core)
+{
+	int ways = numberOfWays - metadataWays;
+	std::vector<bool> allowed(ways, false);
+	if (partitioner->getPolicy() == WayPartitioner::Static) {
+		for (int way = 0; way < ways; way++) {
+			allowed[way] = (partitioner->getMask(core) >> way) & 1;
+		}
+	}
+	else {
+		// Anyone can have an empty line
+		for (int way = 0; way < ways; way++) {
+			if (tagArray.getState(getLine(address, way)) == Invalid) {
+				return getLine(address, way);
+			}
+		}
+		// Below its share a core takes a line from a core above its share (or
+		// one nobody owns), otherwise it replaces one of its own.
+		std::vector<int> owners(ways);
+		std::vector<int> held(partitioner->getNumCores(), 0);
+		for (int way = 0; way < ways; way++) {
+			owners[way] = partitioner->getOwner(getLine(address, way));
+			if (owners[way] >= 0) {
+				held[owners[way]]++;
+			}
+		}
+		bool grow = held[core] < partitioner->getAllocation(core);
+		bool any = false;
+		for (int way = 0; way < ways; way++) {
+			int owner = owners[way];
+			allowed[way] = grow ? owner != core && (owner < 0 || held[owner] > partitioner->getAllocation(owner)) : owner == core;
+			any = any || allowed[way];
+		}
+		if (!any) {
+			allowed.assign(ways, true);
+		}
+	}
+
+	// Like findVictim(): an empty line, then a clean one, then any
+	std::vector<int> candidates;
+	for (int way = 0; way < ways; way++) {
+		if (allowed[way] && tagArray.getState(getLine(address, way)) == Invalid) {
+			return getLine(address, way);
+		}
+	}
+	for (int way = 0; way < ways; way++) {
+		if (allowed[way] && tagArray.getState(getLine(address, way)) != Dirty) {
+			return getLine(address, way);
+		}
+		if (allowed[way]) {
+			candidates.push_back(way);
+		}
+	}
+	return getLine(address, candidates[rand() % candidates.size()]);
+}
+
+void SetAssociativeCache::setPartitioner(WayPartitioner* partitioner)
+{
+	this->partitioner = partitioner;
+}
+
+void SetAssociativeCache::setVictimCache(VictimCache* victim_cache)
+{
+	assert(sectors == 1); // Victim lines have no sectors
+	victimCache = victim_cache;
+	// Dirty lines that fall out of the victim cache still need to get to memory.
+	victimCache->setEvictionCallback([this](uint64_t address, const uint8_t* data, bool dirty) {
+		if (dirty || memSide.wantsCleanEvictions()) {
+			writebackBuffer.insert(address, data, dirty);
+		}
+		return true; // Misses make sure the buffer has room
+	});
+}
+
+void SetAssociativeCache::setWayPrediction(WayPrediction prediction)
+{
+	wayPrediction = prediction;
+	int64_t sets = indexMask + 1;
+	// One entry per set for MRU, four per set for the hash table
+	predictedWays.assign(prediction == HashWayPrediction ? sets * 4 : sets, 0);
+}
+
+int64_t SetAssociativeCache::predictorEntry(uint64_t address)
+{
+	if (wayPrediction == MRUWayPrediction) {
+		return getIndex(address);
+	}
+	// Fold the line number so the tag bits pick the entry too
+	uint64_t line_number = address >> lineBits;
+	int bits = log2int(predictedWays.size());
+	return (line_number ^ (line_number >> bits) ^ (line_number >> (2 * bits))) & (predictedWays.size() - 1);
+}
+
+int SetAssociativeCache::predictLine(uint64_t address)
+{
+	if (wayPrediction == NoWayPrediction) return -1;
+	return getLine(address, predictedWays[predictorEntry(address)]);
+}
+
+int SetAssociativeCache::predictionPenalty(uint64_t address, int line)
+{
+	if (wayPrediction == NoWayPrediction) return 0;
+	wayPredictions++;
+	if (predictLine(address) == line) {
+		wayPredictionsCorrect++;
+		return 0;
+	}
+	return 1; // Second probe
+}
+
+void SetAssociativeCache::setWritePolicy(WritePolicy policy, WriteMissPolicy miss_policy)
+{
+	assert(sectors == 1 && !victimCache); // Lines are written back whole
+	writePolicy = policy;
+	writeMissPolicy = miss_policy;
+	if (miss_policy == WriteValidate) {
+		validBytes.assign(size / lineSize, std::vector<bool>(lineSize, true));
+	}
+}
+
+bool SetAssociativeCache::bytesValid(int line, int block_offset, int size)
+{
+	if (validBytes.empty()) return true;
+	auto begin = validBytes[line].begin() + block_offset;
+	return std::find(begin, begin + size, false) == begin + size;
+}
+
+void SetAssociativeCache::markValid(int line, int block_offset, int size)
+{
+	if (validBytes.empty()) return;
+	std::fill(validBytes[line].begin() + block_offset, validBytes[line].begin() + block_offset + size, true);
+}
+
+bool SetAssociativeCache::writeWithoutFetch(uint64_t address, int size, const uint8_t* data, int request_id)
+{
+	DPRINT("Write miss in cache, not fetching");
+	uint64_t block_address = address & ~(lineSize - 1);
+
+	if (!writebackBuffer.hasSpace()) {
+		DPRINT("Writeback buffer is full!"); // The store or the victim needs an entry
+		writebackBuffer.kick();
+		return refuse();
+	}
+	misses++;
+	lookupMiss(address, request_id);
+	monitor(address, request_id, false);
+
+	// Nothing is fetched, but a whole line that was just evicted can come back.
+	std::vector<uint8_t> evicted(lineSize);
+	bool evicted_dirty;
+	if (recoverLine(block_address, evicted.data(), evicted_dirty)) {
+		int line = fillLine(block_address, evicted.data(), evicted_dirty, false, requestCore(request_id));
+		accessLine(line, getBlockOffset(address), size, data, request_id);
+		return true;
+	}
+
+	if (writeMissPolicy == NoWriteAllocate) {
+		writesAround++;
+		writebackBuffer.write(address, size, data);
+		respond(address, size, request_id, nullptr);
+		return true;
+	}
+
+	writeValidates++;
+	int line = findVictim(address, requestCore(request_id));
+	evict(line);
+	tagArray.setTag(line, getTag(block_address));
+	tagArray.setState(line, Valid);
+	prefetchedLines[line] = false;
+	validBytes[line].assign(lineSize, false); // accessLine marks what is written
+	if (writePolicy == WriteBack && writebackBuffer.remove(block_address, evicted.data(), evicted_dirty, &validBytes[line])) {
+		// Bytes written before the line was last evicted. They come back rather
+		// than having two copies of the line on their way below.
+		memcpy(dataArray.getLine(line), evicted.data(), lineSize);
+		tagArray.setState(line, Dirty);
+	}
+	accessLine(line, getBlockOffset(address), size, data, request_id);
+	return true;
+}
+
+bool SetAssociativeCache::refetch(int line)
+{
+	DPRINT("Read of bytes a write-validate line does not have");
+	if (tagArray.getState(line) == Dirty && !writebackBuffer.hasSpace()) {
+		DPRINT("Writeback buffer is full!");
+		writebackBuffer.kick();
+		return refuse();
+	}
+	validateMisses++;
+	evict(line); // Its bytes get below first, then the line is fetched
+	return true;
+}
+
+bool SetAssociativeCache::writesPending(uint64_t block_address)
+{
+	if (!writebackBuffer.hasPartial(block_address)) return false;
+	DPRINT("Waiting for stores to the line to drain");
+	writebackBuffer.flush();
+	return true;
+}
+
+void SetAssociativeCache::setIndexFunction(IndexFunction::Kind kind)
+{
+	indexFunction = IndexFunction(indexMask + 1, kind);
+	tagBits = addrSize - log2int(indexMask + 1) - lineBits + indexFunction.getExtraTagBits();
+	tagArray.setTagBits(tagBits);
+}
+
+void SetAssociativeCache::reserveMetadataWays(int ways)
+{
+	assert(ways > 0 && ways < numberOfWays);
+	metadataWays = ways;
+}
+
+int SetAssociativeCache::getNumMetadataLines()
+{
+	return (indexMask + 1) * metadataWays;
+}
+
+uint8_t* SetAssociativeCache::getMetadataLine(int index)
+{
+	assert(index >= 0 && index < getNumMetadataLines());
+	int set = index / metadataWays;
+	int way = numberOfWays - metadataWays + index % metadataWays;
+	return dataArray.getLine(set * numberOfWays + way);
+}
+
+uint64_t SetAssociativeCache::getLineAddress(int line)
+{
+	// Tag and Set # of the line, and its way for a skewed index. No Offset
+	return indexFunction.getLineNumber(tagArray.getTag(line), line / numberOfWays, line % numberOfWays) << lineBits;
+}
+
+void SetAssociativeCache::evict(int line)
+{
+	State state = (State)tagArray.getState(line);
+	if (state == Valid || state == Dirty) {
+		bool dirty = state == Dirty;
+		bool dirty_above = false;
+		if (prefetchedLines[line]) {
+			prefetchesUseless++; // Nobody asked for it
+			prefetchedLines[line] = false;
+		}
+		if (inclusion == Inclusive) {
+			backInvalidate(getLineAddress(line), dataArray.getLine(line), dirty_above); // Nothing above may keep it
+			dirty = dirty || dirty_above;
+		}
+		evictedLines++;
+		if (sectors > 1) {
+			// Only the sectors that are here, and only dirty ones
+			for (int sector = 0; sector < sectors; sector++) {
+				State sector_state = (State)tagArray.getSectorState(line, sector);
+				if (sector_state == Invalid) continue;
+				evictedSectors++;
+				if (sector_state == Dirty || dirty_above) { // We do not know which sector the data from above was in
+					writebackBuffer.insert(getLineAddress(line) + sector * sectorSize,
+					                       dataArray.getLine(line) + sector * sectorSize);
+				}
+				tagArray.setSectorState(line, sector, Invalid);
+			}
+		}
+		else if (victimCache) {
+			victimCache->insert(getLineAddress(line), dataArray.getLine(line), dirty);
+		}
+		else if (dirty && !bytesValid(line, 0, lineSize)) {
+			writebackBuffer.insert(getLineAddress(line), dataArray.getLine(line), true, &validBytes[line]); // Only the bytes written
+		}
+		else if (dirty || memSide.wantsCleanEvictions()) {
+			writebackBuffer.insert(getLineAddress(line), dataArray.getLine(line), dirty); // Memory gets it when the channel is free
+		}
+	}
+	tagArray.setState(line, Invalid);
+}
+
+bool SetAssociativeCache::recoverLine(uint64_t block_address, uint8_t* data, bool& dirty, bool demand)
+{
+	if (victimCache && victimCache->probe(block_address, data, dirty, demand)) {
+		return true;
+	}
+	if (writebackBuffer.remove(block_address, data, dirty)) {
+		if (dirty && writePolicy == WriteThrough) {
+			writebackBuffer.insert(block_address, data); // Still on its way below, so the line stays clean
+			dirty = false;
+		}
+		return true;
+	}
+	return false;
+}
+
+int SetAssociativeCache::fillLine(uint64_t block_address, const uint8_t* data, bool dirty, bool prefetch, int core)
+{
+	int line = findVictim(block_address, core);
+	State state = (State)tagArray.getState(line);
+	if (prefetch && (state == Valid || state == Dirty) && !prefetchedLines[line]) {
+		// Remember what the prefetch pushed out, to catch misses it causes.
+		prefetchVictims.push_back(getLineAddress(line));
+		if (prefetchVictims.size() > prefetchVictimEntries) {
+			prefetchVictims.pop_front();
+		}
+	}
+	evict(line);
+	auto victim = std::find(prefetchVictims.begin(), prefetchVictims.end(), block_address);
+	if (victim != prefetchVictims.end()) {
+		prefetchVictims.erase(victim); // It is back
+	}
+
+	// Copy the data into the cache.
+	memcpy(dataArray.getLine(line), data, lineSize);
+	tagArray.setTag(line, getTag(block_address));
+	tagArray.setState(line, dirty ? Dirty : Valid);
+	markValid(line, 0, lineSize);
+	prefetchedLines[line] = prefetch;
+	return line;
+}
+
+bool SetAssociativeCache::isPrefetchVictim(uint64_t block_address)
+{
+	return std::find(prefetchVictims.begin(), prefetchVictims.end(), block_address) != prefetchVictims.end();
+}
+
+bool SetAssociativeCache::sectorValid(int line, int sector)
+{
+	return sectors == 1 || tagArray.getSectorState(line, sector) != Invalid;
+}
+
+void SetAssociativeCache::fillSector(int line, uint64_t sector_address, const uint8_t* data, bool dirty)
+{
+	int sector = getSector(sector_address);
+	if (tagArray.getState(line) == Invalid) {
+		// A new line: none of its other sectors are here yet
+		for (int i = 0; i < sectors; i++) {
+			tagArray.setSectorState(line, i, Invalid);
+		}
+		tagArray.setTag(line, getTag(sector_address));
+		tagArray.setState(line, Valid);
+		prefetchedLines[line] = false;
+	}
+	assert(tagArray.getTag(line) == getTag(sector_address));
+	assert(tagArray.getSectorState(line, sector) == Invalid);
+
+	memcpy(dataArray.getLine(line) + sector * sectorSize, data, sectorSize);
+	tagArray.setSectorState(line, sector, dirty ? Dirty : Valid);
+	if (dirty) {
+		tagArray.setState(line, Dirty);
+	}
+}
+
+void SetAssociativeCache::accessLine(int line, int block_offset, int size, const uint8_t* data, int request_id, int extra_ticks)
+{
+	uint8_t* line_data = dataArray.getLine(line); // line_data is the Address of the data of Set Line
+
+	if (wayPrediction != NoWayPrediction) {
+		predictedWays[predictorEntry(getLineAddress(line))] = line % numberOfWays; // Predict this way next time
+	}
+
+	if (data) {  // WRITE
+		memcpy(&line_data[block_offset], data, size); // Write data into the address of the line
+		respond(getLineAddress(line), size, request_id, nullptr, extra_ticks);
+		markValid(line, block_offset, size);
+		if (writePolicy == WriteThrough) {
+			writesThrough++;
+			writebackBuffer.write(getLineAddress(line) + block_offset, size, data); // The line stays clean
+			return;
+		}
+		tagArray.setState(line, Dirty); // Set Set line to dirty
+		if (sectors > 1) {
+			tagArray.setSectorState(line, block_offset / sectorSize, Dirty);
+		}
+	}
+	else { // READ
+		respond(getLineAddress(line), size, request_id, &line_data[block_offset], extra_ticks);
+	}
+}
+
+void SetAssociativeCache::handOff(int line)
+{
+	if (tagArray.getState(line) == Dirty) {
+		writebackBuffer.insert(getLineAddress(line), dataArray.getLine(line));
+	}
+	tagArray.setState(line, Invalid); // The cache above has it now
+}
+
+bool SetAssociativeCache::receiveEviction(uint64_t address, int size, const uint8_t* data, bool dirty)
+{
+	if (inclusion != Exclusive) {
+		return Cache::receiveEviction(address, size, data, dirty);
+	}
+	assert(size == lineSize);
+
+	int setLine = hit(address);
+	if (setLine >= 0) { // Already here, just take the newer data
+		memcpy(dataArray.getLine(setLine), data, lineSize);
+		if (dirty) {
+			tagArray.setState(setLine, Dirty);
+		}
+		return true;
+	}
+
+	if (!writebackBuffer.hasSpace()) {
+		DPRINT("Writeback buffer is full!"); // Stall until there is room for our victim
+		writebackBuffer.kick();
+		return refuse();
+	}
+
+	// A copy written back by handOff() is older than this one. Drop it, but
+	// memory still needs the data if it was dirty.
+	std::vector<uint8_t> stale(lineSize);
+	bool stale_dirty = false;
+	if (writebackBuffer.remove(address, stale.data(), stale_dirty) && stale_dirty) {
+		dirty = true;
+	}
+	fillLine(address, data, dirty);
+	return true;
+}
+
+int SetAssociativeCache::receiveInvalidate(uint64_t address, int size, uint8_t* data, bool& dirty)
+{
+	assert(size % lineSize == 0); // Lines below are never smaller
+
+	int invalidated = 0;
+	std::vector<uint8_t> recovered(lineSize);
+	for (uint64_t block_address = address; block_address < address + size; block_address += lineSize) {
+		uint8_t* block_data = &data[block_address - address];
+
+		// Take the line out of this level, wherever it is
+		int setLine = hit(block_address);
+		bool recovered_dirty = false;
+		if (sectors > 1) {
+			// Sector by sector, from the cache or the writeback buffer
+			for (int sector = 0; sector < sectors; sector++) {
+				uint8_t* sector_data = block_data + sector * sectorSize;
+				if (setLine >= 0 && tagArray.getSectorState(setLine, sector) == Dirty) {
+					memcpy(sector_data, dataArray.getLine(setLine) + sector * sectorSize, sectorSize);
+					dirty = true;
+				}
+				else if (writebackBuffer.remove(block_address + sector * sectorSize, recovered.data(), recovered_dirty) && recovered_dirty) {
+					memcpy(sector_data, recovered.data(), sectorSize);
+					dirty = true;
+				}
+				if (setLine >= 0) {
+					tagArray.setSectorState(setLine, sector, Invalid);
+				}
+			}
+			if (setLine >= 0) {
+				tagArray.setState(setLine, Invalid);
+				invalidated++;
+			}
+		}
+		else if (setLine >= 0) {
+			if (tagArray.getState(setLine) == Dirty) {
+				for (int i = 0; i < lineSize; i++) {
+					if (bytesValid(setLine, i, 1)) { // Only the bytes a write-validate line has
+						block_data[i] = dataArray.getLine(setLine)[i];
+					}
+				}
+				dirty = true;
+			}
+			if (prefetchedLines[setLine]) {
+				prefetchesUseless++;
+				prefetchedLines[setLine] = false;
+			}
+			tagArray.setState(setLine, Invalid);
+			invalidated++;
+		}
+		else if (recoverLine(block_address, recovered.data(), recovered_dirty, false)) {
+			if (recovered_dirty) {
+				memcpy(block_data, recovered.data(), lineSize);
+				dirty = true;
+			}
+			invalidated++;
+		}
+
+		// Anything above is at least as new as this level
+		invalidated += sendInvalidate(block_address, lineSize, block_data, dirty);
+	}
+	return invalidated;
+}
+
+void SetAssociativeCache::getValidLines(std::vector<uint64_t>& addresses)
+{
+	for (int line = 0; line < (int)(indexMask + 1) * numberOfWays; line++) {
+		State state = (State)tagArray.getState(line);
+		if (state == Valid || state == Dirty) {
+			addresses.push_back(getLineAddress(line));
+		}
+	}
+}
+
+void SetAssociativeCache::getDirtyData(const std::function<void(uint64_t, int, const uint8_t*)>& write)
+{
+	// What was evicted is older than what is in the cache.
+	writebackBuffer.getDirtyData(write);
+	if (victimCache) {
+		victimCache->getDirtyData(write);
+	}
+	for (int line = 0; line < (int)(indexMask + 1) * numberOfWays; line++) {
+		uint64_t line_address = getLineAddress(line);
+		uint8_t* data = dataArray.getLine(line);
+		if (sectors > 1) {
+			for (int sector = 0; sector < sectors; sector++) {
+				if (tagArray.getSectorState(line, sector) == Dirty) {
+					write(line_address + sector * sectorSize, sectorSize, data + sector * sectorSize);
+				}
+			}
+			continue;
+		}
+		if (tagArray.getState(line) != Dirty) continue;
+		// Only the bytes that are there (see write-validate)
+		for (int begin = 0; begin < lineSize;) {
+			int end = begin;
+			while (end < lineSize && bytesValid(line, end, 1)) end++;
+			if (end > begin) {
+				write(line_address + begin, end - begin, data + begin);
+			}
+			begin = end + 1;
+		}
+	}
+}
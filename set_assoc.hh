@@ -1,21 +1,69 @@
 #ifndef CSIM_SET_ASSOC_H
 #define CSIM_SET_ASSOC_H
 
+#include <deque>
+#include <vector>
+
 #include "cache.hh"
+#include "index_function.hh"
 #include "tag_array.hh"
 #include "sram_array.hh"
+#include "victim_cache.hh"
+#include "way_partitioner.hh"
+#include "writeback_buffer.hh"
 
 class SetAssociativeCache : public Cache
 {
 public:
+	/**
+	* How to guess which way of a set will hit, so it can be probed first
+	*/
+	enum WayPrediction
+	{
+		NoWayPrediction,
+		/// The way of the set that was used last
+		MRUWayPrediction,
+		/// A table indexed by a hash of the line address
+		HashWayPrediction
+	};
+
+	/**
+	* When stores reach the level below
+	*/
+	enum WritePolicy
+	{
+		/// When the dirty line is evicted
+		WriteBack,
+		/// Right away, through the writeback buffer. Lines stay clean.
+		WriteThrough
+	};
+
+	/**
+	* What a store that misses does
+	*/
+	enum WriteMissPolicy
+	{
+		/// Fetch the line and write it
+		WriteAllocate,
+		/// Send the store to the level below without filling a line
+		NoWriteAllocate,
+		/// Fill a line without fetching it. Only the bytes written are
+		/// valid, and a read of any other byte fetches the line again.
+		WriteValidate
+	};
+
 	/**
 	* @param size is the *total* size of the cache in bytes
-	* @param the memory that is below this cache
-	* @param processor this cache is connected to
+	* @param line_size is the size of a line in bytes
+	* @param mem_side is the cache or memory below this cache
+	* @param addr_size is the number of bits in the address
 	* @param the number of ways in this set associative cache. If the number
 	*        of ways cannot be realized, this will cause an error
+	* @param the number of lines in the writeback buffer
+	* @param sectors is the number of sectors per line. Sectors share a tag
+	*        but are fetched and written back on their own.
 	*/
-	SetAssociativeCache(int64_t size, Memory& memory, Processor& processor, int ways);
+	SetAssociativeCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int wb_entries = 8, int sectors = 1);
 
 	/**
 	* Destructor
@@ -38,8 +86,8 @@ public:
 	virtual bool receiveRequest(uint64_t address, int size, const uint8_t* data, int request_id) override;
 
 	/**
-	* Called when memory id finished processing a request.
-	* Data will always be the length of memory.getLineSize()
+	* Called when the memory side finished processing a request.
+	* Data will always be the length of getLineSize()
 	*
 	* @param request_id is the id assigned to this request in sendMemRequest
 	* @param data is the data from memory (length of data is line length)
@@ -47,8 +95,100 @@ public:
 	*/
 	virtual void receiveMemResponse(int request_id, const uint8_t* data) override;
 
-private:
-	/// Put any code you want here.
+	/**
+	* A read waiting for the line is answered as soon as its bytes arrive.
+	*/
+	void receiveBeat(int request_id, int offset, int size, const uint8_t* data) override;
+
+	/**
+	* @return the offset of the waiting request in the line (or sector)
+	*/
+	int getCriticalOffset(int request_id) override;
+
+	/**
+	* @return the core of the miss being fetched, from the cache above
+	*/
+	int getCore(int request_id) override;
+
+	/**
+	* Called when the memory side has room again after refusing this cache
+	* or its writeback buffer.
+	*/
+	void receiveRetry() override;
+
+	/**
+	* An exclusive cache fills lines evicted from above. Otherwise dirty
+	* lines are written like any other store.
+	*/
+	bool receiveEviction(uint64_t address, int size, const uint8_t* data, bool dirty) override;
+
+	/**
+	* Removes lines from this cache, its victim cache, its writeback buffer
+	* and everything above it.
+	*/
+	int receiveInvalidate(uint64_t address, int size, uint8_t* data, bool& dirty) override;
+
+	void getValidLines(std::vector<uint64_t>& addresses) override;
+
+	/**
+	* Includes its victim cache and writeback buffer.
+	*/
+	void getDirtyData(const std::function<void(uint64_t, int, const uint8_t*)>& write) override;
+
+	/**
+	* Attach a victim cache. Every line evicted from this cache goes to the
+	* victim cache, and misses look there before going to memory.
+	*/
+	void setVictimCache(VictimCache* victim_cache);
+
+	/**
+	* Probe one predicted way first. A hit in that way takes the normal
+	* latency, any other hit takes an extra tick for the second probe.
+	*/
+	void setWayPrediction(WayPrediction prediction);
+
+	/**
+	* Set how stores are handled. Must be called before the cache is used.
+	*/
+	void setWritePolicy(WritePolicy policy, WriteMissPolicy miss_policy);
+
+	/**
+	* Pick the lines' sets with something other than the low bits of the
+	* line number. With a skewed function each way has its own set for an
+	* address. Must be called before the cache is used.
+	*/
+	void setIndexFunction(IndexFunction::Kind kind);
+
+	/**
+	* Take the last ways of every set away from data and give them to
+	* prefetcher metadata. Must be called before the cache is used.
+	*/
+	void reserveMetadataWays(int ways);
+
+	/**
+	* @return the number of lines set aside for metadata
+	*/
+	int getNumMetadataLines();
+
+	/**
+	* @return the data of a metadata line. Nothing else touches it.
+	*/
+	uint8_t* getMetadataLine(int index);
+
+	/**
+	* Share the ways among the cores above (see WayPartitioner). Misses only
+	* replace lines the partitioner allows, and it sees every demand access.
+	* Must be called before the cache is used.
+	*/
+	void setPartitioner(WayPartitioner* partitioner);
+
+protected:
+	/**
+	* Same as above, but with a given number of credits (outstanding misses)
+	* for subclasses that can handle more than one miss.
+	*/
+	SetAssociativeCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size, int ways, int credits, int wb_entries, int sectors);
+
 	enum State 
 	{
 		Invalid = 0,
@@ -59,8 +199,14 @@ private:
 
 	/**
 	* @return the index number for the given address
+	* @param way only matters for a skewed index function
 	*/
-	int64_t getIndex(uint64_t address);
+	int64_t getIndex(uint64_t address, int way = 0);
+
+	/**
+	* @return the line the address would be in if it were in the given way
+	*/
+	int getLine(uint64_t address, int way) { return getIndex(address, way) * numberOfWays + way; }
 
 	/**
 	* @return the block offset for the given address
@@ -84,24 +230,252 @@ private:
 	*/
 	int dirty(uint64_t address);
 
+	/**
+	* @return the line to replace for the given address: an empty line if
+	*         there is one, then a clean line. This may be dirty.
+	* @param core is the core the line will be filled for, -1 if not known.
+	*        With a partitioner only the core's lines can be picked.
+	*        Subclasses may move or evict lines to free one, so only call
+	*        this once the line is sure to be filled.
+	*/
+	virtual int findVictim(uint64_t address, int core = -1);
+
+	/**
+	* @return the writeback entries to hold for the victim of a miss until
+	*         its line arrives
+	*/
+	virtual int missWritebacks() { return 1; }
+
+	/**
+	* findVictim() for a known core of a partitioned cache
+	*/
+	int findPartitionVictim(uint64_t address, int core);
+
+	/**
+	* @return the core a request from above is for, -1 if it is not known
+	*/
+	int requestCore(int request_id);
+
+	/**
+	* Show a demand access to the partitioner, if there is one.
+	*/
+	void monitor(uint64_t address, int request_id, bool hit);
+
+	/**
+	* @return the address of the data held in a line
+	*/
+	uint64_t getLineAddress(int line);
+
+	/**
+	* Removes a line from the cache. It goes to the victim cache if there is
+	* one, otherwise to the writeback buffer if it is dirty.
+	*/
+	void evict(int line);
+
+	/**
+	* Looks for a recently evicted line in the victim cache and the
+	* writeback buffer, and takes it out if it is found.
+	*
+	* @param data is where the line is copied to
+	* @param dirty is set to true if memory does not have this data
+	* @param demand is false if no request from above is waiting for it
+	* @return true if the line was found
+	*/
+	bool recoverLine(uint64_t block_address, uint8_t* data, bool& dirty, bool demand = true);
+
+	/**
+	* Handles a miss in a sectored cache. Only the missing sector is
+	* fetched.
+	*
+	* @param line is the line whose tag matched, or -1 to replace a line
+	*/
+	bool sectorMiss(uint64_t address, int size, const uint8_t* data, int request_id, int line);
+
+	/**
+	* @return the sector of the line that the address falls in
+	*/
+	int getSector(uint64_t address) { return (address & (lineSize - 1)) / sectorSize; }
+
+	/**
+	* @return true if the sector of a valid line holds data. Always true
+	*         without sectors.
+	*/
+	bool sectorValid(int line, int sector);
+
+	/**
+	* Puts one sector into a line. An empty line takes the sector's tag and
+	* its other sectors start out invalid.
+	*
+	* @param dirty is true if the data does not match memory
+	*/
+	void fillSector(int line, uint64_t sector_address, const uint8_t* data, bool dirty);
+
+	/**
+	* Puts a line into the cache, evicting whatever is in the victim line.
+	*
+	* @param dirty is true if the data does not match memory
+	* @param prefetch is true if nobody has asked for the line yet
+	* @param core is the core the line is for, -1 if not known
+	* @return the line that was filled
+	*/
+	int fillLine(uint64_t block_address, const uint8_t* data, bool dirty, bool prefetch = false, int core = -1);
+
+	/**
+	* Does a read or write to a line that is in the cache and responds.
+	*
+	* @param extra_ticks is added to the hit latency
+	*/
+	void accessLine(int line, int block_offset, int size, const uint8_t* data, int request_id, int extra_ticks = 0);
+
+	/**
+	* @return the line the way predictor expects the address in, -1 if
+	*         there is no prediction
+	*/
+	int predictLine(uint64_t address);
+
+	/**
+	* Count a demand hit against the way prediction.
+	*
+	* @return the extra ticks the hit takes (1 if the prediction was wrong)
+	*/
+	int predictionPenalty(uint64_t address, int line);
+
+	/**
+	* @return the extra ticks a demand hit on a line takes (e.g., to
+	*         decompress it), 0 by default
+	* @param data is non-null for a write
+	*/
+	virtual int hitPenalty(int line, const uint8_t* data) { return 0; }
+
+	/**
+	* @return the way predictor entry for an address
+	*/
+	int64_t predictorEntry(uint64_t address);
+
+	/**
+	* @return true unless the line was filled by write-validate and some of
+	*         the bytes have not been written
+	*/
+	bool bytesValid(int line, int block_offset, int size);
+
+	/**
+	* Record that bytes of a line now hold data (for write-validate).
+	*/
+	void markValid(int line, int block_offset, int size);
+
+	/**
+	* Handles a write miss that does not fetch the line (no-write-allocate
+	* or write-validate).
+	*/
+	bool writeWithoutFetch(uint64_t address, int size, const uint8_t* data, int request_id);
+
+	/**
+	* A read wants bytes that a write-validate line does not have. The line
+	* is written back and the read goes on as a miss, which waits for any
+	* of its bytes still in the writeback buffer (see writesPending()).
+	*
+	* @return false if the request was refused, true if the line is gone
+	*/
+	bool refetch(int line);
+
+	/**
+	* Stores to a line still in the writeback buffer have to get below
+	* before the line is fetched. If there are any, the buffer is flushed.
+	*
+	* @return true if the fetch must wait
+	*/
+	bool writesPending(uint64_t block_address);
+
+	/**
+	* Exclusive caches give a line to the cache above after a hit. A dirty
+	* line is written back first, since it goes up clean.
+	* NOTE: A dirty line needs space in the writeback buffer.
+	*/
+	void handOff(int line);
+
 	/// Number of Ways
 	int numberOfWays;
 
+	/// Ways at the end of each set that hold metadata instead of lines
+	int metadataWays;
+
+	/// Sectors per line, 1 if lines are not sectored
+	int sectors;
+
+	/// Bytes per sector (lineSize without sectors)
+	int sectorSize;
+
 	/// Number of tag bits in the address
 	int64_t tagBits;
 
 	/// Mask for getting the index bits
 	uint64_t indexMask;
 
+	/// Maps line numbers to sets (per way if skewed) and tags
+	IndexFunction indexFunction;
+
 	/// The cache's tag array
 	TagArray tagArray;
 
 	/// The cache's data array
 	SRAMArray dataArray;
 
-	/// If true, the cache is currently blocked
-	bool blocked;
+	/// Dirty lines on their way to memory
+	WritebackBuffer writebackBuffer;
+
+	/// Optional victim cache, nullptr if there is none
+	VictimCache* victimCache;
+
+	/// True for each line that was prefetched and has not been used yet
+	std::vector<bool> prefetchedLines;
+
+	/**
+	* @return true if a prefetch fill recently evicted this line. It is
+	*         forgotten when the line is filled again.
+	*/
+	bool isPrefetchVictim(uint64_t block_address);
+
+	/// Prefetched lines evicted or invalidated before anyone used them
+	int64_t prefetchesUseless;
+
+	/// Shadow tags: lines recently evicted by prefetch fills, newest last
+	std::deque<uint64_t> prefetchVictims;
+
+	WayPrediction wayPrediction;
+
+	/// MRU way of each set, or the way for each hash of a line address
+	std::vector<int> predictedWays;
+
+	/// Shares the ways among cores, nullptr if they are not shared
+	WayPartitioner* partitioner;
 
+	/// Demand hits, and those in the predicted way
+	int64_t wayPredictions;
+	int64_t wayPredictionsCorrect;
+
+	WritePolicy writePolicy;
+	WriteMissPolicy writeMissPolicy;
+
+	/// The bytes of each line that hold data, only with write-validate
+	std::vector<std::vector<bool>> validBytes;
+
+	/// Stores written through, write misses sent below without a line, and
+	/// lines filled by write-validate without a fetch
+	int64_t writesThrough;
+	int64_t writesAround;
+	int64_t writeValidates;
+
+	/// Reads that wanted bytes a write-validate line did not have
+	int64_t validateMisses;
+
+	/// Misses where the tag matched but the sector was not there
+	int64_t sectorMisses;
+
+	/// Valid lines evicted, and the sectors they held, for utilization
+	int64_t evictedLines;
+	int64_t evictedSectors;
+
+private:
 	struct MSHR 
 	{
 		/// This is the current request_id that is blocking the cache.
@@ -114,11 +488,20 @@ private:
 		int savedSize;
 
 		/// This is the data that will be written after a miss
-		const uint8_t* savedData;
+		std::vector<uint8_t> savedData;
 		
 		/// Saves Set Line Index
 		int savedSetLineIndex;
 
+		/// Writeback entries held for the victim, which is only chosen and
+		/// evicted when the line arrives (if savedSetLineIndex is -1)
+		int reserved;
+
+		/// The part of the line that has arrived so far
+		Arrivals arrivals;
+
+		/// True if the read was answered before the fill
+		bool answered;
 	};
 
 	MSHR mshr;
@@ -0,0 +1,90 @@
+
+#include <cassert>
+#include <iostream>
+
+#include "sms_prefetcher.hh"
+#include "util.hh"
+
+SMSPrefetcher::SMSPrefetcher(int line_size, int degree, int region_size,
+                             int generations) :
+    Prefetcher(line_size, degree, region_size / line_size),
+    regionBits(log2int(region_size)), regionLines(region_size / line_size),
+    generations(generations), patterns(region_size / line_size),
+    useCounter(0), triggers(0), patternHits(0)
+{
+    assert(region_size > line_size);
+    assert(generations > 0);
+    for (auto& generation : this->generations) {
+        generation.valid = false;
+    }
+    for (auto& pattern : patterns) {
+        pattern.valid = false;
+    }
+}
+
+void SMSPrefetcher::printStats(const std::string& name)
+{
+    Prefetcher::printStats(name);
+    std::cout << name << " SMS triggers:     " << triggers << std::endl;
+    std::cout << name << " SMS pattern hits: " << patternHits << std::endl;
+}
+
+void SMSPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    uint64_t region = address >> regionBits;
+    int offset = (address >> lineBits) & (regionLines - 1);
+
+    Generation* victim = &generations[0];
+    for (auto& generation : generations) {
+        if (generation.valid && generation.region == region) {
+            // Every access counts, hit or miss, so the pattern is complete.
+            generation.accessed[offset] = true;
+            generation.lastUse = ++useCounter;
+            return;
+        }
+        if (!generation.valid ||
+            (victim->valid && generation.lastUse < victim->lastUse)) {
+            victim = &generation;
+        }
+    }
+
+    // Only a miss starts a generation; hits are in regions already cached.
+    if (hit && !prefetched) return;
+
+    if (victim->valid) {
+        endGeneration(*victim);
+    }
+    victim->valid = true;
+    victim->region = region;
+    victim->triggerOffset = offset;
+    victim->accessed.assign(regionLines, false);
+    victim->accessed[offset] = true;
+    victim->lastUse = ++useCounter;
+    triggers++;
+
+    Pattern& pattern = patterns[offset];
+    if (!pattern.valid) return;
+    patternHits++;
+
+    // Stream the pattern out from the trigger.
+    uint64_t region_address = region << regionBits;
+    int issued = 0;
+    for (int distance = 1; distance < regionLines && issued < degree; distance++) {
+        for (int target : {offset + distance, offset - distance}) {
+            if (target < 0 || target >= regionLines || !pattern.lines[target] ||
+                issued == degree) {
+                continue;
+            }
+            queuePrefetch(region_address + ((uint64_t)target << lineBits));
+            issued++;
+        }
+    }
+}
+
+void SMSPrefetcher::endGeneration(Generation& generation)
+{
+    Pattern& pattern = patterns[generation.triggerOffset];
+    pattern.valid = true;
+    pattern.lines = generation.accessed;
+    generation.valid = false;
+}
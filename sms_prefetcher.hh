@@ -0,0 +1,87 @@
+
+#ifndef CSIM_SMS_PREFETCHER_H
+#define CSIM_SMS_PREFETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "prefetcher.hh"
+
+/**
+ * Spatial memory streaming prefetcher (after Somogyi et al., SMS).
+ *
+ * Memory is split into regions. The first miss to a region (the trigger)
+ * starts a generation, and the active generation table records a bitmap of
+ * the lines accessed in the region until the generation ends. The bitmap
+ * is then stored in the pattern history table, and the next trigger with
+ * the same key prefetches the lines in it.
+ *
+ * The original indexes patterns by PC and trigger offset. The traces have
+ * no PC, so the key is the trigger offset alone, which still captures
+ * layouts that repeat from one region to the next (e.g., the same fields
+ * of each object in a memory area). A generation ends when its entry is
+ * replaced in the active generation table rather than when one of its
+ * lines is evicted.
+ *
+ * The degree caps the lines prefetched per trigger, closest to the trigger
+ * first.
+ */
+class SMSPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the most lines prefetched per trigger
+     * @param region_size is the size of a region, in bytes
+     * @param generations is the number of regions tracked at once
+     */
+    SMSPrefetcher(int line_size, int degree = 16, int region_size = 2048,
+                  int generations = 32);
+
+    void printStats(const std::string& name) override;
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+  private:
+    struct Generation
+    {
+        bool valid;
+        uint64_t region;
+        int triggerOffset;
+
+        /// One bit per line in the region
+        std::vector<bool> accessed;
+
+        /// For LRU replacement
+        int64_t lastUse;
+    };
+
+    struct Pattern
+    {
+        bool valid;
+        std::vector<bool> lines;
+    };
+
+    /**
+     * Store the generation's bitmap in the pattern history table.
+     */
+    void endGeneration(Generation& generation);
+
+    int regionBits;
+
+    /// Lines per region
+    int regionLines;
+
+    std::vector<Generation> generations;
+
+    /// Indexed by trigger offset
+    std::vector<Pattern> patterns;
+
+    int64_t useCounter;
+
+    int64_t triggers;
+    int64_t patternHits;
+};
+
+#endif // CSIM_SMS_PREFETCHER_H
@@ -0,0 +1,273 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "coherent_cache.hh"
+#include "snooping_bus.hh"
+#include "util.hh"
+
+SnoopingBus::SnoopingBus(int cores, int line_size, ResponsePort& mem_side,
+                         Protocol protocol, int latency) :
+    lineSize(line_size), caches(cores, nullptr), lookupLatency(0),
+    memSide(mem_side), protocol(protocol), latency(latency), nextTag(0),
+    sendingTag(-1), drainScheduled(false), drainingCore(-1), transactions{0, 0, 0}, snoops(0), cacheToCache(0),
+    memoryReads(0), writebacksSent(0), transitions{}, transitionBytes{}
+{
+    assert(cores > 0 && latency > 0);
+    for (int core = 0; core < cores; core++) {
+        ports.push_back(new Port(*this, core));
+    }
+    memSide.setRequestor(this);
+}
+
+SnoopingBus::~SnoopingBus()
+{
+    std::cout << "Bus protocol:  " << (protocol == MOESI ? "MOESI" : "MESI") << std::endl;
+    std::cout << "Bus reads:     " << transactions[BusRd] << std::endl;
+    std::cout << "Bus readXs:    " << transactions[BusRdX] << std::endl;
+    std::cout << "Bus upgrades:  " << transactions[BusUpgr] << std::endl;
+    std::cout << "Bus snoops:    " << snoops << std::endl;
+    std::cout << "Bus cache-to-cache transfers: " << cacheToCache << std::endl;
+    std::cout << "Bus reads from below:         " << memoryReads << std::endl;
+    std::cout << "Bus writebacks:               " << writebacksSent << std::endl;
+    for (int from = 0; from < 5; from++) {
+        for (int to = 0; to < 5; to++) {
+            if (transitions[from][to] == 0) continue;
+            std::cout << "Bus " << getStateName((LineState)from) << "->";
+            std::cout << getStateName((LineState)to) << ": " << transitions[from][to];
+            std::cout << " (" << transitionBytes[from][to] << " bytes)" << std::endl;
+        }
+    }
+    for (auto port : ports) {
+        delete port;
+    }
+}
+
+bool SnoopingBus::request(int core, Transaction type, uint64_t line_address,
+                          int request_id)
+{
+    // A read may go below, so there has to be room there before anyone is
+    // snooped.
+    if (busyLines.count(line_address) || writebackQueued(line_address) ||
+        (type != BusUpgr && !memSide.checkCredit())) {
+        DPRINT("Bus is busy with the line");
+        return ports[core]->reject();
+    }
+    std::vector<int> targets;
+    if (!lookup(core, line_address, targets)) {
+        return ports[core]->reject();
+    }
+    transactions[type]++;
+
+    bool shared = false;
+    bool supplied = false;
+    bool flush = false;
+    std::vector<uint8_t> data(lineSize);
+    std::vector<int> holders;
+    for (int i : targets) {
+        assert(i != core);
+        snoops++;
+        if (caches[i]->snoop(type, line_address, data.data(), supplied, flush)) {
+            shared = true;
+            holders.push_back(i);
+        }
+    }
+    if (flush) {
+        // Memory gets the dirty line before anything else about it, and
+        // nobody may write it without asking until it has.
+        queueWriteback(line_address, data.data());
+        shared = true;
+    }
+
+    busyLines.insert(line_address);
+    if (type == BusUpgr || supplied) {
+        if (supplied) {
+            cacheToCache++;
+        }
+        update(core, type, line_address, holders);
+        schedule(latency + lookupLatency, [this, core, request_id, line_address, type, data, shared]{
+            finish(core, request_id, line_address, type == BusUpgr ? nullptr : data.data(), shared);
+        });
+        return true;
+    }
+
+    // Nobody supplied it, so the snoops only dropped clean copies and it is
+    // fine if the level below turns the read away now.
+    int tag = nextTag++;
+    reads[tag] = {core, request_id, line_address, shared, {}};
+    sendingTag = tag;
+    bool sent = memSide.receiveRequest(line_address, lineSize, nullptr, tag);
+    sendingTag = -1;
+    if (!sent) {
+        reads.erase(tag);
+        busyLines.erase(line_address);
+        return ports[core]->reject();
+    }
+    memoryReads++;
+    update(core, type, line_address, holders);
+    if (!reads[tag].early.empty()) {
+        std::vector<uint8_t> line = reads[tag].early;
+        receiveResponse(tag, line.data());
+    }
+    return true;
+}
+
+void SnoopingBus::transition(LineState from, LineState to, int bytes)
+{
+    transitions[from][to]++;
+    transitionBytes[from][to] += bytes;
+}
+
+void SnoopingBus::receiveResponse(int request_id, const uint8_t* data)
+{
+    auto it = reads.find(request_id);
+    assert(it != reads.end());
+    if (request_id == sendingTag) {
+        // Finished once request() is done with the transaction
+        it->second.early.assign(data, data + lineSize);
+        return;
+    }
+    Read read = it->second;
+    reads.erase(it);
+    if (lookupLatency == 0) {
+        finish(read.core, read.requestId, read.lineAddress, data, read.shared);
+        return;
+    }
+    // The lookup happened before the read went below, so it adds up.
+    std::vector<uint8_t> line(data, data + lineSize);
+    schedule(lookupLatency, [this, read, line]{
+        finish(read.core, read.requestId, read.lineAddress, line.data(), read.shared);
+    });
+}
+
+void SnoopingBus::receiveRetry()
+{
+    kick();
+    retryAll();
+}
+
+int SnoopingBus::receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                                   bool& dirty)
+{
+    int invalidated = 0;
+    for (auto cache : caches) {
+        invalidated += cache->receiveInvalidate(address, size, data, dirty);
+    }
+    // Queued writebacks are newer than the level below's copy too.
+    for (auto it = writebacks.begin(); it != writebacks.end();) {
+        if (it->address >= address && it->address < address + size) {
+            memcpy(&data[it->address - address], it->data.data(), lineSize);
+            dirty = true;
+            it = writebacks.erase(it);
+        } else {
+            it++;
+        }
+    }
+    return invalidated;
+}
+
+bool SnoopingBus::lookup(int core, uint64_t line_address,
+                         std::vector<int>& targets)
+{
+    for (int i = 0; i < (int)caches.size(); i++) {
+        if (i != core) {
+            targets.push_back(i);
+        }
+    }
+    return true;
+}
+
+int SnoopingBus::getCore(int request_id)
+{
+    if (request_id < 0) return drainingCore;
+    auto it = reads.find(request_id);
+    return it != reads.end() ? it->second.core : -1;
+}
+
+void SnoopingBus::queueWriteback(uint64_t line_address, const uint8_t* data,
+                                 int core)
+{
+    writebacks.push_back({line_address, std::vector<uint8_t>(data, data + lineSize), core});
+    kick();
+}
+
+bool SnoopingBus::Port::receiveRequest(uint64_t address, int size,
+                                       const uint8_t* data, int request_id)
+{
+    // Only dirty lines from the writeback buffer come through here.
+    assert(data && request_id < 0 && size == bus.lineSize);
+    return bus.writeback(core, address, data);
+}
+
+bool SnoopingBus::writeback(int core, uint64_t address, const uint8_t* data)
+{
+    if (writebacks.size() >= writebackEntries) {
+        DPRINT("Bus writeback queue is full!");
+        return ports[core]->reject();
+    }
+    queueWriteback(address, data, core);
+    writtenBack(core, address);
+    return true;
+}
+
+bool SnoopingBus::writebackQueued(uint64_t line_address)
+{
+    for (auto& writeback : writebacks) {
+        if (writeback.address == line_address) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SnoopingBus::finish(int core, int request_id, uint64_t line_address,
+                         const uint8_t* data, bool shared)
+{
+    caches[core]->complete(request_id, data, shared);
+    busyLines.erase(line_address);
+    retryAll();
+}
+
+void SnoopingBus::retryAll()
+{
+    for (auto port : ports) {
+        port->retry();
+    }
+}
+
+void SnoopingBus::kick()
+{
+    if (drainScheduled || writebacks.empty()) return;
+    drainScheduled = true;
+    schedule(0, [this]{ drain(); });
+}
+
+void SnoopingBus::drain()
+{
+    drainScheduled = false;
+    if (writebacks.empty()) return;
+
+    Writeback& writeback = writebacks.front();
+    drainingCore = writeback.core;
+    bool sent = memSide.receiveEviction(writeback.address, lineSize,
+                                        writeback.data.data(), true);
+    drainingCore = -1;
+    if (!sent) {
+        return; // Wait for a retry
+    }
+    writebacks.pop_front();
+    writebacksSent++;
+    retryAll();
+
+    if (!writebacks.empty()) {
+        drainScheduled = true;
+        schedule(1, [this]{ drain(); });
+    }
+}
+
+const char* SnoopingBus::getStateName(LineState state)
+{
+    const char* names[] = {"I", "S", "E", "O", "M"};
+    return names[state];
+}
@@ -0,0 +1,273 @@
+
+#ifndef CSIM_SNOOPING_BUS_H
+#define CSIM_SNOOPING_BUS_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "port.hh"
+#include "ticked_object.hh"
+
+class CoherentCache;
+
+/**
+ * A bus that keeps the private caches of several cores coherent (MESI, or
+ * MOESI with an Owned state) and connects them to the level below.
+ *
+ * A cache that misses, or that wants to write a line it shares, asks the
+ * bus for the line (request()). The bus snoops every other cache at once:
+ * they give up or share their copies, and a cache with the line Modified,
+ * Owned or Exclusive sends it straight over (a cache-to-cache transfer)
+ * instead of the level below. Under MESI a Modified line that becomes
+ * Shared is also written back; under MOESI it becomes Owned and stays
+ * dirty. Requests for a line wait until the bus is done with it, so every
+ * line's transactions happen one at a time.
+ *
+ * Writebacks from the caches go below through a queue in the bus, in the
+ * order they happened, and a line is not read from below while a writeback
+ * of it is queued. Lines in a cache's writeback buffer are snooped too.
+ *
+ * Subclasses can snoop fewer caches (see lookup() and update()).
+ */
+class SnoopingBus : public TickedObject, public RequestPort
+{
+  public:
+    enum Protocol {
+        MESI,
+        MOESI
+    };
+
+    enum Transaction {
+        /// Read a line to share it
+        BusRd,
+        /// Read a line to write it: every other copy is invalidated
+        BusRdX,
+        /// Invalidate every other copy of a line this cache shares
+        BusUpgr
+    };
+
+    enum LineState {
+        Invalid,
+        Shared,
+        Exclusive,
+        Owned,
+        Modified
+    };
+
+    /**
+     * @param cores is the number of private caches
+     * @param line_size is the size of a line in bytes
+     * @param mem_side is the level below every private cache
+     * @param latency is how many ticks a transaction that stays on the bus
+     *        (an upgrade or a cache-to-cache transfer) takes
+     */
+    SnoopingBus(int cores, int line_size, ResponsePort& mem_side,
+                Protocol protocol = MESI, int latency = 4);
+
+    ~SnoopingBus() override;
+
+    /**
+     * @return the port a core's cache sends its writebacks to
+     */
+    ResponsePort& getPort(int core) { return *ports[core]; }
+
+    void setCache(int core, CoherentCache* cache) { caches[core] = cache; }
+
+    Protocol getProtocol() { return protocol; }
+
+    /**
+     * Start a transaction for a core's cache. The cache's complete() is
+     * called when it is done.
+     *
+     * @return false if the bus cannot take it now. The cache gets a retry
+     *         through its port.
+     */
+    bool request(int core, Transaction type, uint64_t line_address,
+                 int request_id);
+
+    /**
+     * Count a cache's line moving from one state to another, and the bytes
+     * that moved on the bus because of it.
+     */
+    void transition(LineState from, LineState to, int bytes);
+
+    void receiveResponse(int request_id, const uint8_t* data) override;
+
+    void receiveRetry() override;
+
+    /**
+     * An inclusive level below drops a line from every private cache.
+     */
+    int receiveInvalidate(uint64_t address, int size, uint8_t* data,
+                          bool& dirty) override;
+
+    /**
+     * @return the core a read below is for, or for a negative id the core
+     *         whose writeback is being sent (-1 if the line was flushed by
+     *         a snoop)
+     */
+    int getCore(int request_id) override;
+
+  protected:
+    /**
+     * Find the caches a core's transaction has to snoop. A bus snoops every
+     * other cache.
+     *
+     * @param targets is filled with the cores to snoop
+     * @return false if the transaction cannot start now. The core gets a
+     *         retry.
+     */
+    virtual bool lookup(int core, uint64_t line_address,
+                        std::vector<int>& targets);
+
+    /**
+     * Called after a transaction's snoops, once it is sure to go ahead.
+     *
+     * @param holders are the snooped cores that still have a copy
+     */
+    virtual void update(int core, Transaction type, uint64_t line_address,
+                        const std::vector<int>& holders) {}
+
+    /**
+     * Called when a core writes back a dirty line it evicted.
+     */
+    virtual void writtenBack(int core, uint64_t line_address) {}
+
+    /**
+     * Queue a dirty line to be written below.
+     *
+     * @param core is the core that evicted it, -1 if there is none
+     */
+    void queueWriteback(uint64_t line_address, const uint8_t* data,
+                        int core = -1);
+
+    /**
+     * @return true if a transaction for the line is in progress
+     */
+    bool isBusy(uint64_t line_address) { return busyLines.count(line_address); }
+
+    int lineSize;
+
+    std::vector<CoherentCache*> caches;
+
+    /// Ticks to find out who to snoop, added to every transaction
+    int lookupLatency;
+
+  private:
+    /**
+     * A core's connection to the bus. Only writebacks come through it.
+     */
+    class Port : public ResponsePort
+    {
+      public:
+        Port(SnoopingBus& bus, int core) :
+            ResponsePort(1), bus(bus), core(core) {}
+
+        bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                            int request_id) override;
+
+        bool reject() { return refuse(); }
+
+        void retry() { sendRetry(); }
+
+      private:
+        SnoopingBus& bus;
+        int core;
+    };
+
+    struct Writeback
+    {
+        uint64_t address;
+        std::vector<uint8_t> data;
+        int core;
+    };
+
+    /// A read sent below, by the tag it was sent with
+    struct Read
+    {
+        int core;
+        int requestId;
+        uint64_t lineAddress;
+        bool shared;
+
+        /// The line, if it came back before the read was known to be taken
+        std::vector<uint8_t> early;
+    };
+
+    /**
+     * Queue a writeback from a core's cache.
+     */
+    bool writeback(int core, uint64_t address, const uint8_t* data);
+
+    /**
+     * @return true if a writeback of the line is queued
+     */
+    bool writebackQueued(uint64_t line_address);
+
+    /**
+     * Hand a transaction's line to its cache and let the next one for the
+     * line go.
+     */
+    void finish(int core, int request_id, uint64_t line_address,
+                const uint8_t* data, bool shared);
+
+    /**
+     * Tell every core that was turned away to try again.
+     */
+    void retryAll();
+
+    void kick();
+
+    /**
+     * Send queued writebacks below, one per tick.
+     */
+    void drain();
+
+    static const char* getStateName(LineState state);
+
+    ResponsePort& memSide;
+
+    Protocol protocol;
+
+    int latency;
+
+    std::vector<Port*> ports;
+
+    /// Lines with a transaction in progress
+    std::set<uint64_t> busyLines;
+
+    /// Reads waiting for the level below
+    std::map<int, Read> reads;
+
+    int nextTag;
+
+    /// The tag of the read being sent, -1 if there is none
+    int sendingTag;
+
+    /// Writebacks waiting to go below, oldest first
+    std::deque<Writeback> writebacks;
+
+    /// Writebacks from the caches that can wait before they are refused
+    static const size_t writebackEntries = 8;
+
+    bool drainScheduled;
+
+    /// The core of the writeback being sent below, -1 between writebacks
+    int drainingCore;
+
+    int64_t transactions[3];
+    /// Caches asked about a line
+    int64_t snoops;
+    int64_t cacheToCache;
+    int64_t memoryReads;
+    int64_t writebacksSent;
+
+    /// Transitions and the bytes they moved, by from and to state
+    int64_t transitions[5][5];
+    int64_t transitionBytes[5][5];
+};
+
+#endif // CSIM_SNOOPING_BUS_H
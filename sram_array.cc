@@ -2,7 +2,7 @@
 #include "sram_array.hh"
 
 SRAMArray::SRAMArray(int64_t lines, int line_bytes) :
-    lines(lines), lineBytes(line_bytes)
+    lines(lines), lineBytes(line_bytes), physicalSize(lines * line_bytes)
 {
     data.resize(lines * lineBytes);
 
@@ -16,7 +16,13 @@ uint8_t* SRAMArray::getLine(int index)
 
 int64_t SRAMArray::getSize()
 {
-    return lines * lineBytes;
+    return physicalSize;
+}
+
+void SRAMArray::setPhysicalSize(int64_t bytes)
+{
+    totalSize += bytes - physicalSize;
+    physicalSize = bytes;
 }
 
 int64_t SRAMArray::getTotalSize()
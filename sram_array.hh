@@ -11,6 +11,9 @@ class SRAMArray
     int64_t lines;
     int lineBytes;
 
+    /// Bytes the hardware would have, see setPhysicalSize()
+    int64_t physicalSize;
+
     std::vector<uint8_t> data;
 
     /// Sum of the size of all SRAM arrays.
@@ -33,6 +36,12 @@ class SRAMArray
      */
     int64_t getSize();
 
+    /**
+     * Count only this many bytes as SRAM, for arrays that hold more than
+     * the hardware would (e.g., uncompressed copies of compressed lines).
+     */
+    void setPhysicalSize(int64_t bytes);
+
     /**
      * Returns the total size of all SRAM arrays.
      */
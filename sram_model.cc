@@ -0,0 +1,60 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "sram_model.hh"
+#include "util.hh"
+
+/// Length of a tick in ns (2GHz)
+static const double tickTime = 0.5;
+
+/// Decoder and sense amplifier time, and wire time per sqrt(KB) of bank
+static const double fixedTime = 0.2;
+static const double wireTime = 0.12;
+
+/// Time to compare the tags of each doubling of the ways
+static const double compareTime = 0.04;
+
+/// Energy to read a bit, and extra per sqrt(KB) of bank for the wires
+static const double bitEnergy = 0.008;
+static const double wireEnergy = 0.001;
+
+/// Leakage of a KB of SRAM in mW
+static const double leakagePerKB = 0.12;
+
+SRAMModel::SRAMModel(int64_t size, int line_size, int ways, int banks,
+                     int addr_size, int tag_factor)
+{
+    assert(ways > 0 && banks > 0 && tag_factor > 0);
+    int64_t lines = size / line_size * tag_factor;
+    int64_t sets = lines / (ways * tag_factor);
+    int tag_bits = addr_size - log2int(sets) - log2int(line_size) + 2; // Plus state
+
+    double data_kb = (double)size / banks / 1024;
+    double tag_kb = (double)lines * tag_bits / 8 / banks / 1024;
+
+    tagTime = fixedTime + wireTime * sqrt(tag_kb) + compareTime * log2(ways * tag_factor);
+    dataTime = fixedTime + wireTime * sqrt(data_kb);
+
+    // Every way of the set is read in parallel.
+    tagEnergy = ways * tag_factor * tag_bits * (bitEnergy + wireEnergy * sqrt(tag_kb));
+    dataEnergy = ways * line_size * 8 * (bitEnergy + wireEnergy * sqrt(data_kb));
+
+    leakage = leakagePerKB * (data_kb + tag_kb) * banks;
+}
+
+int SRAMModel::getTagLatency()
+{
+    return std::max(1, (int)ceil(tagTime / tickTime));
+}
+
+int SRAMModel::getDataLatency()
+{
+    return std::max(1, (int)ceil(dataTime / tickTime));
+}
+
+double SRAMModel::getLeakageEnergy()
+{
+    return leakage * tickTime; // mW * ns = pJ
+}
@@ -0,0 +1,71 @@
+
+#ifndef CSIM_SRAM_MODEL_H
+#define CSIM_SRAM_MODEL_H
+
+#include <cstdint>
+
+/**
+ * A rough analytical model of a cache's SRAM arrays, in the spirit of
+ * CACTI but much simpler. From the geometry of the cache it estimates the
+ * time to read the tags and the data, the energy of each, and the leakage
+ * power.
+ *
+ * Wire delay and energy grow with the square root of the bank size and
+ * reading a set reads every way. The constants are loosely based on a
+ * 32nm process at 2GHz (one tick is one cycle). The numbers are meant for
+ * comparing design points against each other, not as absolute values.
+ */
+class SRAMModel
+{
+  public:
+    /**
+     * @param size is the size of the data array in bytes
+     * @param line_size is the size of a line in bytes
+     * @param ways is the number of ways (1 for direct mapped)
+     * @param banks is the number of banks the arrays are split into
+     * @param addr_size is the number of bits in the address
+     * @param tag_factor is the number of tags per way (e.g., compressed)
+     */
+    SRAMModel(int64_t size, int line_size, int ways, int banks, int addr_size,
+              int tag_factor = 1);
+
+    /**
+     * @return the ticks it takes to read the tags, at least 1
+     */
+    int getTagLatency();
+
+    /**
+     * @return the ticks it takes to read the data after the tags, at
+     *         least 1
+     */
+    int getDataLatency();
+
+    /**
+     * @return the energy of a tag lookup in pJ
+     */
+    double getTagEnergy() { return tagEnergy; }
+
+    /**
+     * @return the energy of reading or writing the data in pJ
+     */
+    double getDataEnergy() { return dataEnergy; }
+
+    /**
+     * @return the leakage energy in pJ for each tick
+     */
+    double getLeakageEnergy();
+
+  private:
+    /// Access times in ns
+    double tagTime;
+    double dataTime;
+
+    /// Energy per access in pJ
+    double tagEnergy;
+    double dataEnergy;
+
+    /// Leakage power in mW
+    double leakage;
+};
+
+#endif // CSIM_SRAM_MODEL_H
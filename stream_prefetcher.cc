@@ -0,0 +1,93 @@
+
+#include <cassert>
+
+#include "stream_prefetcher.hh"
+#include "util.hh"
+
+StreamPrefetcher::StreamPrefetcher(int line_size, int streams, int depth) :
+    Prefetcher(line_size, depth, streams * depth), streams(streams),
+    useCounter(0)
+{
+    assert(streams > 0);
+    for (auto& stream : this->streams) {
+        stream.valid = false;
+    }
+}
+
+StreamPrefetcher::Stream* StreamPrefetcher::findStream(int64_t line)
+{
+    for (auto& stream : streams) {
+        if (!stream.valid) continue;
+        int64_t distance = line - stream.lastLine;
+        if (!stream.trained) {
+            // Close enough to tell which way the stream is going
+            if (distance != 0 && distance >= -2 && distance <= 2) {
+                return &stream;
+            }
+        }
+        else {
+            // Anywhere in the window the stream has prefetched
+            distance *= stream.direction;
+            if (distance > 0 && distance <= degree) {
+                return &stream;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void StreamPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    // Hits to lines that were already here say nothing about streams.
+    if (hit && !prefetched) return;
+
+    int64_t line = address >> lineBits;
+    Stream* stream = findStream(line);
+    if (stream) {
+        if (!stream->trained) {
+            stream->trained = true;
+            stream->direction = line > stream->lastLine ? 1 : -1;
+            stream->nextPrefetch = line + stream->direction;
+            DPRINT("Stream found at line 0x" << std::hex << line << std::dec
+                   << " going " << (stream->direction > 0 ? "up" : "down"));
+        }
+        stream->lastLine = line;
+        stream->lastUse = ++useCounter;
+        advance(*stream);
+        return;
+    }
+
+    if (hit) return;
+
+    // Start a new stream in place of an empty or the LRU one.
+    Stream* victim = &streams[0];
+    for (auto& candidate : streams) {
+        if (!candidate.valid) {
+            victim = &candidate;
+            break;
+        }
+        if (candidate.lastUse < victim->lastUse) {
+            victim = &candidate;
+        }
+    }
+    victim->valid = true;
+    victim->trained = false;
+    victim->lastLine = line;
+    victim->direction = 1;
+    victim->nextPrefetch = line + 1;
+    victim->lastUse = ++useCounter;
+}
+
+void StreamPrefetcher::advance(Stream& stream)
+{
+    int64_t last = stream.lastLine + stream.direction * degree;
+    // Skip ahead if accesses ran past what was prefetched.
+    if ((stream.nextPrefetch - stream.lastLine) * stream.direction <= 0) {
+        stream.nextPrefetch = stream.lastLine + stream.direction;
+    }
+    while ((last - stream.nextPrefetch) * stream.direction >= 0) {
+        if (stream.nextPrefetch < 0) break; // Ran off the bottom of memory
+        queuePrefetch((uint64_t)stream.nextPrefetch << lineBits);
+        stream.nextPrefetch += stream.direction;
+    }
+}
@@ -0,0 +1,73 @@
+
+#ifndef CSIM_STREAM_PREFETCHER_H
+#define CSIM_STREAM_PREFETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "prefetcher.hh"
+
+/**
+ * Tracks several sequential streams at once, in the spirit of multi-way
+ * stream buffers. The prefetched lines go into the cache itself rather
+ * than into separate buffers.
+ *
+ * A miss that does not belong to a stream starts a new one (replacing the
+ * least recently used stream). A second miss one or two lines away sets
+ * the direction, up or down. From then on every access that lands in the
+ * stream's window moves it along and keeps the next `depth` lines on their
+ * way. The depth is the prefetcher's degree.
+ */
+class StreamPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param streams is the number of streams tracked at once
+     * @param depth is how many lines each stream runs ahead
+     */
+    StreamPrefetcher(int line_size, int streams = 4, int depth = 4);
+
+  protected:
+    /**
+     * The degree is the depth: how far each stream runs ahead.
+     */
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+  private:
+    struct Stream
+    {
+        bool valid;
+
+        /// False until the direction is known
+        bool trained;
+
+        /// Line number (address / line size) of the last access
+        int64_t lastLine;
+
+        /// +1 for ascending addresses, -1 for descending
+        int direction;
+
+        /// The next line this stream has not prefetched yet
+        int64_t nextPrefetch;
+
+        /// For LRU replacement of streams
+        int64_t lastUse;
+    };
+
+    /**
+     * @return the stream that the line belongs to, or nullptr
+     */
+    Stream* findStream(int64_t line);
+
+    /**
+     * Prefetch up to depth lines past the last access of the stream.
+     */
+    void advance(Stream& stream);
+
+    std::vector<Stream> streams;
+
+    int64_t useCounter;
+};
+
+#endif // CSIM_STREAM_PREFETCHER_H
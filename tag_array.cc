@@ -4,16 +4,20 @@
 
 #include "tag_array.hh"
 
-TagArray::TagArray(int lines, int state_bits, int tag_bits) :
-    lines(lines), stateBits(state_bits), tagBits(tag_bits)
+TagArray::TagArray(int lines, int state_bits, int tag_bits, int sectors) :
+    lines(lines), stateBits(state_bits), tagBits(tag_bits), sectors(sectors)
 {
     assert(stateBits <= 32);
     assert(tagBits <= 64);
 
     assert(lines > 0);
+    assert(sectors > 0);
 
     tags.resize(lines, 0);
     states.resize(lines, 0);
+    if (sectors > 1) {
+        sectorStates.resize(lines * sectors, 0);
+    }
 
     totalSize += getSize();
 }
@@ -46,9 +50,35 @@ void TagArray::setState(int line, uint32_t state)
     states[line] = state;
 }
 
+uint32_t TagArray::getSectorState(int line, int sector)
+{
+    assert(line >= 0 && line < lines);
+    assert(sector >= 0 && sector < sectors && sectors > 1);
+    return sectorStates[line * sectors + sector];
+}
+
+void TagArray::setSectorState(int line, int sector, uint32_t state)
+{
+    assert(line >= 0 && line < lines);
+    assert(sector >= 0 && sector < sectors && sectors > 1);
+    uint64_t state_mask = ((uint64_t)-1) >> (64 - stateBits);
+    assert((state & state_mask) == state);
+    sectorStates[line * sectors + sector] = state;
+}
+
+void TagArray::setTagBits(int tag_bits)
+{
+    assert(tag_bits <= 64);
+    totalSize -= getSize();
+    tagBits = tag_bits;
+    totalSize += getSize();
+}
+
 int64_t TagArray::getSize()
 {
-    int64_t bits = (stateBits + tagBits) * tags.size();
+    // With sectors, the line state can be worked out from the sector
+    // states, so only those count.
+    int64_t bits = (stateBits * sectors + tagBits) * tags.size();
     return bits/8;
 }
 
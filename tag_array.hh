@@ -12,8 +12,10 @@ class TagArray
      * Allocates the tag and state data. All data defaults to 0
      *
      * @param lines that are in the tag array
+     * @param sectors is the number of sectors per line. With more than
+     *        one, each sector has its own state_bits of state as well.
      */
-    TagArray(int lines, int state_bits, int tag_bits);
+    TagArray(int lines, int state_bits, int tag_bits, int sectors = 1);
 
     /**
      * @return a pointer to the bits that correspond to the tag for the given
@@ -37,6 +39,22 @@ class TagArray
      */
     void setState(int line, uint32_t state);
 
+    /**
+     * @return the state of one sector of the line
+     */
+    uint32_t getSectorState(int line, int sector);
+
+    /**
+     * Sets the state of one sector of the line.
+     */
+    void setSectorState(int line, int sector, uint32_t state);
+
+    /**
+     * Change the number of bits in a tag. Must be called before any tag
+     * is set.
+     */
+    void setTagBits(int tag_bits);
+
     /**
      * Return the size in bytes.
      */
@@ -59,6 +77,11 @@ class TagArray
     /// The storage for the state. Cheating and using more bits that needed.
     std::vector<uint32_t> states;
 
+    int sectors;
+
+    /// The state of each sector, line by line. Empty without sectors.
+    std::vector<uint32_t> sectorStates;
+
     /// Sum of the size of all tag arrays.
     static int64_t totalSize;
 };
@@ -0,0 +1,119 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "temporal_prefetcher.hh"
+#include "util.hh"
+
+/// Bytes per metadata entry: trigger and successor
+static const int entrySize = 8;
+
+/// Line size of the dedicated table
+static const int tableLineSize = 64;
+
+TemporalPrefetcher::TemporalPrefetcher(int line_size, int degree,
+                                       int table_size) :
+    Prefetcher(line_size, degree), table(nullptr), metadataLines(0),
+    metadataLineSize(0), lastLine(0), lookups(0), lookupHits(0), updates(0)
+{
+    if (table_size > 0) {
+        assert(table_size % tableLineSize == 0);
+        table = new SRAMArray(table_size / tableLineSize, tableLineSize);
+        setMetadataStore(table_size / tableLineSize, tableLineSize,
+                         [this](int index) { return table->getLine(index); });
+    }
+}
+
+TemporalPrefetcher::~TemporalPrefetcher()
+{
+    delete table;
+}
+
+void TemporalPrefetcher::setMetadataStore(int lines, int line_size,
+        const std::function<uint8_t*(int)>& get_line)
+{
+    assert(lines > 0);
+    assert(line_size >= entrySize && line_size % entrySize == 0);
+    metadataLines = lines;
+    metadataLineSize = line_size;
+    getMetadataLine = get_line;
+    for (int i = 0; i < lines; i++) {
+        memset(getMetadataLine(i), 0, line_size);
+    }
+}
+
+void TemporalPrefetcher::printStats(const std::string& name)
+{
+    Prefetcher::printStats(name);
+    std::cout << name << " temporal metadata:   ";
+    std::cout << ((float)metadataLines * metadataLineSize)/1024 << "KB";
+    std::cout << (table ? " (table)" : " (cache)") << std::endl;
+    std::cout << name << " temporal lookups:    " << lookups << std::endl;
+    std::cout << name << " temporal hits:       " << lookupHits << std::endl;
+    std::cout << name << " temporal updates:    " << updates << std::endl;
+}
+
+uint8_t* TemporalPrefetcher::findMetadataLine(uint32_t trigger)
+{
+    uint32_t hash = trigger * 2654435761u; // Spread neighbouring lines out
+    return getMetadataLine((hash >> 8) % metadataLines);
+}
+
+uint32_t TemporalPrefetcher::lookup(uint32_t trigger)
+{
+    uint8_t* line = findMetadataLine(trigger);
+    lookups++;
+    for (int offset = 0; offset < metadataLineSize; offset += entrySize) {
+        uint32_t entry[2];
+        memcpy(entry, &line[offset], entrySize);
+        if (entry[0] == trigger) {
+            lookupHits++;
+            return entry[1];
+        }
+    }
+    return 0;
+}
+
+void TemporalPrefetcher::record(uint32_t trigger, uint32_t successor)
+{
+    uint8_t* line = findMetadataLine(trigger);
+    updates++;
+
+    // Entries are in MRU order; the last one falls off if this is new.
+    int found = metadataLineSize - entrySize;
+    for (int offset = 0; offset < metadataLineSize; offset += entrySize) {
+        uint32_t entry_trigger;
+        memcpy(&entry_trigger, &line[offset], sizeof(entry_trigger));
+        if (entry_trigger == trigger || entry_trigger == 0) {
+            found = offset;
+            break;
+        }
+    }
+    memmove(&line[entrySize], line, found);
+    uint32_t entry[2] = { trigger, successor };
+    memcpy(line, entry, entrySize);
+}
+
+void TemporalPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    // Trained on the miss stream. A prefetched line would have been a miss.
+    if (hit && !prefetched) return;
+    assert(metadataLines > 0);
+
+    uint32_t line = (address >> lineBits) + 1;
+    if (lastLine != 0 && lastLine != line) {
+        record(lastLine, line);
+    }
+    lastLine = line;
+
+    // Follow the chain of successors.
+    uint32_t next = line;
+    for (int i = 0; i < degree; i++) {
+        next = lookup(next);
+        if (next == 0 || next == line) break;
+        DPRINT("Temporal prefetcher predicts line 0x" << std::hex
+               << ((uint64_t)(next - 1) << lineBits) << std::dec);
+        queuePrefetch((uint64_t)(next - 1) << lineBits);
+    }
+}
@@ -0,0 +1,88 @@
+
+#ifndef CSIM_TEMPORAL_PREFETCHER_H
+#define CSIM_TEMPORAL_PREFETCHER_H
+
+#include <cstdint>
+#include <functional>
+
+#include "prefetcher.hh"
+#include "sram_array.hh"
+
+/**
+ * Temporal prefetcher for irregular (e.g., pointer chasing) access
+ * patterns, in the style of ISB and Triage.
+ *
+ * Each miss (or first use of a prefetched line) records that it followed
+ * the previous one, as a pair of line numbers in a metadata store. A miss
+ * then looks up its successor, and that line's successor, and so on, to
+ * prefetch `degree` lines. The traces have no PC, so there is a single
+ * global stream of misses rather than one per instruction.
+ *
+ * The metadata lives in lines of 8-byte entries (4-byte trigger, 4-byte
+ * successor). A trigger hashes to one line, whose entries are kept in
+ * most recently used order. The lines come from either a dedicated table
+ * owned by the prefetcher, or a partition of the last level cache (see
+ * setMetadataStore()), in which case the cache loses that capacity.
+ */
+class TemporalPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of successors to follow on each miss
+     * @param table_size is the size of the dedicated metadata table in
+     *        bytes, or 0 if setMetadataStore() will be called
+     */
+    TemporalPrefetcher(int line_size, int degree = 1, int table_size = 16384);
+
+    ~TemporalPrefetcher();
+
+    /**
+     * Keep the metadata somewhere else (e.g., ways of the LLC) instead of
+     * the dedicated table.
+     *
+     * @param lines is the number of metadata lines
+     * @param line_size is the size of each metadata line in bytes
+     * @param get_line returns the data of a metadata line
+     */
+    void setMetadataStore(int lines, int line_size,
+                          const std::function<uint8_t*(int)>& get_line);
+
+    void printStats(const std::string& name) override;
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+  private:
+    /**
+     * @return the metadata line that holds this trigger
+     */
+    uint8_t* findMetadataLine(uint32_t trigger);
+
+    /**
+     * @return the successor of the line, or 0 if there is none
+     */
+    uint32_t lookup(uint32_t trigger);
+
+    /**
+     * Record that successor followed trigger.
+     */
+    void record(uint32_t trigger, uint32_t successor);
+
+    /// Dedicated table, nullptr if the metadata is kept elsewhere
+    SRAMArray* table;
+
+    int metadataLines;
+    int metadataLineSize;
+    std::function<uint8_t*(int)> getMetadataLine;
+
+    /// The last line that missed, 0 if none yet. Line numbers are stored
+    /// plus one so that 0 can mean empty.
+    uint32_t lastLine;
+
+    int64_t lookups;
+    int64_t lookupHits;
+    int64_t updates;
+};
+
+#endif // CSIM_TEMPORAL_PREFETCHER_H
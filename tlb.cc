@@ -0,0 +1,65 @@
+
+#include <cassert>
+#include <iostream>
+
+#include "tlb.hh"
+
+TLB::TLB(int entries, int ways) :
+    ways(ways), sets(entries / ways), keys(entries, 0), valid(entries, false),
+    lastUse(entries, 0), useCounter(0), accesses(0), misses(0)
+{
+    assert(ways > 0 && sets > 0 && entries % ways == 0);
+}
+
+void TLB::printStats(const std::string& name)
+{
+    std::cout << name << " accesses: " << accesses << std::endl;
+    std::cout << name << " misses:   " << misses << " (";
+    std::cout << (accesses ? 100.0 * misses / accesses : 0) << "%)" << std::endl;
+}
+
+bool TLB::lookup(uint64_t key)
+{
+    accesses++;
+    int entry = find(key);
+    if (entry < 0) {
+        misses++;
+        return false;
+    }
+    lastUse[entry] = ++useCounter;
+    return true;
+}
+
+void TLB::insert(uint64_t key)
+{
+    int entry = find(key);
+    if (entry < 0) {
+        int64_t set = key % sets;
+        entry = set * ways;
+        for (int way = 0; way < ways; way++) {
+            int candidate = set * ways + way;
+            if (!valid[candidate]) {
+                entry = candidate;
+                break;
+            }
+            if (lastUse[candidate] < lastUse[entry]) {
+                entry = candidate;
+            }
+        }
+    }
+    keys[entry] = key;
+    valid[entry] = true;
+    lastUse[entry] = ++useCounter;
+}
+
+int TLB::find(uint64_t key)
+{
+    int64_t set = key % sets;
+    for (int way = 0; way < ways; way++) {
+        int entry = set * ways + way;
+        if (valid[entry] && keys[entry] == key) {
+            return entry;
+        }
+    }
+    return -1;
+}
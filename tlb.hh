@@ -0,0 +1,68 @@
+
+#ifndef CSIM_TLB_H
+#define CSIM_TLB_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A set associative, LRU cache of translations. It only holds tags: the
+ * key is a virtual page number (or, as a page-walk cache, the part of a
+ * virtual address that picks a page-table entry), and the translation
+ * itself comes from the PageTable.
+ */
+class TLB
+{
+  public:
+    /**
+     * @param entries is the number of translations
+     * @param ways is the associativity, entries for fully associative
+     */
+    TLB(int entries, int ways);
+
+    /**
+     * Print the accesses, misses and miss rate.
+     *
+     * @param name is printed before each statistic
+     */
+    void printStats(const std::string& name);
+
+    /**
+     * @return true if the key is here. Counts an access (and a miss).
+     */
+    bool lookup(uint64_t key);
+
+    /**
+     * Add a key, replacing the least recently used one in its set.
+     */
+    void insert(uint64_t key);
+
+    int getEntries() { return keys.size(); }
+
+    int64_t getAccesses() { return accesses; }
+
+    int64_t getMisses() { return misses; }
+
+  private:
+    /**
+     * @return the entry holding the key, -1 if it is not here
+     */
+    int find(uint64_t key);
+
+    int ways;
+    int64_t sets;
+
+    std::vector<uint64_t> keys;
+    std::vector<bool> valid;
+
+    /// When each entry was last used
+    std::vector<int64_t> lastUse;
+
+    int64_t useCounter;
+
+    int64_t accesses;
+    int64_t misses;
+};
+
+#endif // CSIM_TLB_H
@@ -0,0 +1,101 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "util.hh"
+#include "victim_cache.hh"
+
+VictimCache::VictimCache(int entries, int line_size, int addr_size) :
+    numEntries(entries), lineBits(log2int(line_size)),
+    tagArray(entries, 2, addr_size - log2int(line_size)),
+    dataArray(entries, line_size),
+    lastUse(entries, 0), useCounter(0),
+    hits(0), misses(0), inserts(0), writebacks(0)
+{
+}
+
+void VictimCache::printStats(const std::string& name)
+{
+    std::cout << name << " victim cache hits:       " << hits << std::endl;
+    std::cout << name << " victim cache misses:     " << misses << std::endl;
+    std::cout << name << " victim cache inserts:    " << inserts << std::endl;
+    std::cout << name << " victim cache writebacks: " << writebacks << std::endl;
+}
+
+bool VictimCache::probe(uint64_t line_address, uint8_t* data, bool& dirty,
+                        bool demand)
+{
+    uint64_t tag = line_address >> lineBits;
+    for (int i = 0; i < numEntries; i++) {
+        State state = (State)tagArray.getState(i);
+        if ((state == Valid || state == Dirty) && tagArray.getTag(i) == tag) {
+            DPRINT("Hit in victim cache");
+            memcpy(data, dataArray.getLine(i), 1 << lineBits);
+            dirty = state == Dirty;
+            tagArray.setState(i, Invalid);
+            if (demand) {
+                hits++;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VictimCache::makeRoom()
+{
+    int line = findVictim();
+    State state = (State)tagArray.getState(line);
+    if (state != Valid && state != Dirty) return true;
+
+    uint64_t evict_address = tagArray.getTag(line) << lineBits;
+    DPRINT("Victim cache evicting 0x" << std::hex << evict_address << std::dec);
+    assert(evictionCallback);
+    if (!evictionCallback(evict_address, dataArray.getLine(line), state == Dirty)) {
+        return false;
+    }
+    if (state == Dirty) {
+        writebacks++;
+    }
+    tagArray.setState(line, Invalid);
+    return true;
+}
+
+void VictimCache::insert(uint64_t line_address, const uint8_t* data, bool dirty)
+{
+    bool made_room = makeRoom();
+    assert(made_room);
+    (void)made_room;
+
+    int line = findVictim(); // Empty now
+    memcpy(dataArray.getLine(line), data, 1 << lineBits);
+    tagArray.setTag(line, line_address >> lineBits);
+    tagArray.setState(line, dirty ? Dirty : Valid);
+    lastUse[line] = ++useCounter;
+    inserts++;
+}
+
+void VictimCache::getDirtyData(
+        const std::function<void(uint64_t, int, const uint8_t*)>& write)
+{
+    for (int i = 0; i < numEntries; i++) {
+        if (tagArray.getState(i) == Dirty) {
+            write(tagArray.getTag(i) << lineBits, 1 << lineBits, dataArray.getLine(i));
+        }
+    }
+}
+
+int VictimCache::findVictim()
+{
+    int lru = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (tagArray.getState(i) == Invalid) {
+            return i;
+        }
+        if (lastUse[i] < lastUse[lru]) {
+            lru = i;
+        }
+    }
+    return lru;
+}
@@ -0,0 +1,125 @@
+
+#ifndef CSIM_VICTIM_CACHE_H
+#define CSIM_VICTIM_CACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sram_array.hh"
+#include "tag_array.hh"
+
+/**
+ * A small fully associative cache that holds lines evicted from a cache.
+ *
+ * The cache it is attached to probes it on every miss. On a hit the line is
+ * handed back and removed, and the cache's own victim takes its place (a
+ * swap). Lines are replaced in LRU order. Lines that fall out of the
+ * victim cache are handed to the eviction callback.
+ *
+ * Only demand misses count: its hits and misses add up to the misses of
+ * the cache that go below or are swapped back in.
+ */
+class VictimCache
+{
+  public:
+    /**
+     * @param entries is the number of lines
+     * @param line_size is the size of a line in bytes
+     * @param addr_size is the number of bits in the address
+     */
+    VictimCache(int entries, int line_size, int addr_size = 32);
+
+    /**
+     * Print the statistics for this victim cache.
+     *
+     * @param name is printed before each statistic
+     */
+    void printStats(const std::string& name);
+
+    /**
+     * Look for a line and take it out of the victim cache if it is there.
+     * A miss is not counted here, see countMiss().
+     *
+     * @param data is where the line is copied to on a hit
+     * @param dirty is set to true if the line was dirty
+     * @param demand is false for a prefetch or an invalidation, which do
+     *        not count as hits
+     * @return true on a hit
+     */
+    bool probe(uint64_t line_address, uint8_t* data, bool& dirty,
+               bool demand = true);
+
+    /**
+     * Count a demand miss that was not here either, once the level below
+     * has taken the request for it (a refused request is probed again).
+     */
+    void countMiss() { misses++; }
+
+    /**
+     * If the victim cache is full, hand the LRU line to the eviction
+     * callback and drop it.
+     *
+     * @return false if the callback could not take the line, which stays
+     */
+    bool makeRoom();
+
+    /**
+     * Add a line evicted from the cache. The data is copied. If the victim
+     * cache is full the LRU line is replaced and handed to the eviction
+     * callback, which must take it (call makeRoom() first if it may not).
+     */
+    void insert(uint64_t line_address, const uint8_t* data, bool dirty);
+
+    /**
+     * Hand every dirty line to write (see Cache::getDirtyData()).
+     */
+    void getDirtyData(
+            const std::function<void(uint64_t, int, const uint8_t*)>& write);
+
+    /**
+     * @param callback is called with the address, data and dirty bit of
+     *        lines that are replaced. It returns false if it cannot take
+     *        the line yet.
+     */
+    void setEvictionCallback(
+            const std::function<bool(uint64_t, const uint8_t*, bool)>& callback)
+    {
+        evictionCallback = callback;
+    }
+
+  private:
+    enum State {
+        Invalid=0,
+        Valid=1,
+        Invalid2=2,
+        Dirty=3 // Dirty implies valid
+    };
+
+    /**
+     * @return an empty line if there is one, otherwise the LRU line
+     */
+    int findVictim();
+
+    int numEntries;
+    int lineBits;
+
+    TagArray tagArray;
+
+    SRAMArray dataArray;
+
+    /// When each line was last touched, for LRU replacement
+    std::vector<int64_t> lastUse;
+
+    int64_t useCounter;
+
+    std::function<bool(uint64_t, const uint8_t*, bool)> evictionCallback;
+
+    int64_t hits;
+    int64_t misses;
+    int64_t inserts;
+    int64_t writebacks;
+};
+
+#endif // CSIM_VICTIM_CACHE_H
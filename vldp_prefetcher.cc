@@ -0,0 +1,170 @@
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "util.hh"
+#include "vldp_prefetcher.hh"
+
+/// Entries in each delta prediction table
+static const int tableEntries = 64;
+
+VLDPPrefetcher::VLDPPrefetcher(int line_size, int degree, int distance,
+                               int pages) :
+    Prefetcher(line_size, degree), pages(pages),
+    deltaTables(maxHistory, std::vector<Prediction>(tableEntries)),
+    distance(distance), useCounter(0), predictions(maxHistory + 1, 0)
+{
+    assert(distance > 0);
+    assert(pages > 0);
+    assert(line_size < (1 << pageBits));
+    offsetBits = pageBits - lineBits;
+    offsetTable.resize(1 << offsetBits);
+    for (auto& page : this->pages) {
+        page.valid = false;
+    }
+    for (auto& table : deltaTables) {
+        for (auto& entry : table) {
+            entry.valid = false;
+        }
+    }
+    for (auto& entry : offsetTable) {
+        entry.valid = false;
+    }
+}
+
+void VLDPPrefetcher::printStats(const std::string& name)
+{
+    Prefetcher::printStats(name);
+    std::cout << name << " VLDP offset predictions: " << predictions[0]
+              << std::endl;
+    for (int i = 1; i <= maxHistory; i++) {
+        std::cout << name << " VLDP " << i << "-delta predictions: "
+                  << predictions[i] << std::endl;
+    }
+}
+
+VLDPPrefetcher::Prediction& VLDPPrefetcher::lookup(
+        const std::vector<int>& history, int length)
+{
+    assert(length > 0 && length <= (int)history.size());
+    uint64_t hash = 0;
+    for (int i = history.size() - length; i < (int)history.size(); i++) {
+        hash = hash * 31 + (uint64_t)(int64_t)history[i];
+    }
+    return deltaTables[length - 1][hash % tableEntries];
+}
+
+void VLDPPrefetcher::train(const std::vector<int>& history, int delta)
+{
+    for (int length = 1; length <= (int)history.size(); length++) {
+        Prediction& entry = lookup(history, length);
+        std::vector<int> key(history.end() - length, history.end());
+        if (entry.valid && entry.history == key) {
+            if (entry.delta == delta) {
+                if (entry.confidence < 3) entry.confidence++;
+            } else if (--entry.confidence == 0) {
+                entry.delta = delta;
+                entry.confidence = 1;
+            }
+        } else {
+            entry.valid = true;
+            entry.history = key;
+            entry.delta = delta;
+            entry.confidence = 1;
+        }
+    }
+}
+
+int VLDPPrefetcher::predict(const std::vector<int>& history)
+{
+    // Longest matching history first
+    for (int length = history.size(); length > 0; length--) {
+        Prediction& entry = lookup(history, length);
+        if (entry.valid &&
+            std::equal(entry.history.begin(), entry.history.end(),
+                       history.end() - length)) {
+            predictions[length]++;
+            return entry.delta;
+        }
+    }
+    return 0;
+}
+
+void VLDPPrefetcher::notifyAccess(uint64_t address, bool hit, bool prefetched)
+{
+    // Trained on the miss stream. A prefetched line would have been a miss.
+    if (hit && !prefetched) return;
+
+    uint64_t page_number = address >> pageBits;
+    int offset = (address >> lineBits) & ((1 << offsetBits) - 1);
+
+    Page* page = nullptr;
+    Page* victim = &pages[0];
+    for (auto& p : pages) {
+        if (p.valid && p.page == page_number) {
+            page = &p;
+            break;
+        }
+        if (!p.valid || (victim->valid && p.lastUse < victim->lastUse)) {
+            victim = &p;
+        }
+    }
+
+    uint64_t page_address = page_number << pageBits;
+    if (!page) {
+        page = victim;
+        page->valid = true;
+        page->page = page_number;
+        page->lastOffset = offset;
+        page->firstOffset = offset;
+        page->deltas.clear();
+        page->lastUse = ++useCounter;
+
+        // Nothing to go on but where in the page we are.
+        Prediction& entry = offsetTable[offset];
+        int target = offset + entry.delta;
+        if (entry.valid && distance == 1 && target >= 0 &&
+            target < (1 << offsetBits)) {
+            predictions[0]++;
+            queuePrefetch(page_address + ((uint64_t)target << lineBits));
+        }
+        return;
+    }
+    page->lastUse = ++useCounter;
+
+    int delta = offset - page->lastOffset;
+    if (delta == 0) return;
+    page->lastOffset = offset;
+
+    if (page->deltas.empty()) {
+        Prediction& entry = offsetTable[page->firstOffset];
+        entry.valid = true;
+        entry.delta = delta;
+    } else {
+        train(page->deltas, delta);
+    }
+    page->deltas.push_back(delta);
+    if ((int)page->deltas.size() > maxHistory) {
+        page->deltas.erase(page->deltas.begin());
+    }
+
+    // Chain predictions, feeding each back in as history.
+    std::vector<int> history = page->deltas;
+    int target = offset;
+    for (int i = 1; i < distance + degree; i++) {
+        int predicted = predict(history);
+        if (predicted == 0) break;
+        target += predicted;
+        // VLDP does not prefetch across pages.
+        if (target < 0 || target >= (1 << offsetBits)) break;
+        history.push_back(predicted);
+        if ((int)history.size() > maxHistory) {
+            history.erase(history.begin());
+        }
+        if (i < distance) continue;
+        DPRINT("VLDP predicts line 0x" << std::hex
+               << (page_address + ((uint64_t)target << lineBits)) << std::dec);
+        queuePrefetch(page_address + ((uint64_t)target << lineBits));
+    }
+}
@@ -0,0 +1,114 @@
+
+#ifndef CSIM_VLDP_PREFETCHER_H
+#define CSIM_VLDP_PREFETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "prefetcher.hh"
+
+/**
+ * Variable length delta prefetcher (after Shevgoor et al., VLDP).
+ *
+ * Misses are grouped by 4KB page. A delta history buffer keeps, for each
+ * recently missed page, the last offset and the last few deltas between
+ * misses in it. Delta prediction tables are indexed by the last one, two
+ * and three deltas and hold the delta that came next; the longest history
+ * that matches wins. A prediction is pushed onto the history and looked up
+ * again to prefetch more than one line. The first miss to a page has no
+ * deltas, so an offset prediction table maps its offset to the delta
+ * usually seen next.
+ *
+ * As with the GHB prefetcher, the distance is how many predicted lines to
+ * skip before prefetching.
+ */
+class VLDPPrefetcher : public Prefetcher
+{
+  public:
+    /**
+     * @param line_size is the line size of the cache, in bytes
+     * @param degree is the number of lines to prefetch on each miss
+     * @param distance is how far ahead the first prefetch is (1 is the next
+     *        predicted line)
+     * @param pages is the number of pages in the delta history buffer
+     */
+    VLDPPrefetcher(int line_size, int degree = 4, int distance = 1,
+                   int pages = 16);
+
+    void printStats(const std::string& name) override;
+
+  protected:
+    void notifyAccess(uint64_t address, bool hit, bool prefetched) override;
+
+  private:
+    /// Number of delta prediction tables, i.e., the longest history used
+    static const int maxHistory = 3;
+
+    static const int pageBits = 12;
+
+    struct Page
+    {
+        bool valid;
+        uint64_t page;
+
+        /// Offset in lines of the last miss
+        int lastOffset;
+
+        /// Offset of the first miss, until the first delta trains the
+        /// offset prediction table
+        int firstOffset;
+
+        /// Most recent delta last
+        std::vector<int> deltas;
+
+        /// For LRU replacement
+        int64_t lastUse;
+    };
+
+    struct Prediction
+    {
+        bool valid;
+
+        /// The delta history this entry is for, most recent last
+        std::vector<int> history;
+
+        int delta;
+
+        /// 2-bit confidence; replaced when it reaches 0
+        int confidence;
+    };
+
+    /**
+     * @return the table entry for the last `length` deltas in history
+     */
+    Prediction& lookup(const std::vector<int>& history, int length);
+
+    /**
+     * Teach the tables that `delta` followed the deltas in history.
+     */
+    void train(const std::vector<int>& history, int delta);
+
+    /**
+     * @return the predicted next delta, or 0 if there is none
+     */
+    int predict(const std::vector<int>& history);
+
+    std::vector<Page> pages;
+
+    /// deltaTables[n] is indexed by the last n + 1 deltas
+    std::vector<std::vector<Prediction>> deltaTables;
+
+    /// Offset of the first miss to a page -> delta to the second
+    std::vector<Prediction> offsetTable;
+
+    int distance;
+
+    int offsetBits;
+
+    int64_t useCounter;
+
+    /// Predictions by history length (index 0 is the offset table)
+    std::vector<int64_t> predictions;
+};
+
+#endif // CSIM_VLDP_PREFETCHER_H
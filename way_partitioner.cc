@@ -0,0 +1,142 @@
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "way_partitioner.hh"
+
+WayPartitioner::WayPartitioner(int cores, int64_t sets, int ways,
+                               Policy policy, int interval,
+                               int sampled_sets) :
+    cores(cores), ways(ways), policy(policy), interval(interval),
+    sampleStride(std::max<int64_t>(1, sets / sampled_sets)),
+    masks(cores, ways < 64 ? ((uint64_t)1 << ways) - 1 : ~(uint64_t)0),
+    allocations(cores, ways / cores), owners(sets * ways, -1),
+    stackHits(cores, std::vector<int64_t>(ways, 0)), accessCount(0),
+    repartitions(0), allocationSums(cores, 0), accesses(cores, 0),
+    hits(cores, 0)
+{
+    assert(cores > 0 && ways >= cores && interval > 0 && sampled_sets > 0);
+    // The ways that do not divide evenly go to the first cores
+    for (int core = 0; core < ways % cores; core++) {
+        allocations[core]++;
+    }
+    if (policy == Utility) {
+        shadowTags.resize(cores * ((sets + sampleStride - 1) / sampleStride));
+    }
+}
+
+void WayPartitioner::printStats(const std::string& name)
+{
+    std::cout << name << " partitioning: ";
+    if (policy == Static) {
+        std::cout << "static way masks" << std::endl;
+    } else {
+        std::cout << "utility (every " << interval << " accesses, ";
+        std::cout << shadowTags.size() / cores << " sampled sets, ";
+        std::cout << repartitions << " reallocations)" << std::endl;
+    }
+    for (int core = 0; core < cores; core++) {
+        std::cout << name << " core " << core << ": " << accesses[core];
+        std::cout << " accesses, " << (accesses[core] ? 100.0 * hits[core] / accesses[core] : 0);
+        std::cout << "% hits, ";
+        if (policy == Static) {
+            std::cout << "ways 0x" << std::hex << masks[core] << std::dec;
+            std::cout << std::endl;
+            continue;
+        }
+        std::cout << allocations[core] << " ways (";
+        std::cout << (repartitions ? (float)allocationSums[core] / repartitions :
+                                     allocations[core]);
+        std::cout << " on average)" << std::endl;
+    }
+}
+
+void WayPartitioner::setMask(int core, uint64_t mask)
+{
+    assert(policy == Static && mask != 0);
+    assert(ways >= 64 || mask >> ways == 0);
+    masks[core] = mask;
+}
+
+void WayPartitioner::access(int core, int64_t set, uint64_t line_number,
+                            bool hit)
+{
+    assert(core >= 0 && core < cores);
+    accesses[core]++;
+    if (hit) {
+        hits[core]++;
+    }
+    if (policy != Utility) return;
+
+    if (set % sampleStride == 0) {
+        std::vector<uint64_t>& stack =
+            shadowTags[core * (shadowTags.size() / cores) + set / sampleStride];
+        auto it = std::find(stack.begin(), stack.end(), line_number);
+        if (it != stack.end()) {
+            stackHits[core][it - stack.begin()]++;
+            stack.erase(it);
+        } else if ((int)stack.size() == ways) {
+            stack.pop_back(); // The least recently used
+        }
+        stack.insert(stack.begin(), line_number);
+    }
+
+    if (++accessCount == interval) {
+        accessCount = 0;
+        repartition();
+    }
+}
+
+void WayPartitioner::repartition()
+{
+    // Everyone keeps at least a way
+    std::vector<int> next(cores, 1);
+    int balance = ways - cores;
+    while (balance > 0) {
+        // Find the most hits per way that any core can gain, looking past
+        // ways that gain nothing on their own.
+        int winner = 0;
+        int winner_ways = 1;
+        double best = -1;
+        for (int core = 0; core < cores; core++) {
+            int64_t base = getUtility(core, next[core]);
+            for (int extra = 1; extra <= balance; extra++) {
+                double gain = (double)(getUtility(core, next[core] + extra) - base) / extra;
+                if (gain > best) {
+                    best = gain;
+                    winner = core;
+                    winner_ways = extra;
+                }
+            }
+        }
+        if (best <= 0) {
+            // Nobody gains from more ways, so share out the rest
+            for (int core = 0; balance > 0; core = (core + 1) % cores) {
+                next[core]++;
+                balance--;
+            }
+            break;
+        }
+        next[winner] += winner_ways;
+        balance -= winner_ways;
+    }
+    allocations = next;
+
+    repartitions++;
+    for (int core = 0; core < cores; core++) {
+        allocationSums[core] += allocations[core];
+        for (auto& count : stackHits[core]) {
+            count /= 2;
+        }
+    }
+}
+
+int64_t WayPartitioner::getUtility(int core, int core_ways)
+{
+    int64_t utility = 0;
+    for (int position = 0; position < core_ways; position++) {
+        utility += stackHits[core][position];
+    }
+    return utility;
+}
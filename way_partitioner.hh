@@ -0,0 +1,126 @@
+
+#ifndef CSIM_WAY_PARTITIONER_H
+#define CSIM_WAY_PARTITIONER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Shares the ways of a last level cache among the cores above it. Hits can
+ * be in any way, but a miss only replaces a line the core is allowed to.
+ *
+ * With Static partitioning each core has a mask of the ways it may fill
+ * (like Intel's Cache Allocation Technology). Masks may overlap.
+ *
+ * With Utility partitioning (UCP, Qureshi and Patt) each core gets a
+ * number of ways, not particular ones. A core below its share replaces a
+ * line of a core above its share, otherwise one of its own. Every core has
+ * a utility monitor: LRU shadow tags for a sample of the sets, as if the
+ * core had the whole cache, counting the hits at each position of the LRU
+ * stack. Every interval accesses the ways are handed out again, one core
+ * at a time to whoever gains the most hits per way (the lookahead
+ * algorithm), and the counts are halved so that older behavior fades.
+ */
+class WayPartitioner
+{
+  public:
+    enum Policy {
+        Static,
+        Utility
+    };
+
+    /**
+     * Every core starts with an equal share of the ways, or all of them
+     * until setMask() is called for static partitioning.
+     *
+     * @param ways is the number of ways that can be shared
+     * @param interval is the number of accesses between reallocations
+     * @param sampled_sets is the number of sets the monitors watch
+     */
+    WayPartitioner(int cores, int64_t sets, int ways, Policy policy,
+                   int interval = 10000, int sampled_sets = 32);
+
+    /**
+     * Print the policy and every core's accesses, hit rate and ways.
+     *
+     * @param name is printed before each statistic
+     */
+    void printStats(const std::string& name);
+
+    /**
+     * Set the ways a core may fill with static partitioning.
+     */
+    void setMask(int core, uint64_t mask);
+
+    /**
+     * Count a demand access by a core and show it to the core's monitor.
+     *
+     * @param line_number is the address without its offset
+     */
+    void access(int core, int64_t set, uint64_t line_number, bool hit);
+
+    Policy getPolicy() { return policy; }
+
+    int getNumCores() { return cores; }
+
+    uint64_t getMask(int core) { return masks[core]; }
+
+    /**
+     * @return the number of ways the core should have in each set
+     */
+    int getAllocation(int core) { return allocations[core]; }
+
+    /**
+     * @return the core a line was filled for, -1 if it is not known
+     */
+    int getOwner(int line) { return owners[line]; }
+
+    void setOwner(int line, int core) { owners[line] = core; }
+
+  private:
+    /**
+     * Hand out the ways again from the monitors' hit counts.
+     */
+    void repartition();
+
+    /**
+     * @return the hits the core would have had with the given ways
+     */
+    int64_t getUtility(int core, int core_ways);
+
+    int cores;
+    int ways;
+    Policy policy;
+    int interval;
+
+    /// Every sampleStride-th set is watched by the monitors
+    int64_t sampleStride;
+
+    std::vector<uint64_t> masks;
+    std::vector<int> allocations;
+
+    /// Core of every line, by line number in the cache
+    std::vector<int> owners;
+
+    /// Shadow tags of each core, ways per sampled set, most recently used
+    /// first
+    std::vector<std::vector<uint64_t>> shadowTags;
+
+    /// Monitor hits of each core at each LRU stack position
+    std::vector<std::vector<int64_t>> stackHits;
+
+    /// Accesses since the last reallocation
+    int accessCount;
+
+    int64_t repartitions;
+
+    /// Every core's allocations added up at each reallocation, for the
+    /// average
+    std::vector<int64_t> allocationSums;
+
+    std::vector<int64_t> accesses;
+    std::vector<int64_t> hits;
+};
+
+#endif // CSIM_WAY_PARTITIONER_H
@@ -0,0 +1,252 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "util.hh"
+#include "writeback_buffer.hh"
+
+WritebackBuffer::WritebackBuffer(int entries, int line_size, ResponsePort& downstream) :
+    numEntries(entries), lineSize(line_size), downstream(downstream),
+    dataArray(entries, line_size), addresses(entries, 0),
+    dirtyBits(entries, false), validBytes(entries), nextByte(entries, 0),
+    reserved(0), drainScheduled(false), flushing(false), needed(1), inserts(0),
+    readHits(0), fullDrains(0), writes(0), coalesced(0), partialWrites(0)
+{
+    assert(entries > 0);
+    for (int i = entries - 1; i >= 0; i--) {
+        freeSlots.push_back(i);
+    }
+}
+
+void WritebackBuffer::printStats(const std::string& name)
+{
+    std::cout << name << " WB buffer inserts:   " << inserts << std::endl;
+    std::cout << name << " WB buffer read hits: " << readHits << std::endl;
+    std::cout << name << " WB buffer full:      " << fullDrains << std::endl;
+    if (writes > 0 || partialWrites > 0) {
+        std::cout << name << " WB buffer writes:    " << writes << " (";
+        std::cout << coalesced << " coalesced, " << partialWrites;
+        std::cout << " partial lines sent)" << std::endl;
+    }
+}
+
+void WritebackBuffer::insert(uint64_t line_address, const uint8_t* data, bool dirty,
+                             const std::vector<bool>* valid)
+{
+    assert(!valid || (int)valid->size() == lineSize);
+
+    int slot = find(line_address);
+    if (slot >= 0) {
+        // Newer than what is there, so it goes on top
+        coalesced++;
+        nextByte[slot] = 0; // Send the whole entry again
+    }
+    else {
+        assert(!isFull());
+        assert((int)fifo.size() + reserved < numEntries);
+
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        addresses[slot] = line_address;
+        dirtyBits[slot] = false;
+        validBytes[slot].assign(lineSize, false);
+        nextByte[slot] = 0;
+        fifo.push_back(slot);
+        inserts++;
+    }
+
+    uint8_t* line = dataArray.getLine(slot);
+    for (int i = 0; i < lineSize; i++) {
+        if (!valid || (*valid)[i]) {
+            line[i] = data[i];
+            validBytes[slot][i] = true;
+        }
+    }
+    dirtyBits[slot] = dirtyBits[slot] || dirty;
+
+    kick();
+}
+
+void WritebackBuffer::write(uint64_t address, int size, const uint8_t* data)
+{
+    assert(size <= lineSize);
+    uint64_t line_address = address & ~((uint64_t)lineSize - 1);
+    int offset = address - line_address;
+
+    std::vector<uint8_t> line(lineSize);
+    std::vector<bool> valid(lineSize, false);
+    memcpy(&line[offset], data, size);
+    std::fill(valid.begin() + offset, valid.begin() + offset + size, true);
+    writes++;
+    insert(line_address, line.data(), true, &valid);
+}
+
+void WritebackBuffer::reserve()
+{
+    assert(hasSpace());
+    reserved++;
+}
+
+void WritebackBuffer::release()
+{
+    assert(reserved > 0);
+    reserved--;
+    if (spaceCallback) spaceCallback();
+}
+
+void WritebackBuffer::unreserve()
+{
+    assert(reserved > 0);
+    reserved--;
+}
+
+bool WritebackBuffer::remove(uint64_t line_address, uint8_t* data, bool& dirty,
+                             std::vector<bool>* valid)
+{
+    for (auto it = fifo.begin(); it != fifo.end(); it++) {
+        if (addresses[*it] == line_address && (valid || isComplete(*it))) {
+            DPRINT("Hit in writeback buffer");
+            memcpy(data, dataArray.getLine(*it), lineSize);
+            dirty = dirtyBits[*it];
+            if (valid) {
+                *valid = validBytes[*it];
+            }
+            freeSlots.push_back(*it);
+            fifo.erase(it);
+            readHits++;
+            if (spaceCallback) spaceCallback();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WritebackBuffer::hasPartial(uint64_t line_address)
+{
+    int slot = find(line_address);
+    return slot >= 0 && !isComplete(slot);
+}
+
+int WritebackBuffer::find(uint64_t line_address)
+{
+    for (int slot : fifo) {
+        if (addresses[slot] == line_address) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+bool WritebackBuffer::isComplete(int slot)
+{
+    return std::find(validBytes[slot].begin(), validBytes[slot].end(), false) ==
+           validBytes[slot].end();
+}
+
+void WritebackBuffer::getDirtyData(
+        const std::function<void(uint64_t, int, const uint8_t*)>& write)
+{
+    for (int slot : fifo) {
+        if (!dirtyBits[slot]) continue;
+        const std::vector<bool>& valid = validBytes[slot];
+        for (int begin = 0; begin < lineSize;) {
+            int end = begin;
+            while (end < lineSize && valid[end]) end++;
+            if (end > begin) {
+                write(addresses[slot] + begin, end - begin, dataArray.getLine(slot) + begin);
+            }
+            begin = end + 1;
+        }
+    }
+}
+
+void WritebackBuffer::kick(int lines)
+{
+    assert(lines <= numEntries);
+    needed = std::max(needed, lines);
+    if (drainScheduled || fifo.empty()) return;
+    drainScheduled = true;
+    // Wait until the end of this tick so that memory is up to date.
+    schedule(0, [this]{ drain(); });
+}
+
+void WritebackBuffer::flush()
+{
+    flushing = true;
+    kick();
+}
+
+bool WritebackBuffer::drainOne()
+{
+    assert(!fifo.empty());
+    int slot = fifo.front();
+    if (isComplete(slot) && nextByte[slot] == 0) {
+        if (!downstream.receiveEviction(addresses[slot], lineSize,
+                                        dataArray.getLine(slot), dirtyBits[slot])) {
+            return false;
+        }
+    }
+    else {
+        // The biggest aligned store that starts at the next byte there is
+        std::vector<bool>& valid = validBytes[slot];
+        int offset = nextByte[slot];
+        while (offset < lineSize && !valid[offset]) offset++;
+        if (offset < lineSize) {
+            int size = 1;
+            while (size < lineSize && offset % (size * 2) == 0 &&
+                   std::find(valid.begin() + offset, valid.begin() + offset + size * 2,
+                             false) == valid.begin() + offset + size * 2) {
+                size *= 2;
+            }
+            if (!downstream.receiveRequest(addresses[slot] + offset, size,
+                                           dataArray.getLine(slot) + offset, -1)) {
+                return false;
+            }
+            offset += size;
+            while (offset < lineSize && !valid[offset]) offset++;
+        }
+        nextByte[slot] = offset;
+        if (offset < lineSize) return true; // More pieces to go
+        partialWrites++;
+    }
+    fifo.pop_front();
+    freeSlots.push_back(slot);
+    if (spaceCallback) spaceCallback();
+    return true;
+}
+
+void WritebackBuffer::drain()
+{
+    drainScheduled = false;
+    if (hasSpace(needed)) {
+        needed = 1;
+    }
+    if (fifo.empty()) {
+        flushing = false;
+        return;
+    }
+
+    // Only use the channel when nobody else is, unless we do not have the
+    // room someone is waiting for or a line has to get out.
+    if (!downstream.isIdle() && hasSpace(needed) && !flushing) return;
+
+    if (!hasSpace(needed)) {
+        fullDrains++;
+    }
+    if (!drainOne()) return;
+
+    if (hasSpace(needed)) {
+        needed = 1;
+    }
+    if (fifo.empty()) {
+        flushing = false;
+    }
+    else {
+        // One line per tick
+        drainScheduled = true;
+        schedule(1, [this]{ drain(); });
+    }
+}
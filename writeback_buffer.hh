@@ -0,0 +1,225 @@
+
+#ifndef CSIM_WRITEBACK_BUFFER_H
+#define CSIM_WRITEBACK_BUFFER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "port.hh"
+#include "sram_array.hh"
+#include "ticked_object.hh"
+
+/**
+ * A small buffer that holds dirty lines evicted from a cache so that the
+ * cache does not have to wait for memory before filling the new line.
+ * Clean lines go through it too when the level below wants them (e.g., an
+ * exclusive cache).
+ *
+ * Lines are sent to memory in FIFO order, one per tick, whenever memory is
+ * idle. When the buffer is full it drains even if memory is busy.
+ *
+ * A cache that will evict a line later (e.g., when a fill comes back) can
+ * reserve an entry ahead of time so that the eviction never has to wait.
+ *
+ * It is also the write buffer of a write-through or no-write-allocate
+ * cache. An entry can hold only some bytes of a line (stores, or a line
+ * that was never fetched), which are sent on as naturally aligned stores
+ * instead of a whole line. Writes to a line that is already in the buffer
+ * are merged into its entry, so there is at most one entry per line.
+ */
+class WritebackBuffer : public TickedObject
+{
+  public:
+    /**
+     * @param entries is the number of lines the buffer can hold
+     * @param line_size is the size of a line in bytes
+     * @param downstream is where the lines are written back to
+     */
+    WritebackBuffer(int entries, int line_size, ResponsePort& downstream);
+
+    /**
+     * Print the statistics for this buffer.
+     *
+     * @param name is printed before each statistic
+     */
+    void printStats(const std::string& name);
+
+    /**
+     * Add an evicted line to the buffer. The data is copied.
+     * There must be a free (or released) entry, unless the line is already
+     * in the buffer.
+     *
+     * @param dirty is false for a clean line
+     * @param valid marks the bytes of data to keep, nullptr for all of them
+     */
+    void insert(uint64_t line_address, const uint8_t* data, bool dirty = true,
+                const std::vector<bool>* valid = nullptr);
+
+    /**
+     * Add a store that does not go into the cache (write-through or a write
+     * miss that is not allocated). Same rules as insert().
+     */
+    void write(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * Hold an entry for a future insert.
+     * hasSpace() must be true.
+     */
+    void reserve();
+
+    /**
+     * Give back an entry held by reserve(), just before the insert it was
+     * held for (or when no insert is needed after all).
+     */
+    void release();
+
+    /**
+     * Give back an entry held by reserve() for a request that was refused
+     * further down. Unlike release(), nobody is told there is space.
+     */
+    void unreserve();
+
+    /**
+     * Take a line back out of the buffer (e.g., on a read that misses in the
+     * cache but hits in the buffer).
+     *
+     * @param data is where the line is copied to
+     * @param dirty is set to true if the line was dirty
+     * @param valid, if given, takes out a line that is only partly there
+     *        too and is set to the bytes that were there
+     * @return true if the line (the whole line if there is no valid) was
+     *         in the buffer
+     */
+    bool remove(uint64_t line_address, uint8_t* data, bool& dirty,
+                std::vector<bool>* valid = nullptr);
+
+    /**
+     * @return true if the buffer holds part of a line. The line must not be
+     *         fetched until that part has drained (see flush()).
+     */
+    bool hasPartial(uint64_t line_address);
+
+    /**
+     * @return true if any of the line is in the buffer
+     */
+    bool holds(uint64_t line_address) { return find(line_address) >= 0; }
+
+    /**
+     * Hand the bytes of every dirty line to write, oldest first (see
+     * Cache::getDirtyData()).
+     */
+    void getDirtyData(
+            const std::function<void(uint64_t, int, const uint8_t*)>& write);
+
+    /**
+     * Try to drain. Call this when the downstream channel may have become
+     * idle, or when a request was refused for lack of space.
+     *
+     * @param lines is how many free entries the caller is waiting for. The
+     *        buffer drains even while the channel is busy until it has them.
+     */
+    void kick(int lines = 1);
+
+    /**
+     * Drain everything, even while the downstream channel is busy.
+     */
+    void flush();
+
+    /**
+     * @param callback is called whenever an entry is freed
+     */
+    void setSpaceCallback(const std::function<void(void)>& callback)
+    {
+        spaceCallback = callback;
+    }
+
+    /**
+     * @return true if there are that many entries neither used nor reserved
+     */
+    bool hasSpace(int lines = 1) { return (int)fifo.size() + reserved + lines <= numEntries; }
+
+    bool isFull() { return (int)fifo.size() == numEntries; }
+
+    bool isEmpty() { return fifo.empty(); }
+
+  private:
+    /**
+     * @return the slot holding a line, -1 if it is not in the buffer
+     */
+    int find(uint64_t line_address);
+
+    /**
+     * @return true if every byte of the slot's line is there
+     */
+    bool isComplete(int slot);
+
+    /**
+     * Write back the oldest line, or its next aligned piece if only part of
+     * it is there.
+     *
+     * @return true if downstream accepted it
+     */
+    bool drainOne();
+
+    /**
+     * Write back lines while the channel is idle (or there is not the space
+     * someone is waiting for).
+     */
+    void drain();
+
+    int numEntries;
+    int lineSize;
+
+    ResponsePort& downstream;
+
+    /// Storage for the evicted lines
+    SRAMArray dataArray;
+
+    /// The line address held in each slot
+    std::vector<uint64_t> addresses;
+
+    /// The dirty bit of the line in each slot
+    std::vector<bool> dirtyBits;
+
+    /// The bytes of the line each slot holds
+    std::vector<std::vector<bool>> validBytes;
+
+    /// The first byte of a partial line that has not been sent yet
+    std::vector<int> nextByte;
+
+    /// Slots in the order they were inserted
+    std::deque<int> fifo;
+
+    /// Slots that are not holding a line
+    std::vector<int> freeSlots;
+
+    /// Number of entries held for future inserts
+    int reserved;
+
+    /// True if there is a drain event in the queue
+    bool drainScheduled;
+
+    /// True until the buffer is empty after a flush()
+    bool flushing;
+
+    /// Free entries someone is waiting for, see kick()
+    int needed;
+
+    std::function<void(void)> spaceCallback;
+
+    int64_t inserts;
+    int64_t readHits;
+    int64_t fullDrains;
+
+    /// Stores from write(), and inserts merged into an existing entry
+    int64_t writes;
+    int64_t coalesced;
+
+    /// Aligned pieces sent for lines that were only partly there
+    int64_t partialWrites;
+};
+
+#endif // CSIM_WRITEBACK_BUFFER_H
@@ -0,0 +1,145 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "util.hh"
+#include "zcache.hh"
+
+ZCache::ZCache(int64_t size, int line_size, ResponsePort& mem_side,
+               int addr_size, int ways, int levels, int wb_entries) :
+    SetAssociativeCache(size, line_size, mem_side, addr_size, ways, wb_entries),
+    levels(levels), lastUse(size / line_size, 0), useCounter(0),
+    fillAddress(0), fillPending(false), walks(0), walkLookups(0),
+    relocations(0), victimLevels(0)
+{
+    assert(levels > 0);
+    assert(ways > 1);
+    setIndexFunction(IndexFunction::Skewed);
+}
+
+ZCache::~ZCache()
+{
+    std::cout << name << " zcache walks:       " << walks << std::endl;
+    std::cout << name << " zcache candidates:  ";
+    std::cout << (walks ? (float)walkLookups / walks : 0) << " per walk" << std::endl;
+    std::cout << name << " zcache victim level: ";
+    std::cout << (walks ? (float)victimLevels / walks : 0) << " on average" << std::endl;
+    std::cout << name << " zcache relocations: " << relocations << std::endl;
+    if (tagEnergy > 0) {
+        std::cout << name << " zcache walk energy: " << extraEnergy / 1000 << "nJ" << std::endl;
+    }
+}
+
+bool ZCache::receiveRequest(uint64_t address, int size, const uint8_t* data,
+                            int request_id)
+{
+    int line = hit(address);
+    if (!checkCredit() || line >= 0) {
+        if (line >= 0) {
+            touch(line);
+        }
+        return SetAssociativeCache::receiveRequest(address, size, data,
+                                                   request_id);
+    }
+
+    fillAddress = address;
+    fillPending = true;
+    if (!SetAssociativeCache::receiveRequest(address, size, data, request_id)) {
+        fillPending = false;
+        return false;
+    }
+    line = hit(address);
+    if (fillPending && line >= 0) {
+        touch(line); // Recovered without going to memory
+        fillPending = false;
+    }
+    return true;
+}
+
+void ZCache::receiveMemResponse(int request_id, const uint8_t* data)
+{
+    SetAssociativeCache::receiveMemResponse(request_id, data);
+    int line = hit(fillAddress);
+    if (fillPending && line >= 0) {
+        touch(line);
+    }
+    fillPending = false;
+}
+
+int ZCache::findVictim(uint64_t address, int core)
+{
+    makeRoom(address);
+    return SetAssociativeCache::findVictim(address, core); // The freed position
+}
+
+void ZCache::makeRoom(uint64_t address)
+{
+    walks++;
+
+    // Breadth first, so that the shallowest empty line is found first.
+    std::vector<Candidate> candidates;
+    for (int way = 0; way < numberOfWays; way++) {
+        candidates.push_back({getLine(address, way), -1});
+    }
+    size_t level_start = 0;
+    for (int level = 1; level < levels; level++) {
+        size_t level_end = candidates.size();
+        for (size_t i = level_start; i < level_end; i++) {
+            int line = candidates[i].line;
+            if (tagArray.getState(line) == Invalid) continue; // Nothing to move
+            uint64_t line_address = getLineAddress(line);
+            for (int way = 0; way < numberOfWays; way++) {
+                if (way == line % numberOfWays) continue;
+                int next = getLine(line_address, way);
+                bool seen = false;
+                for (auto& candidate : candidates) {
+                    seen = seen || candidate.line == next;
+                }
+                if (!seen) {
+                    candidates.push_back({next, (int)i});
+                }
+            }
+        }
+        level_start = level_end;
+    }
+    walkLookups += candidates.size();
+    // The first level is the miss's own lookup, the rest read one way each.
+    extraEnergy += tagEnergy / numberOfWays * (candidates.size() - numberOfWays);
+
+    // The first empty line, otherwise the least recently used one
+    int victim = 0;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        int line = candidates[i].line;
+        if (tagArray.getState(line) == Invalid) {
+            victim = i;
+            break;
+        }
+        if (lastUse[line] < lastUse[candidates[victim].line]) {
+            victim = i;
+        }
+    }
+    for (int i = victim; i >= 0; i = candidates[i].parent) {
+        victimLevels++;
+    }
+
+    DPRINT("zcache walk found " << candidates.size() << " candidates");
+    evict(candidates[victim].line);
+    for (int i = victim; candidates[i].parent >= 0; i = candidates[i].parent) {
+        relocate(candidates[candidates[i].parent].line, candidates[i].line);
+    }
+}
+
+void ZCache::relocate(int from, int to)
+{
+    assert(tagArray.getState(to) == Invalid);
+    assert(getLine(getLineAddress(from), to % numberOfWays) == to);
+    memcpy(dataArray.getLine(to), dataArray.getLine(from), lineSize);
+    tagArray.setTag(to, tagArray.getTag(from)); // Same tag in every way
+    tagArray.setState(to, tagArray.getState(from));
+    tagArray.setState(from, Invalid);
+    prefetchedLines[to] = prefetchedLines[from];
+    prefetchedLines[from] = false;
+    lastUse[to] = lastUse[from];
+    relocations++;
+}
@@ -0,0 +1,94 @@
+
+#ifndef CSIM_ZCACHE_H
+#define CSIM_ZCACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "set_assoc.hh"
+
+/**
+ * A zcache (Sanchez and Kozyrakis): a skewed associative cache that finds
+ * more replacement candidates than it has ways.
+ *
+ * On a miss the lines in the address's position in each way are the first
+ * candidates. Each of those could move to its own position in the other
+ * ways, so the lines there are candidates too, and so on for a number of
+ * levels (a walk). The least recently used candidate is evicted, and the
+ * lines on the path from it to the first level move down one step
+ * (relocations), which frees a position for the new line.
+ *
+ * With 4 ways and 3 levels there are up to 4 + 12 + 36 = 52 candidates, at
+ * the cost of a tag read for each and a relocation for each level walked.
+ */
+class ZCache : public SetAssociativeCache
+{
+  public:
+    /**
+     * @param levels is how many levels the walk goes down, 1 for a plain
+     *        skewed associative cache
+     */
+    ZCache(int64_t size, int line_size, ResponsePort& mem_side, int addr_size,
+           int ways, int levels, int wb_entries = 8);
+
+    ~ZCache() override;
+
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    void receiveMemResponse(int request_id, const uint8_t* data) override;
+
+  protected:
+    /**
+     * Walk for the victim and free one of the address's positions.
+     */
+    int findVictim(uint64_t address, int core = -1) override;
+
+  private:
+    struct Candidate
+    {
+        int line;
+
+        /// Index of the candidate that would move here, -1 on the first level
+        int parent;
+    };
+
+    /**
+     * Walk the candidates for an address, evict the best one and relocate
+     * lines until a position of the address is empty.
+     */
+    void makeRoom(uint64_t address);
+
+    /**
+     * Move a line to an empty line (another way of its own position).
+     */
+    void relocate(int from, int to);
+
+    /**
+     * Mark a line as just used.
+     */
+    void touch(int line) { lastUse[line] = ++useCounter; }
+
+    int levels;
+
+    /// When each line was last used, for LRU replacement
+    std::vector<int64_t> lastUse;
+
+    int64_t useCounter;
+
+    /// The address of the miss being filled, if fillPending
+    uint64_t fillAddress;
+    bool fillPending;
+
+    int64_t walks;
+
+    /// Tags read by walks, including the first level
+    int64_t walkLookups;
+
+    int64_t relocations;
+
+    /// Sum over walks of the level the victim was found at
+    int64_t victimLevels;
+};
+
+#endif // CSIM_ZCACHE_H